@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2026 Nordic Semiconductor ASA
+#
+# SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+
+"""Unpack compressed modem traces collected from the Serial Modem CMUX trace channel.
+
+The traces are sent in frames:
+
+    offset  size  field
+    0       2     magic "TZ"
+    2       1     flags, bit 0: the data is an LZ4 block, otherwise the data is stored as is
+    3       1     sequence number, incremented by one for each frame
+    4       2     trace length (little endian)
+    6       2     data length (little endian)
+    8       n     data
+"""
+
+import sys
+import argparse
+
+FRAME_MAGIC = b"TZ"
+FRAME_FLAG_LZ4 = 0x01
+FRAME_HDR_LEN = 8
+
+
+def lz4_block_decompress(src: bytes, size: int) -> bytes:
+    """Decompress an LZ4 block of known decompressed size."""
+    dst = bytearray()
+    pos = 0
+
+    while pos < len(src):
+        token = src[pos]
+        pos += 1
+
+        lit_len = token >> 4
+        if lit_len == 15:
+            while True:
+                byte = src[pos]
+                pos += 1
+                lit_len += byte
+                if byte != 255:
+                    break
+        dst += src[pos:pos + lit_len]
+        pos += lit_len
+        if pos >= len(src):
+            break
+
+        offset = src[pos] | (src[pos + 1] << 8)
+        pos += 2
+        if offset == 0 or offset > len(dst):
+            raise ValueError("invalid match offset")
+
+        match_len = token & 0x0F
+        if match_len == 15:
+            while True:
+                byte = src[pos]
+                pos += 1
+                match_len += byte
+                if byte != 255:
+                    break
+        match_len += 4
+        start = len(dst) - offset
+        for i in range(match_len):
+            dst.append(dst[start + i])
+
+    if len(dst) != size:
+        raise ValueError("size mismatch")
+    return bytes(dst)
+
+
+def decode(data: bytes, out, verbose: bool):
+    """Decode the frames of data into out. Returns the statistics as a dict."""
+    stats = {"frames": 0, "trace_bytes": 0, "frame_bytes": 0, "skipped_bytes": 0,
+             "lost_frames": 0}
+    expected_seq = None
+    pos = 0
+
+    while pos + FRAME_HDR_LEN <= len(data):
+        if data[pos:pos + 2] != FRAME_MAGIC:
+            # Resynchronize, for example, after a capture started in the middle of a frame.
+            stats["skipped_bytes"] += 1
+            pos += 1
+            continue
+
+        flags = data[pos + 2]
+        seq = data[pos + 3]
+        trace_len = int.from_bytes(data[pos + 4:pos + 6], "little")
+        data_len = int.from_bytes(data[pos + 6:pos + 8], "little")
+        end = pos + FRAME_HDR_LEN + data_len
+
+        if flags & ~FRAME_FLAG_LZ4 or end > len(data):
+            stats["skipped_bytes"] += 1
+            pos += 1
+            continue
+
+        payload = data[pos + FRAME_HDR_LEN:end]
+        try:
+            if flags & FRAME_FLAG_LZ4:
+                trace = lz4_block_decompress(payload, trace_len)
+            elif data_len == trace_len:
+                trace = payload
+            else:
+                raise ValueError("size mismatch")
+        except (ValueError, IndexError) as e:
+            if verbose:
+                print(f"Invalid frame at offset {pos}: {e}", file=sys.stderr)
+            stats["skipped_bytes"] += 1
+            pos += 1
+            continue
+
+        if expected_seq is not None and seq != expected_seq:
+            lost = (seq - expected_seq) & 0xFF
+            stats["lost_frames"] += lost
+            if verbose:
+                print(f"{lost} frame(s) lost before offset {pos}", file=sys.stderr)
+        expected_seq = (seq + 1) & 0xFF
+
+        out.write(trace)
+        stats["frames"] += 1
+        stats["trace_bytes"] += trace_len
+        stats["frame_bytes"] += end - pos
+        pos = end
+
+    stats["skipped_bytes"] += len(data) - pos
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Unpack compressed modem traces from the Serial Modem CMUX trace channel."
+    )
+    parser.add_argument("input", help="Trace file collected from the CMUX trace channel")
+    parser.add_argument("output", help="Output file for the modem traces")
+    parser.add_argument("-v", "--verbose", action="store_true",
+                        help="Report invalid and lost frames")
+    args = parser.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    with open(args.output, "wb") as out:
+        stats = decode(data, out, args.verbose)
+
+    ratio = 100 * stats["frame_bytes"] / stats["trace_bytes"] if stats["trace_bytes"] else 0
+    print(f"{stats['frames']} frames, {stats['trace_bytes']} trace bytes "
+          f"from {stats['frame_bytes']} bytes ({ratio:.1f} %)")
+    if stats["lost_frames"] or stats["skipped_bytes"]:
+        print(f"{stats['lost_frames']} frames lost, {stats['skipped_bytes']} bytes skipped")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -37,6 +37,7 @@ LOG_MODULE_REGISTER(sm_at_host, CONFIG_SM_LOG_LEVEL);
 #define URC_RETRY_DELAY   K_MSEC(100)
 #define AT_BUF_MIN_SIZE   128
 #define AT_BUF_MAX_SIZE   8192
+#define AT_RX_CHUNK_SIZE  256
 #define AT_XDFU_INIT_CMD  "AT#XDFUINIT"
 #define AT_XDFU_WRITE_CMD "AT#XDFUWRITE"
 #define AT_XDFU_APPLY_CMD "AT#XDFUAPPLY"
@@ -70,12 +71,87 @@ struct data_mode {
 	size_t data_len;     /* Expected data length in data mode. */
 };
 
+/** URC priorities. Lower priority URCs are dropped first when the URC queue is full. */
+enum urc_prio {
+	URC_PRIO_LOW,
+	URC_PRIO_NORMAL,
+	URC_PRIO_HIGH,
+};
+
+/** Classification of URCs by prefix */
+struct urc_class {
+	const char *prefix;
+	enum urc_prio prio;
+	/* Number of leading parameters which, together with the prefix, identify a stream of URCs
+	 * of which only the latest one is of interest. -1 if the URC is never superseded.
+	 */
+	int8_t id_params;
+	/* Number of leading parameters which, together with the prefix, must be equal for a URC to
+	 * supersede the latest queued URC of the same stream. At least id_params.
+	 */
+	int8_t key_params;
+};
+
+static const struct urc_class urc_classes[] = {
+	/* Only URCs with the same registration status are coalesced, so that no change of the
+	 * registration status is hidden from the host.
+	 */
+	{"+CEREG:", URC_PRIO_NORMAL, 0, 1},
+	{"+CSCON:", URC_PRIO_LOW, 0, 0},
+	{"%CESQ:", URC_PRIO_LOW, 0, 0},
+	{"#XAPOLL:", URC_PRIO_LOW, 1, 1},
+	{"#XGNSSPOS:", URC_PRIO_LOW, 0, 0},
+	{"#XSENDNTF:", URC_PRIO_HIGH, -1, -1},
+	{"#XMODEM:", URC_PRIO_HIGH, -1, -1},
+};
+
+/** Lengths of the leading parts of a URC that identify the URCs it supersedes */
+struct urc_key {
+	uint8_t id_len;
+	uint8_t len; /* 0 if the URC is never superseded */
+};
+
+/** Header of a URC in the default URC queue. The URC follows the header. */
+struct urc_entry {
+	uint16_t len;
+	uint8_t prio;
+	struct urc_key key;
+};
+
+#define URC_ENTRY_SIZE(len) (sizeof(struct urc_entry) + (len))
+
 /** Buffered URC message targeting a specific pipe */
 struct urc_msg {
 	sys_snode_t node;
+	struct urc_key key;
+	uint8_t prio;
+	uint8_t size_class; /* Index in urc_msg_classes or URC_MSG_HEAP */
 	char urc[];
 };
 
+/* Pipe-specific URCs are allocated from fixed size classes instead of the system heap.
+ * Only URCs that do not fit in the largest class are allocated from the heap.
+ */
+#define URC_MSG_SMALL_SIZE    64
+#define URC_MSG_SMALL_COUNT   16
+#define URC_MSG_LARGE_SIZE    256
+#define URC_MSG_LARGE_COUNT   8
+#define URC_MSG_HEAP          UINT8_MAX
+/* Time that a producer outside of sm_work_q waits for the host to drain buffered URCs */
+#define URC_MSG_ALLOC_TIMEOUT K_MSEC(500)
+
+K_MEM_SLAB_DEFINE_STATIC(urc_msg_small_slab, URC_MSG_SMALL_SIZE, URC_MSG_SMALL_COUNT, 4);
+K_MEM_SLAB_DEFINE_STATIC(urc_msg_large_slab, URC_MSG_LARGE_SIZE, URC_MSG_LARGE_COUNT, 4);
+
+static struct {
+	struct k_mem_slab *slab;
+	size_t size;
+	atomic_t max_used;
+} urc_msg_classes[] = {
+	{.slab = &urc_msg_small_slab, .size = URC_MSG_SMALL_SIZE},
+	{.slab = &urc_msg_large_slab, .size = URC_MSG_LARGE_SIZE},
+};
+
 /* Forward declarations */
 static void idle_timer_handler(struct k_timer *timer);
 static void idle_work(struct sm_at_host_ctx *ctx);
@@ -83,7 +159,8 @@ static void raw_send_scheduled(struct k_work *work);
 static void at_pipe_rx_work_fn(struct k_work *work);
 static void at_pipe_event_handler(struct modem_pipe *pipe, enum modem_pipe_event event,
 				  void *user_data);
-static size_t sm_at_receive(struct sm_at_host_ctx *ctx, uint8_t c);
+static size_t sm_at_receive(struct sm_at_host_ctx *ctx, struct modem_pipe *pipe,
+			    const uint8_t *buf, size_t len);
 static void sm_at_host_work_fn(struct k_work *work);
 static enum sm_operation_mode get_sm_mode(struct sm_at_host_ctx *ctx);
 static bool sm_at_ctx_check(struct sm_at_host_ctx *ctx);
@@ -91,6 +168,14 @@ static void sm_at_host_event_notify(struct sm_at_host_ctx *ctx, enum sm_event ev
 static void check_idle_timer(struct sm_at_host_ctx *ctx, bool reschedule);
 static void send_urcs(struct sm_at_host_ctx *ctx);
 static void flush_pipe_urcs(struct sm_at_host_ctx *ctx);
+static void pipeline_run(struct sm_at_host_ctx *ctx);
+static bool pipeline_can_receive(struct sm_at_host_ctx *ctx);
+
+/* Echo gathered from a received chunk, to be sent with a single transmit. */
+struct echo_buf {
+	uint8_t data[AT_RX_CHUNK_SIZE + sizeof(CRLF_STR)];
+	size_t len;
+};
 
 /**
  * @brief AT host context structure.
@@ -104,9 +189,9 @@ static void flush_pipe_urcs(struct sm_at_host_ctx *ctx);
  * [*] --> Attached: sm_at_host_attach(pipe)
  * Attached: modem_pipe_attach(pipe, null_pipe_handler, NULL)
  * Attached --> Create: MODEM_PIPE_EVENT_OPENED
- * state allocated as "Memory is allocated for context" {
+ * state allocated as "Context slot is allocated" {
  * Create: sm_at_host_create()
- * Create: modem_pipe_attach(pipe, at_pipe_event_handler, ctx)
+ * Create: modem_pipe_attach(pipe, at_pipe_event_handler, handle)
  * Create --> Open
  * Open --> Open: MODEM_PIPE_EVENT_RECEIVE_READY\nk_work_submit(...,at_pipe_rx_work_fn)
  * Open --> Closing: MODEM_PIPE_EVENT_CLOSED
@@ -119,7 +204,8 @@ static void flush_pipe_urcs(struct sm_at_host_ctx *ctx);
  * Idle: modem_pipe_attach(pipe, null_pipe_handler, NULL)
  * Idle -up-> Create: MODEM_PIPE_EVENT_OPENED
  * }
- * Destroy: free(ctx->data_rb_buf)\nfree(ctx->at_buf)\nfree(ctx)
+ * Destroy: free(ctx->data_rb_buf)\nfree(ctx->at_buf)\nfree(ctx->pipeline_buf)
+ * Destroy: ctx_slot_free(ctx)
  * Destroy --> [*]
  * @enduml
  *
@@ -128,6 +214,9 @@ struct sm_at_host_ctx {
 	/* List node for instance management */
 	sys_snode_t node;
 
+	/* Handle of the context, 0 when the context is not in use */
+	atomic_t handle;
+
 	/* Pipe instance reference */
 	atomic_ptr_t pipe;
 	struct k_event pipe_event;
@@ -144,17 +233,32 @@ struct sm_at_host_ctx {
 	uint8_t quit_str_match;
 	struct k_mutex mutex_data;
 
+	/* Data read with modem_pipe_receive() from rx_pipe and not yet dispatched */
+	uint8_t rx_buf[AT_RX_CHUNK_SIZE];
+	struct modem_pipe *rx_pipe;
+	size_t rx_head;
+	size_t rx_len;
+
 	/* Work items and timers */
 	struct k_work rx_work;
 	struct k_work raw_send_scheduled_work;
 	struct k_timer data_inactivity_timer;
 	struct k_timer idle_timer;
+	/* Uptime (in ticks) of the last data mode RX chunk. */
+	atomic_t data_rx_ticks;
 
 	/* AT command reception state (for cmd_rx_handler) */
 	bool inside_quotes;
 	atomic_t executing_lock;
 	size_t at_cmd_len;
 	size_t echo_len;
+	struct echo_buf echo;
+
+	/* Pipelined command queue of NUL-terminated commands, allocated when first enabled */
+	bool pipeline;
+	uint8_t *pipeline_buf;
+	size_t pipeline_head;
+	size_t pipeline_used;
 	uint8_t prev_character;
 
 	/* null_handler state */
@@ -178,7 +282,7 @@ enum sm_pipe_event {
 };
 
 struct sm_at_host_msg {
-	struct sm_at_host_ctx *ctx;
+	uint32_t ctx_handle;
 	struct modem_pipe *pipe;
 	enum sm_pipe_event pipe_event;
 	enum sm_event sm_event;
@@ -186,8 +290,64 @@ struct sm_at_host_msg {
 K_MSGQ_DEFINE(sm_at_host_msgq, sizeof(struct sm_at_host_msg), 10, 1);
 
 static sys_slist_t instance_list = SYS_SLIST_STATIC_INIT(instance_list);
+
+/* Contexts are allocated from a fixed-size table and referred to by handles, which combine the
+ * table index with a generation counter that is incremented every time the slot is reused.
+ * Handles are used where a context reference can outlive the context (pipe user data and
+ * AT host messages), so that a reference to a destroyed context is detected in O(1).
+ */
+#if defined(CONFIG_SM_CMUX)
+#define AT_HOST_CTX_COUNT (CONFIG_SM_CMUX_CHANNEL_COUNT + 1)
+#else
+#define AT_HOST_CTX_COUNT 1
+#endif
+#define CTX_HANDLE_INDEX_BITS 8
+#define CTX_HANDLE_INDEX_MASK BIT_MASK(CTX_HANDLE_INDEX_BITS)
+#define CTX_HANDLE_GEN_MASK   BIT_MASK(32 - CTX_HANDLE_INDEX_BITS)
+BUILD_ASSERT(AT_HOST_CTX_COUNT <= CTX_HANDLE_INDEX_MASK);
+
+static struct sm_at_host_ctx ctx_pool[AT_HOST_CTX_COUNT];
+static struct {
+	uint32_t generation;
+	bool used;
+} ctx_slots[AT_HOST_CTX_COUNT];
+
+/* Pipes attached to at_pipe_event_handler() and the handle of the context given as their user
+ * data, so that the context of a pipe is found without looking into the pipe. An entry is kept
+ * until the AT host detaches or releases the pipe, also after the context is destroyed.
+ */
+static struct {
+	struct modem_pipe *pipe;
+	uint32_t handle;
+} pipe_handles[AT_HOST_CTX_COUNT];
+
+/* Pipe of a context that is being destroyed. The pipe is swapped for this with a CAS, so that
+ * the context is destroyed only once. It is never equal to a real pipe.
+ */
+static uint8_t ctx_pipe_destroying;
+#define CTX_PIPE_DESTROYING ((void *)&ctx_pipe_destroying)
+
 static K_WORK_DEFINE(sm_at_host_work, sm_at_host_work_fn);
-RING_BUF_DECLARE(urc_buf, CONFIG_SM_URC_BUFFER_SIZE);
+
+/* URCs for the default context, stored back-to-back in a ring buffer in the order they were sent.
+ * Offsets of URCs are relative to the head of the queue.
+ */
+static struct {
+	uint8_t buf[CONFIG_SM_URC_BUFFER_SIZE];
+	size_t head;
+	size_t used;
+	/* Set while send_urcs() transmits the first URC, which must then stay in place. */
+	bool sending;
+} urc_queue;
+static K_MUTEX_DEFINE(urc_queue_mutex);
+
+static struct {
+	atomic_t coalesced;
+	atomic_t dropped;
+	atomic_t queue_max_used;
+} urc_stats;
+
+/* Commands of all contexts are executed one at a time in sm_work_q, so they share the buffer. */
 static uint8_t sm_response_buf[CONFIG_SM_AT_BUF_SIZE + 1];
 /* Current executing context (set by entry points) */
 static struct sm_at_host_ctx *current_ctx;
@@ -220,6 +380,109 @@ static struct sm_at_host_ctx *sm_at_host_create(struct modem_pipe *pipe);
  */
 static int sm_at_host_destroy(struct sm_at_host_ctx *ctx);
 
+static inline uint32_t ctx_handle_get(struct sm_at_host_ctx *ctx)
+{
+	return ctx ? (uint32_t)atomic_get(&ctx->handle) : 0;
+}
+
+/* Pipe user data is the context handle, not a pointer to the context. */
+static inline void *ctx_user_data(struct sm_at_host_ctx *ctx)
+{
+	return (void *)(uintptr_t)ctx_handle_get(ctx);
+}
+
+/**
+ * @brief Get the context of a handle.
+ *
+ * @return Pointer to the context, or NULL if the handle does not refer to a live context.
+ */
+static struct sm_at_host_ctx *ctx_from_handle(uint32_t handle)
+{
+	const size_t index = handle & CTX_HANDLE_INDEX_MASK;
+
+	if (handle == 0 || index >= ARRAY_SIZE(ctx_pool)) {
+		return NULL;
+	}
+
+	return (atomic_get(&ctx_pool[index].handle) == handle) ? &ctx_pool[index] : NULL;
+}
+
+/* Reserve a free slot from the context table. Returns the slot index or -ENOMEM. */
+static int ctx_slot_alloc(void)
+{
+	int index = -ENOMEM;
+
+	K_SPINLOCK(&sm_at_host_lock) {
+		for (size_t i = 0; i < ARRAY_SIZE(ctx_slots); i++) {
+			if (!ctx_slots[i].used) {
+				ctx_slots[i].used = true;
+				ctx_slots[i].generation =
+					(ctx_slots[i].generation + 1) & CTX_HANDLE_GEN_MASK;
+				if (ctx_slots[i].generation == 0) {
+					ctx_slots[i].generation = 1;
+				}
+				index = i;
+				break;
+			}
+		}
+	}
+
+	return index;
+}
+
+static void ctx_slot_free(struct sm_at_host_ctx *ctx)
+{
+	K_SPINLOCK(&sm_at_host_lock) {
+		ctx_slots[ctx - ctx_pool].used = false;
+	}
+}
+
+/* Record the handle a pipe is attached to the AT host with, or 0 when the pipe is detached. */
+static void pipe_handle_set(struct modem_pipe *pipe, uint32_t handle)
+{
+	bool full = (handle != 0);
+
+	K_SPINLOCK(&sm_at_host_lock) {
+		size_t index = ARRAY_SIZE(pipe_handles);
+
+		for (size_t i = 0; i < ARRAY_SIZE(pipe_handles); i++) {
+			if (pipe_handles[i].pipe == pipe) {
+				index = i;
+				break;
+			}
+			if (!pipe_handles[i].pipe && index == ARRAY_SIZE(pipe_handles)) {
+				index = i;
+			}
+		}
+		if (index < ARRAY_SIZE(pipe_handles)) {
+			pipe_handles[index].pipe = handle ? pipe : NULL;
+			pipe_handles[index].handle = handle;
+			full = false;
+		}
+	}
+
+	if (full) {
+		LOG_ERR("No room to record pipe %p", (void *)pipe);
+	}
+}
+
+/* Get the handle a pipe is attached to the AT host with, or 0 if it is not attached. */
+static uint32_t pipe_handle_get(struct modem_pipe *pipe)
+{
+	uint32_t handle = 0;
+
+	K_SPINLOCK(&sm_at_host_lock) {
+		for (size_t i = 0; i < ARRAY_SIZE(pipe_handles); i++) {
+			if (pipe_handles[i].pipe == pipe) {
+				handle = pipe_handles[i].handle;
+				break;
+			}
+		}
+	}
+
+	return handle;
+}
+
 static void send_msg(struct sm_at_host_msg msg)
 {
 	int ret;
@@ -233,8 +496,10 @@ static void send_msg(struct sm_at_host_msg msg)
 	if (ret < 0) {
 		if (ret == -ENODEV) {
 			/* sm_work_q is not yet running */
-			if (msg.ctx) {
-				check_idle_timer(msg.ctx, true);
+			struct sm_at_host_ctx *ctx = ctx_from_handle(msg.ctx_handle);
+
+			if (ctx) {
+				check_idle_timer(ctx, true);
 				return;
 			}
 		}
@@ -245,7 +510,7 @@ static void send_msg(struct sm_at_host_msg msg)
 static void sm_at_pipe_opened(struct sm_at_host_ctx *ctx, struct modem_pipe *pipe)
 {
 	struct sm_at_host_msg msg = {
-		.ctx = ctx,
+		.ctx_handle = ctx_handle_get(ctx),
 		.pipe = pipe,
 		.pipe_event = SM_PIPE_EVENT_OPENED,
 	};
@@ -273,7 +538,7 @@ static void sm_at_pipe_opened(struct sm_at_host_ctx *ctx, struct modem_pipe *pip
 static void sm_at_pipe_closed(struct sm_at_host_ctx *ctx, struct modem_pipe *pipe)
 {
 	struct sm_at_host_msg msg = {
-		.ctx = ctx,
+		.ctx_handle = ctx_handle_get(ctx),
 		.pipe = pipe,
 		.pipe_event = SM_PIPE_EVENT_CLOSED,
 	};
@@ -316,19 +581,32 @@ struct sm_at_host_ctx *sm_at_host_get_current(void)
 
 struct sm_at_host_ctx *sm_at_host_get_ctx_from(struct modem_pipe *pipe)
 {
-	struct sm_at_host_ctx *ctx;
+	struct sm_at_host_ctx *ctx = NULL;
+	uint32_t handle;
 
 	if (!pipe) {
 		return NULL;
 	}
 
-	K_SPINLOCK(&sm_at_host_lock) {
-		SYS_SLIST_FOR_EACH_CONTAINER(&instance_list, ctx, node) {
-			if (atomic_ptr_get(&ctx->pipe) == pipe) {
-				break;
-			}
+	handle = pipe_handle_get(pipe);
+	if (handle != 0) {
+		/* The pipe is attached to the AT host. */
+		ctx = ctx_from_handle(handle);
+		if (ctx && atomic_ptr_get(&ctx->pipe) == pipe) {
+			return ctx;
+		}
+		return NULL;
+	}
+
+	/* Pipe temporarily attached elsewhere, look through the context table. */
+	for (size_t i = 0; i < ARRAY_SIZE(ctx_pool); i++) {
+		if (atomic_get(&ctx_pool[i].handle) != 0 &&
+		    atomic_ptr_get(&ctx_pool[i].pipe) == pipe) {
+			ctx = &ctx_pool[i];
+			break;
 		}
 	}
+
 	return ctx;
 }
 
@@ -384,28 +662,31 @@ struct modem_pipe *sm_at_host_get_pipe_from_poll_ctx(struct async_poll_ctx *poll
 /**
  * @brief Check if ctx pointer is still valid.
  *
+ * The handle of a live context refers to its own slot and to the current generation of the slot.
+ * The work items and timers of a context are cancelled when it is destroyed, so they cannot
+ * refer to a reused slot.
+ *
  * @param ctx
  * @return true ctx is valid
  * @return false ctx is already destroyed
  */
 static bool sm_at_ctx_check(struct sm_at_host_ctx *ctx)
 {
-	struct sm_at_host_ctx *p;
-	bool found = false;
+	const uintptr_t offset = (uintptr_t)ctx - (uintptr_t)ctx_pool;
+	uint32_t handle;
+	size_t index;
 
-	if (!ctx) {
+	if (!ctx || (uintptr_t)ctx < (uintptr_t)ctx_pool || offset >= sizeof(ctx_pool) ||
+	    offset % sizeof(ctx_pool[0]) != 0) {
 		return false;
 	}
 
-	K_SPINLOCK(&sm_at_host_lock) {
-		SYS_SLIST_FOR_EACH_CONTAINER(&instance_list, p, node) {
-			if (p == ctx) {
-				found = true;
-				break;
-			}
-		}
-	}
-	return found;
+	index = ctx - ctx_pool;
+	handle = (uint32_t)atomic_get(&ctx->handle);
+
+	return handle != 0 && (handle & CTX_HANDLE_INDEX_MASK) == index &&
+	       ctx_slots[index].used &&
+	       (handle >> CTX_HANDLE_INDEX_BITS) == ctx_slots[index].generation;
 }
 
 static void check_idle_timer(struct sm_at_host_ctx *ctx, bool reschedule)
@@ -426,8 +707,8 @@ static void check_idle_timer(struct sm_at_host_ctx *ctx, bool reschedule)
 static void at_pipe_rx_work_fn(struct k_work *work)
 {
 	struct sm_at_host_ctx *ctx = CONTAINER_OF(work, struct sm_at_host_ctx, rx_work);
+	size_t consumed = 0;
 	int ret;
-	uint8_t rx_buf;
 
 	if (!sm_at_ctx_check(ctx)) {
 		LOG_ERR("AT pipe RX work: context destroyed");
@@ -441,28 +722,64 @@ static void at_pipe_rx_work_fn(struct k_work *work)
 		return;
 	}
 
-	/* Do not parse more commands, if we are still executing */
-	if (atomic_get(&ctx->executing_lock) > 0) {
+	/* Do not parse more commands, if we are still executing and they cannot be queued */
+	if (atomic_get(&ctx->executing_lock) > 0 && !ctx->pipeline) {
 		return;
 	}
 
 	/* Set as current context */
 	sm_at_host_set_current_ctx(ctx);
 
-	/* Read data from ctx->pipe */
+	pipeline_run(ctx);
+
+	if (ctx->rx_len > 0 && ctx->rx_pipe != pipe) {
+		LOG_WRN("Dropped %zu bytes received before the pipe was switched", ctx->rx_len);
+		ctx->rx_len = 0;
+	}
+
+	/* Drain ctx->pipe in chunks. Dispatching stops when the pipe is handed over or a command
+	 * is executing, in which case the rest of the data is left for later.
+	 */
 	do {
-		ret = modem_pipe_receive(pipe, &rx_buf, sizeof(rx_buf));
+		if (!pipeline_can_receive(ctx)) {
+			/* Leave the data in the pipe until queued commands have been executed */
+			break;
+		}
+		if (pipe == sm_uart_pipe_get()) {
+			/* Parse in place in the UART RX buffer. Data mode takes whole RX buffers,
+			 * AT command mode takes chunks for the pipelined command flow control.
+			 */
+			const uint8_t *data;
+			const size_t max_len =
+				(get_sm_mode(ctx) == SM_DATA_MODE) ? SIZE_MAX : AT_RX_CHUNK_SIZE;
+
+			ret = sm_uart_pipe_rx_claim(&data, max_len);
+			if (ret > 0) {
+				consumed = sm_at_receive(ctx, pipe, data, ret);
+				sm_uart_pipe_rx_release(consumed);
+			}
+		} else {
+			if (ctx->rx_len == 0) {
+				ret = modem_pipe_receive(pipe, ctx->rx_buf, sizeof(ctx->rx_buf));
+				if (ret > 0) {
+					ctx->rx_pipe = pipe;
+					ctx->rx_head = 0;
+					ctx->rx_len = ret;
+				}
+			}
+			if (ctx->rx_len > 0) {
+				ret = ctx->rx_len;
+				consumed = sm_at_receive(ctx, pipe, &ctx->rx_buf[ctx->rx_head],
+							 ctx->rx_len);
+				ctx->rx_head += consumed;
+				ctx->rx_len -= consumed;
+			}
+		}
 		if (ret < 0) {
 			LOG_ERR("Pipe receive failed: %d (ctx %p, pipe %p)", ret, (void *)ctx,
 				(void *)pipe);
-			break;
 		}
-
-		if (ret > 0) {
-			/* Process received AT data */
-			sm_at_receive(ctx, rx_buf);
-		}
-	} while (ret > 0 && atomic_ptr_get(&ctx->pipe) == pipe);
+	} while (ret > 0 && consumed == (size_t)ret && atomic_ptr_get(&ctx->pipe) == pipe);
 
 	/* Clear current context */
 	sm_at_host_set_current_ctx(NULL);
@@ -473,9 +790,9 @@ static void at_pipe_event_handler(struct modem_pipe *pipe, enum modem_pipe_event
 				  void *user_data)
 {
 	int ret;
-	struct sm_at_host_ctx *ctx = (struct sm_at_host_ctx *)user_data;
+	struct sm_at_host_ctx *ctx = ctx_from_handle((uint32_t)(uintptr_t)user_data);
 
-	if (!ctx || !sm_at_ctx_check(ctx)) {
+	if (!ctx) {
 		LOG_ERR("Invalid context in pipe event handler");
 		return;
 	}
@@ -520,15 +837,23 @@ static int sm_at_host_pipe_tx_blocking(struct sm_at_host_ctx *ctx, const uint8_t
 	}
 
 	for (size_t len = size; len > 0;) {
+		/* Clear before transmitting, so that a transmit idle event is not missed. */
+		k_event_clear(&ctx->pipe_event, BIT(MODEM_PIPE_EVENT_TRANSMIT_IDLE));
 		ret = modem_pipe_transmit(pipe, buf, len);
 		if (ret < 0) {
 			LOG_ERR("Pipe transmit failed: %d (ctx %p, pipe %p)", ret, (void *)ctx,
 				(void *)pipe);
 			return ret;
 		} else if (ret == 0) {
-			/* No data transmitted, wait for transmit idle event */
-			if (k_event_wait(&ctx->pipe_event, BIT(MODEM_PIPE_EVENT_TRANSMIT_IDLE),
-					 true, K_MSEC(100)) == 0) {
+			/* No data transmitted, wait until TX buffer space is freed. */
+			if (pipe == sm_uart_pipe_get()) {
+				ret = sm_uart_pipe_tx_wait(K_MSEC(100));
+			} else {
+				ret = k_event_wait(&ctx->pipe_event,
+						   BIT(MODEM_PIPE_EVENT_TRANSMIT_IDLE), false,
+						   K_MSEC(100)) ? 0 : -EAGAIN;
+			}
+			if (ret) {
 				if (--retries == 0) {
 					LOG_ERR("Pipe blocked, dropping %d bytes", len);
 					return -EIO;
@@ -554,6 +879,20 @@ static void null_pipe_handler(struct modem_pipe *pipe, enum modem_pipe_event eve
 	}
 }
 
+/* Attach a pipe to the AT host for a context. */
+static void at_pipe_attach(struct sm_at_host_ctx *ctx, struct modem_pipe *pipe)
+{
+	pipe_handle_set(pipe, ctx_handle_get(ctx));
+	modem_pipe_attach(pipe, at_pipe_event_handler, ctx_user_data(ctx));
+}
+
+/* Detach a pipe from its context, but keep listening for it to be opened. */
+static void at_pipe_detach(struct modem_pipe *pipe)
+{
+	pipe_handle_set(pipe, 0);
+	modem_pipe_attach(pipe, null_pipe_handler, NULL);
+}
+
 int sm_at_host_set_pipe(struct sm_at_host_ctx *ctx, struct modem_pipe *pipe)
 {
 	if (!ctx || !pipe) {
@@ -573,20 +912,21 @@ int sm_at_host_set_pipe(struct sm_at_host_ctx *ctx, struct modem_pipe *pipe)
 
 	/* Release old pipe if attached */
 	if (old_pipe) {
-		modem_pipe_attach(old_pipe, null_pipe_handler, NULL);
+		at_pipe_detach(old_pipe);
 	}
 
 	/* Release old CTX if the pipe had one */
 	struct sm_at_host_ctx *old_ctx = sm_at_host_get_ctx_from(pipe);
 
-	if (old_ctx && old_ctx != ctx && atomic_ptr_cas(&old_ctx->pipe, pipe, (void *)0xdeadbeef)) {
+	if (old_ctx && old_ctx != ctx && atomic_ptr_cas(&old_ctx->pipe, pipe, CTX_PIPE_DESTROYING)) {
 		LOG_DBG("Pipe %p already attached to another context %p, destroying old context",
 			(void *)pipe, (void *)old_ctx);
 		sm_at_host_destroy(old_ctx);
 	}
 
 	/* Attach to new pipe */
-	modem_pipe_attach(pipe, at_pipe_event_handler, ctx);
+	at_pipe_attach(ctx, pipe);
+	sm_uart_rx_fc_mode_update();
 	return 0;
 }
 
@@ -600,7 +940,9 @@ void sm_at_host_release(struct sm_at_host_ctx *ctx)
 
 	pipe = atomic_ptr_get(&ctx->pipe);
 	modem_pipe_release(pipe);
+	pipe_handle_set(pipe, 0);
 	sm_at_pipe_closed(ctx, pipe);
+	sm_uart_rx_fc_mode_update();
 
 	LOG_DBG("Releasing AT host pipe: %p (ctx: %p)", (void *)pipe, (void *)ctx);
 }
@@ -610,7 +952,8 @@ void sm_at_host_attach(struct modem_pipe *pipe)
 	if (!pipe) {
 		return;
 	}
-	modem_pipe_attach(pipe, null_pipe_handler, NULL);
+	at_pipe_detach(pipe);
+	sm_uart_rx_fc_mode_update();
 	if (sm_pipe_is_open(pipe)) {
 		sm_at_pipe_opened(NULL, pipe);
 	}
@@ -662,6 +1005,7 @@ static bool set_sm_mode(struct sm_at_host_ctx *ctx, enum sm_operation_mode mode)
 	if (ret) {
 		LOG_DBG("SM mode changed: %d -> %d", ctx->at_mode, mode);
 		ctx->at_mode = mode;
+		sm_uart_rx_fc_mode_update();
 	} else {
 		LOG_ERR("Failed to change SM mode: %d -> %d", ctx->at_mode, mode);
 	}
@@ -672,7 +1016,7 @@ static bool set_sm_mode(struct sm_at_host_ctx *ctx, enum sm_operation_mode mode)
 static void sm_at_host_event_notify(struct sm_at_host_ctx *ctx, enum sm_event event)
 {
 	send_msg((struct sm_at_host_msg){
-		.ctx = ctx,
+		.ctx_handle = ctx_handle_get(ctx),
 		.sm_event = event,
 	});
 }
@@ -768,6 +1112,10 @@ static void write_data_buf(const uint8_t *buf, size_t len)
 	size_t ret;
 	size_t index = 0;
 
+	if (len == 0) {
+		return;
+	}
+
 	/* Reset the ring buffer so that UDP packets have enough continuous space. */
 	if (ring_buf_is_empty(&ctx->data_rb)) {
 		ring_buf_reset(&ctx->data_rb);
@@ -812,6 +1160,17 @@ static void inactivity_timer_handler(struct k_timer *timer)
 {
 	struct sm_at_host_ctx *ctx =
 		CONTAINER_OF(timer, struct sm_at_host_ctx, data_inactivity_timer);
+	const uint32_t limit = k_ms_to_ticks_ceil32(ctx->data_mode.time_limit);
+	const uint32_t idle =
+		(uint32_t)k_uptime_ticks() - (uint32_t)atomic_get(&ctx->data_rx_ticks);
+
+	/* The timer is not restarted on every RX chunk. Check again if data was received
+	 * after the timer was started.
+	 */
+	if (idle < limit) {
+		k_timer_start(timer, K_TICKS(limit - idle), K_NO_WAIT);
+		return;
+	}
 
 	LOG_DBG("Time limit reached");
 	if (!ring_buf_is_empty(&ctx->data_rb)) {
@@ -821,44 +1180,108 @@ static void inactivity_timer_handler(struct k_timer *timer)
 	}
 }
 
-/* Search for quit_str and send data prior to that. Tracks quit_str over several calls. */
-static size_t raw_rx_handler(struct sm_at_host_ctx *ctx, uint8_t c)
+#define QUIT_STR_LEN (sizeof(CONFIG_SM_DATAMODE_TERMINATOR) - 1)
+BUILD_ASSERT(QUIT_STR_LEN > 0, "Data mode terminator cannot be empty");
+
+/* Returns the number of quit_str characters, starting from offset, matched at the start of buf. */
+static size_t quit_str_match_len(size_t offset, const uint8_t *buf, size_t len)
 {
-	k_mutex_lock(&ctx->mutex_data, K_FOREVER);
+	const char *const quit_str = CONFIG_SM_DATAMODE_TERMINATOR;
+	size_t i = 0;
+
+	while (offset + i < QUIT_STR_LEN && i < len && buf[i] == (uint8_t)quit_str[offset + i]) {
+		i++;
+	}
+
+	return i;
+}
 
+/* Search for quit_str and send data prior to that. Tracks quit_str over several calls.
+ * Returns the number of bytes consumed, which is less than len if data mode was exited.
+ *
+ * The chunk is scanned with memchr() for the first quit_str character and the data between
+ * candidates is written to the data buffer as a whole.
+ */
+static size_t raw_rx_handler(struct sm_at_host_ctx *ctx, const uint8_t *buf, size_t len)
+{
 	const char *const quit_str = CONFIG_SM_DATAMODE_TERMINATOR;
+	size_t processed = 0;
+	size_t match;
+
+	k_mutex_lock(&ctx->mutex_data, K_FOREVER);
 
 	/* If <data_len> is set in datamode, skip searching for quit_str. Just send data until
 	 * length is reached.
 	 */
 	if (ctx->data_mode.data_len > 0) {
-		write_data_buf(&c, 1);
-		ctx->data_mode.data_len--;
+		processed = MIN(len, ctx->data_mode.data_len);
+		write_data_buf(buf, processed);
+		ctx->data_mode.data_len -= processed;
 		if (ctx->data_mode.data_len == 0) {
 			raw_send(SM_DATAMODE_FLAGS_NONE);
 			(void)exit_datamode(ctx);
 		}
-	} else {
-retry_match:	/* Find quit_str or partial match at the end of the buffer. */
-		if (c == quit_str[ctx->quit_str_match]) {
-			ctx->quit_str_match++;
-			if (ctx->quit_str_match == strlen(quit_str)) {
-				raw_send(SM_DATAMODE_FLAGS_NONE);
-				(void)exit_datamode(ctx);
-				ctx->quit_str_match = 0;
-			}
-		} else if (ctx->quit_str_match > 0) {
-			/* Write data which was previously interpreted as a possible quit_str. */
-			write_data_buf(quit_str, ctx->quit_str_match);
-			ctx->quit_str_match = 0;
-			goto retry_match;
-		} else {
-			write_data_buf(&c, 1);
+		goto unlock;
+	}
+
+	/* Continue a partial match from the end of the previous chunk. */
+	if (ctx->quit_str_match > 0) {
+		match = quit_str_match_len(ctx->quit_str_match, buf, len);
+		if (ctx->quit_str_match + match == QUIT_STR_LEN) {
+			processed = match;
+			goto quit_str_found;
+		}
+		if (match == len) {
+			ctx->quit_str_match += match;
+			processed = len;
+			goto unlock;
+		}
+		/* Write data which was previously interpreted as a possible quit_str.
+		 * The matched part of this chunk is written as data with the rest of the chunk.
+		 */
+		write_data_buf(quit_str, ctx->quit_str_match);
+		ctx->quit_str_match = 0;
+		processed = match;
+	}
+
+	while (processed < len) {
+		const uint8_t *candidate = memchr(buf + processed, quit_str[0], len - processed);
+
+		if (!candidate) {
+			break;
+		}
+
+		const size_t pos = candidate - buf;
+
+		match = quit_str_match_len(0, candidate, len - pos);
+		if (match == QUIT_STR_LEN) {
+			write_data_buf(buf, pos);
+			processed = pos + match;
+			goto quit_str_found;
+		}
+		if (pos + match == len) {
+			/* Partial match at the end of the chunk, resolved by the next chunk. */
+			write_data_buf(buf, pos);
+			ctx->quit_str_match = match;
+			processed = len;
+			goto unlock;
 		}
+		/* Not a quit_str, retry from the mismatching character. */
+		processed = pos + match;
 	}
+
+	write_data_buf(buf, len);
+	processed = len;
+	goto unlock;
+
+quit_str_found:
+	ctx->quit_str_match = 0;
+	raw_send(SM_DATAMODE_FLAGS_NONE);
+	(void)exit_datamode(ctx);
+unlock:
 	k_mutex_unlock(&ctx->mutex_data);
 
-	return 1;
+	return processed;
 }
 
 /*
@@ -954,73 +1377,458 @@ static int cmd_grammar_check(const char *cmd, size_t length)
 		}
 	}
 
-	/* no need to check AT<separator><body>=<parameters><NULL> */
-	return 0;
+	/* no need to check AT<separator><body>=<parameters><NULL> */
+	return 0;
+}
+
+/**
+ * @brief Find the final result code of a modem response.
+ *
+ * The final result code is the last line of the response, so it is found with a single backward
+ * pass from the end of the response.
+ *
+ * @return Offset of the final result code, or -ENOENT if the response does not end with one.
+ */
+static int find_final_result(const char *buf, size_t len)
+{
+	static const char *const final_results[] = {
+		"OK\r\n", "ERROR\r\n", "+CME ERROR:", "+CMS ERROR:"
+	};
+	size_t start;
+
+	if (len < strlen(CRLF_STR) || buf[len - 2] != CR || buf[len - 1] != LF) {
+		return -ENOENT;
+	}
+
+	start = len - strlen(CRLF_STR);
+	while (start > 0 && buf[start - 1] != LF) {
+		start--;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(final_results); i++) {
+		const size_t result_len = strlen(final_results[i]);
+
+		if (len - start >= result_len &&
+		    memcmp(&buf[start], final_results[i], result_len) == 0) {
+			return start;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Offset of the end of the leading parameters of a URC, or 0 if it does not fit in a key. */
+static uint8_t urc_key_end(const uint8_t *data, size_t len, size_t end, int params)
+{
+	/* The key ends before the first parameter that is not part of it. */
+	while (params > 0 && end < len && data[end] != CR && data[end] != LF) {
+		if (data[end] == ',' && --params == 0) {
+			break;
+		}
+		end++;
+	}
+
+	return (end <= UINT8_MAX) ? end : 0;
+}
+
+/**
+ * @brief Classify a URC by its prefix.
+ *
+ * @param[out] prio Priority of the URC.
+ * @return Key identifying the URCs that this one supersedes.
+ */
+static struct urc_key urc_classify(const uint8_t *data, size_t len, enum urc_prio *prio)
+{
+	struct urc_key key = {0};
+	size_t start = 0;
+
+	*prio = URC_PRIO_NORMAL;
+
+	while (start < len && (data[start] == CR || data[start] == LF)) {
+		start++;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(urc_classes); i++) {
+		const struct urc_class *cls = &urc_classes[i];
+		const size_t prefix_len = strlen(cls->prefix);
+
+		if (len - start < prefix_len || memcmp(&data[start], cls->prefix, prefix_len)) {
+			continue;
+		}
+
+		*prio = cls->prio;
+		if (cls->id_params < 0) {
+			break;
+		}
+
+		key.id_len = urc_key_end(data, len, start + prefix_len, cls->id_params);
+		key.len = urc_key_end(data, len, start + prefix_len, cls->key_params);
+		if (!key.id_len) {
+			key.len = 0;
+		}
+		break;
+	}
+
+	return key;
+}
+
+/* Position in the buffer of a queue offset. Requires urc_queue_mutex. */
+static inline size_t urc_queue_pos(size_t offset)
+{
+	return (urc_queue.head + offset) % sizeof(urc_queue.buf);
+}
+
+/* Requires urc_queue_mutex. */
+static void urc_queue_read(size_t offset, void *dst, size_t len)
+{
+	const size_t pos = urc_queue_pos(offset);
+	const size_t first = MIN(len, sizeof(urc_queue.buf) - pos);
+
+	memcpy(dst, &urc_queue.buf[pos], first);
+	memcpy((uint8_t *)dst + first, urc_queue.buf, len - first);
+}
+
+/* Requires urc_queue_mutex. */
+static void urc_queue_write(size_t offset, const void *src, size_t len)
+{
+	const size_t pos = urc_queue_pos(offset);
+	const size_t first = MIN(len, sizeof(urc_queue.buf) - pos);
+
+	memcpy(&urc_queue.buf[pos], src, first);
+	memcpy(urc_queue.buf, (const uint8_t *)src + first, len - first);
+}
+
+/* Requires urc_queue_mutex. */
+static bool urc_queue_equals(size_t offset, const uint8_t *data, size_t len)
+{
+	const size_t pos = urc_queue_pos(offset);
+	const size_t first = MIN(len, sizeof(urc_queue.buf) - pos);
+
+	return memcmp(&urc_queue.buf[pos], data, first) == 0 &&
+	       memcmp(urc_queue.buf, data + first, len - first) == 0;
+}
+
+/* Requires urc_queue_mutex. */
+static inline struct urc_entry urc_queue_entry(size_t offset)
+{
+	struct urc_entry entry;
+
+	urc_queue_read(offset, &entry, sizeof(entry));
+	return entry;
+}
+
+/* Requires urc_queue_mutex. */
+static inline size_t urc_queue_entry_size(size_t offset)
+{
+	return URC_ENTRY_SIZE(urc_queue_entry(offset).len);
+}
+
+/* Offset of the first URC that producers may modify. Requires urc_queue_mutex. */
+static size_t urc_queue_first(void)
+{
+	return urc_queue.sending ? urc_queue_entry_size(0) : 0;
+}
+
+/**
+ * @brief Move the URCs from an offset to the end of the queue to another offset.
+ *
+ * Only used to remove or resize a URC in the middle of the queue, which happens when URCs are
+ * coalesced or dropped. Requires urc_queue_mutex.
+ */
+static void urc_queue_move(size_t from, size_t to)
+{
+	const size_t count = urc_queue.used - from;
+
+	uint8_t *buf = urc_queue.buf;
+
+	if (to < from) {
+		for (size_t i = 0; i < count; i++) {
+			buf[urc_queue_pos(to + i)] = buf[urc_queue_pos(from + i)];
+		}
+	} else if (to > from) {
+		for (size_t i = count; i-- > 0;) {
+			buf[urc_queue_pos(to + i)] = buf[urc_queue_pos(from + i)];
+		}
+	}
+	urc_queue.used = to + count;
+}
+
+/* Requires urc_queue_mutex. */
+static void urc_queue_remove(size_t offset)
+{
+	const size_t size = urc_queue_entry_size(offset);
+
+	if (offset == 0) {
+		urc_queue.head = urc_queue_pos(size);
+		urc_queue.used -= size;
+		if (urc_queue.used == 0) {
+			urc_queue.head = 0;
+		}
+	} else {
+		urc_queue_move(offset + size, offset);
+	}
+}
+
+static void urc_queue_reset(void)
+{
+	size_t count = 0;
+
+	k_mutex_lock(&urc_queue_mutex, K_FOREVER);
+	for (size_t offset = urc_queue_first(); offset < urc_queue.used;
+	     offset += urc_queue_entry_size(offset)) {
+		count++;
+	}
+	urc_queue.used = urc_queue_first();
+	if (urc_queue.used == 0) {
+		urc_queue.head = 0;
+	}
+	k_mutex_unlock(&urc_queue_mutex);
+
+	atomic_add(&urc_stats.dropped, count);
+}
+
+/**
+ * @brief Find the queued URC that a new URC supersedes.
+ *
+ * A URC supersedes the latest queued URC of the same stream if their keys are equal.
+ * Requires urc_queue_mutex.
+ *
+ * @return Offset of the superseded URC, or SIZE_MAX if there is none.
+ */
+static size_t urc_queue_find_superseded(const uint8_t *data, struct urc_key key)
+{
+	const size_t entry_len = sizeof(struct urc_entry);
+	size_t latest = SIZE_MAX;
+	struct urc_entry entry;
+
+	if (!key.len) {
+		return SIZE_MAX;
+	}
+
+	for (size_t offset = urc_queue_first(); offset < urc_queue.used;
+	     offset += URC_ENTRY_SIZE(entry.len)) {
+		entry = urc_queue_entry(offset);
+		if (entry.key.id_len == key.id_len &&
+		    urc_queue_equals(offset + entry_len, data, key.id_len)) {
+			latest = offset;
+		}
+	}
+	if (latest == SIZE_MAX) {
+		return SIZE_MAX;
+	}
+
+	entry = urc_queue_entry(latest);
+	if (entry.key.len != key.len || !urc_queue_equals(latest + entry_len, data, key.len)) {
+		return SIZE_MAX;
+	}
+
+	return latest;
+}
+
+/**
+ * @brief Add a URC to the default URC queue.
+ *
+ * A URC superseded by the new one is replaced in place, so the URC keeps its position relative
+ * to the other queued URCs. If there is not enough room, the oldest URCs of the lowest priority
+ * are dropped, as long as their priority does not exceed the priority of the new URC.
+ *
+ * @return 0 on success, -ENOBUFS if the URC was dropped.
+ */
+static int urc_queue_put(const uint8_t *data, size_t len)
+{
+	const size_t size = URC_ENTRY_SIZE(len);
+	struct urc_entry entry;
+	size_t superseded_size = 0;
+	size_t superseded;
+	enum urc_prio prio;
+	size_t dst;
+	struct urc_key key;
+	size_t first;
+	int ret = 0;
+
+	key = urc_classify(data, len, &prio);
+
+	k_mutex_lock(&urc_queue_mutex, K_FOREVER);
+
+	first = urc_queue_first();
+	if (len > UINT16_MAX || size > sizeof(urc_queue.buf) - first) {
+		ret = -ENOBUFS;
+		goto out;
+	}
+
+	superseded = urc_queue_find_superseded(data, key);
+	if (superseded != SIZE_MAX) {
+		superseded_size = urc_queue_entry_size(superseded);
+	}
+
+	while (sizeof(urc_queue.buf) - urc_queue.used + superseded_size < size) {
+		size_t victim = SIZE_MAX;
+		int victim_prio = prio + 1;
+
+		for (size_t offset = first; offset < urc_queue.used;
+		     offset += URC_ENTRY_SIZE(entry.len)) {
+			entry = urc_queue_entry(offset);
+			if (offset != superseded && entry.prio < victim_prio) {
+				victim = offset;
+				victim_prio = entry.prio;
+			}
+		}
+		if (victim == SIZE_MAX) {
+			ret = -ENOBUFS;
+			goto out;
+		}
+		if (superseded != SIZE_MAX && victim < superseded) {
+			superseded -= urc_queue_entry_size(victim);
+		}
+		urc_queue_remove(victim);
+		atomic_inc(&urc_stats.dropped);
+	}
+
+	entry.len = len;
+	entry.prio = prio;
+	entry.key = key;
+	if (superseded != SIZE_MAX) {
+		dst = superseded;
+		urc_queue_move(superseded + superseded_size, superseded + size);
+		atomic_inc(&urc_stats.coalesced);
+	} else {
+		dst = urc_queue.used;
+		urc_queue.used += size;
+	}
+	urc_queue_write(dst, &entry, sizeof(entry));
+	urc_queue_write(dst + sizeof(entry), data, len);
+	sm_util_atomic_max(&urc_stats.queue_max_used, urc_queue.used);
+out:
+	k_mutex_unlock(&urc_queue_mutex);
+
+	if (ret) {
+		atomic_inc(&urc_stats.dropped);
+	}
+	return ret;
 }
 
-static char *strrstr(const char *str1, const char *str2)
+static inline bool urc_queue_is_empty(void)
 {
-	size_t len1;
-	size_t len2;
+	return urc_queue.used == 0;
+}
 
-	if (str1 == NULL || str2 == NULL) {
+/**
+ * @brief Buffer a pipe-specific URC message.
+ *
+ * A URC message superseded by the new one is replaced in place. Requires sm_at_host_lock.
+ *
+ * @return Superseded URC message, or NULL if there is none.
+ */
+static struct urc_msg *urc_msg_put(struct sm_at_host_ctx *ctx, struct urc_msg *new_msg)
+{
+	sys_snode_t *latest_prev = NULL;
+	struct urc_msg *latest = NULL;
+	sys_snode_t *prev = NULL;
+	struct urc_msg *msg;
+
+	if (new_msg->key.len) {
+		SYS_SLIST_FOR_EACH_CONTAINER(&ctx->buffered_urcs, msg, node) {
+			if (msg->key.id_len == new_msg->key.id_len &&
+			    strncmp(msg->urc, new_msg->urc, new_msg->key.id_len) == 0) {
+				latest = msg;
+				latest_prev = prev;
+			}
+			prev = &msg->node;
+		}
+	}
+	if (!latest || latest->key.len != new_msg->key.len ||
+	    strncmp(latest->urc, new_msg->urc, new_msg->key.len) != 0) {
+		sys_slist_append(&ctx->buffered_urcs, &new_msg->node);
 		return NULL;
 	}
 
-	len1 = strlen(str1);
-	len2 = strlen(str2);
+	sys_slist_insert(&ctx->buffered_urcs, &latest->node, &new_msg->node);
+	sys_slist_remove(&ctx->buffered_urcs, latest_prev, &latest->node);
 
-	if (len2 > len1 || len1 == 0 || len2 == 0) {
-		return NULL;
-	}
+	return latest;
+}
 
-	for (int i = len1 - len2; i >= 0; i--) {
-		if (strncmp(str1 + i, str2, len2) == 0) {
-			return (char *)str1 + i;
+/* Remove the oldest buffered URC of the lowest priority, not exceeding the given priority,
+ * from a size class. Requires sm_at_host_lock.
+ */
+static struct urc_msg *urc_msg_take_lowest(struct sm_at_host_ctx *ctx, uint8_t size_class,
+					   enum urc_prio prio)
+{
+	struct urc_msg *victim = NULL;
+	struct urc_msg *msg;
+
+	SYS_SLIST_FOR_EACH_CONTAINER(&ctx->buffered_urcs, msg, node) {
+		if (msg->size_class == size_class && msg->prio <= prio &&
+		    (!victim || msg->prio < victim->prio)) {
+			victim = msg;
 		}
 	}
+	if (victim) {
+		sys_slist_find_and_remove(&ctx->buffered_urcs, &victim->node);
+	}
 
-	return NULL;
+	return victim;
 }
 
-static void format_final_result(char *buf, size_t buf_len, size_t buf_max_len)
+/**
+ * @brief Allocate a pipe-specific URC message.
+ *
+ * When the size class is exhausted, a producer outside of sm_work_q waits for the host to drain
+ * the buffered URCs. If there is still no room, a buffered URC of the same context and no higher
+ * priority is dropped to make room.
+ *
+ * @return Allocated message, or NULL if the URC has to be dropped.
+ */
+static struct urc_msg *urc_msg_alloc(struct sm_at_host_ctx *ctx, size_t len, enum urc_prio prio)
 {
-	static const char ok_str[] = "OK\r\n";
-	static const char error_str[] = "ERROR\r\n";
-	static const char cme_error_str[] = "+CME ERROR:";
-	static const char cms_error_str[] = "+CMS ERROR:";
-	char *result = NULL;
+	const size_t size = sizeof(struct urc_msg) + len + 1;
+	struct urc_msg *msg = NULL;
+	uint8_t size_class;
 
-	result = strrstr(buf, ok_str);
-	if (result == NULL) {
-		result = strrstr(buf, error_str);
+	for (size_class = 0; size_class < ARRAY_SIZE(urc_msg_classes); size_class++) {
+		if (size <= urc_msg_classes[size_class].size) {
+			break;
+		}
 	}
-
-	if (result == NULL) {
-		result = strrstr(buf, cme_error_str);
+	if (size_class == ARRAY_SIZE(urc_msg_classes)) {
+		msg = calloc(1, size);
+		if (msg) {
+			msg->size_class = URC_MSG_HEAP;
+		}
+		return msg;
 	}
 
-	if (result == NULL) {
-		result = strrstr(buf, cms_error_str);
-	}
+	struct k_mem_slab *slab = urc_msg_classes[size_class].slab;
 
-	if (result == NULL) {
-		LOG_WRN("Final result not found");
-		return;
+	if (k_mem_slab_alloc(slab, (void **)&msg, K_NO_WAIT) != 0) {
+		if (k_current_get() != k_work_queue_thread_get(&sm_work_q)) {
+			sm_at_host_event_notify(ctx, SM_EVENT_URC);
+			if (k_mem_slab_alloc(slab, (void **)&msg, URC_MSG_ALLOC_TIMEOUT) == 0) {
+				goto allocated;
+			}
+		}
+		K_SPINLOCK(&sm_at_host_lock) {
+			msg = urc_msg_take_lowest(ctx, size_class, prio);
+		}
+		if (!msg) {
+			return NULL;
+		}
+		LOG_WRN("URC messages exhausted, dropped: %s", msg->urc);
+		atomic_inc(&urc_stats.dropped);
 	}
+allocated:
+	sm_util_atomic_max(&urc_msg_classes[size_class].max_used, k_mem_slab_num_used_get(slab));
+	msg->size_class = size_class;
 
-	/* insert CRLF before final result if there is information response before it */
-	if (result != buf + strlen(CRLF_STR)) {
-		if (buf_len + strlen(CRLF_STR) < buf_max_len) {
-			memmove((void *)(result + strlen(CRLF_STR)), (void *)result,
-				strlen(result));
-			result[0] = CR;
-			result[1] = LF;
-			buf_len += strlen(CRLF_STR);
-			buf[buf_len] = '\0';
-		} else {
-			LOG_WRN("No room to insert CRLF");
-		}
+	return msg;
+}
+
+static void urc_msg_free(struct urc_msg *msg)
+{
+	if (msg->size_class == URC_MSG_HEAP) {
+		free(msg);
+	} else {
+		k_mem_slab_free(urc_msg_classes[msg->size_class].slab, msg);
 	}
 }
 
@@ -1039,30 +1847,41 @@ static int sm_at_send_internal(struct sm_at_host_ctx *ctx, const uint8_t *data,
 			ctx = sm_at_host_get_urc_ctx();
 			if (!ctx) {
 				/* Safe to assume that already buffered URCs are outdated as well */
-				ring_buf_reset(&urc_buf);
+				urc_queue_reset();
+				atomic_inc(&urc_stats.dropped);
 				LOG_DBG("No context available for URC: %s", (const char *)data);
 				return -EIO;
 			}
 			LOG_DBG("URC default pipe=%p: %s", ctx->pipe, (const char *)data);
-			ret = ring_buf_put(&urc_buf, data, len);
-			if (ret < len) {
-				LOG_ERR("URC buffer full, dropped %d bytes", len - ret);
-				/* Safe to assume that already buffered URCs are outdated as well */
-				ring_buf_reset(&urc_buf);
+			ret = urc_queue_put(data, len);
+			if (ret) {
+				LOG_ERR("URC buffer full, dropped %d bytes", len);
 				return -EIO;
 			}
 		} else {
 			LOG_DBG("URC to pipe=%p: %s", ctx->pipe, (const char *)data);
 			/* Pipe specific URC */
-			struct urc_msg *msg = calloc(1, sizeof(struct urc_msg) + len + 1);
+			struct urc_msg *superseded = NULL;
+			struct urc_msg *msg;
+			enum urc_prio prio;
+			struct urc_key key = urc_classify(data, len, &prio);
 
+			msg = urc_msg_alloc(ctx, len, prio);
 			if (!msg) {
 				LOG_ERR("Failed to allocate URC message");
+				atomic_inc(&urc_stats.dropped);
 				return -ENOMEM;
 			}
-			strcpy(msg->urc, (const char *)data);
+			memcpy(msg->urc, data, len);
+			msg->urc[len] = '\0';
+			msg->key = key;
+			msg->prio = prio;
 			K_SPINLOCK(&sm_at_host_lock) {
-				sys_slist_append(&ctx->buffered_urcs, &msg->node);
+				superseded = urc_msg_put(ctx, msg);
+			}
+			if (superseded) {
+				urc_msg_free(superseded);
+				atomic_inc(&urc_stats.coalesced);
 			}
 		}
 		if (ctx) {
@@ -1090,6 +1909,45 @@ static int sm_at_send_internal(struct sm_at_host_ctx *ctx, const uint8_t *data,
 	return (ret == len) ? 0 : -EIO;
 }
 
+/**
+ * @brief Send a modem response with an empty line before the final result code.
+ *
+ * The information response and the final result code are sent as separate segments. The
+ * second segment starts from the CRLF that ends the information response, which produces the
+ * empty line without moving the response in the buffer.
+ */
+static int send_modem_response(struct sm_at_host_ctx *ctx, const char *buf, size_t len)
+{
+	const int result = find_final_result(buf, len);
+	int err;
+
+	if (result < 0) {
+		LOG_WRN("Final result not found");
+	}
+	if (result <= (int)strlen(CRLF_STR)) {
+		/* No final result code, or no information response before it */
+		return sm_at_send_internal(ctx, (const uint8_t *)buf, len, false,
+					   SM_DEBUG_PRINT_FULL);
+	}
+
+	err = sm_at_send_internal(ctx, (const uint8_t *)buf, result, false, SM_DEBUG_PRINT_FULL);
+	if (err) {
+		return err;
+	}
+	if (buf[result - 2] != CR) {
+		err = sm_at_send_internal(ctx, (const uint8_t *)CRLF_STR, strlen(CRLF_STR), false,
+					  SM_DEBUG_PRINT_FULL);
+		if (err) {
+			return err;
+		}
+		return sm_at_send_internal(ctx, (const uint8_t *)buf + result, len - result, false,
+					   SM_DEBUG_PRINT_FULL);
+	}
+
+	return sm_at_send_internal(ctx, (const uint8_t *)buf + result - strlen(CRLF_STR),
+				   len - result + strlen(CRLF_STR), false, SM_DEBUG_PRINT_FULL);
+}
+
 static void handle_bootloader_at_cmd(uint8_t *buf, size_t buf_size, char *at_cmd)
 {
 	int err;
@@ -1134,6 +1992,7 @@ static void cmd_send(struct sm_at_host_ctx *ctx, uint8_t *buf, size_t cmd_length
 {
 	int err;
 	size_t offset = 0;
+	size_t rsp_len;
 	char *at_cmd = buf;
 
 	LOG_HEXDUMP_DBG(buf, cmd_length, "RX");
@@ -1196,11 +2055,9 @@ static void cmd_send(struct sm_at_host_ctx *ctx, uint8_t *buf, size_t cmd_length
 	 */
 	sm_response_buf[0] = CR;
 	sm_response_buf[1] = LF;
-	if (strlen(sm_response_buf) > strlen(CRLF_STR)) {
-		format_final_result(sm_response_buf, strlen(sm_response_buf),
-				    sizeof(sm_response_buf));
-		err = sm_at_send_internal(ctx, sm_response_buf, strlen(sm_response_buf), false,
-					  SM_DEBUG_PRINT_FULL);
+	rsp_len = strlen((const char *)sm_response_buf);
+	if (rsp_len > strlen(CRLF_STR)) {
+		err = send_modem_response(ctx, (const char *)sm_response_buf, rsp_len);
 		if (err) {
 			LOG_ERR("AT command response failed: %d", err);
 		}
@@ -1235,11 +2092,170 @@ void sm_at_host_lock_ctx(struct sm_at_host_ctx *ctx)
 	atomic_inc(&ctx->executing_lock);
 }
 
-static size_t cmd_rx_handler(struct sm_at_host_ctx *ctx, uint8_t c)
+/* The queue holds commands and the echo received while earlier commands are executing.
+ * Commands are non-empty NUL-terminated strings. Echo is stored as a NUL byte, the echo length
+ * and the echo, so that it is sent when the commands before it have completed.
+ */
+#define PIPELINE_ECHO_HDR_SIZE (1 + sizeof(uint16_t))
+
+static inline bool pipeline_is_empty(struct sm_at_host_ctx *ctx)
 {
-	bool send = false;
+	return ctx->pipeline_head == ctx->pipeline_used;
+}
 
-	check_idle_timer(ctx, true);
+/* Whether echo must be queued instead of sent, to stay after the responses of the commands
+ * before it.
+ */
+static inline bool pipeline_is_busy(struct sm_at_host_ctx *ctx)
+{
+	return ctx->pipeline_buf &&
+	       (!pipeline_is_empty(ctx) || atomic_get(&ctx->executing_lock) > 0);
+}
+
+/* Whether a chunk can be received without overflowing the pipelined command queue. Every
+ * received byte takes at most one byte in the queue, terminators being replaced by a NUL.
+ * Echo takes at most one more byte per received byte, and a header for each command, which
+ * takes at least three bytes ("AT" and a terminator), and for the end of the chunk.
+ */
+static bool pipeline_can_receive(struct sm_at_host_ctx *ctx)
+{
+	const size_t free_space = CONFIG_SM_AT_PIPELINE_BUF_SIZE -
+				  (ctx->pipeline_used - ctx->pipeline_head);
+	const size_t echo_space =
+		ctx->echo_enabled
+			? AT_RX_CHUNK_SIZE + (AT_RX_CHUNK_SIZE / 3 + 1) * PIPELINE_ECHO_HDR_SIZE
+			: 0;
+
+	return pipeline_is_empty(ctx) ||
+	       free_space >= ctx->at_cmd_len + AT_RX_CHUNK_SIZE + echo_space;
+}
+
+/* Reserve space at the end of the queue. Returns NULL if the queue is full. */
+static uint8_t *pipeline_reserve(struct sm_at_host_ctx *ctx, size_t size)
+{
+	uint8_t *item;
+
+	if (!ctx->pipeline_buf ||
+	    size > CONFIG_SM_AT_PIPELINE_BUF_SIZE - (ctx->pipeline_used - ctx->pipeline_head)) {
+		return NULL;
+	}
+
+	if (ctx->pipeline_used + size > CONFIG_SM_AT_PIPELINE_BUF_SIZE) {
+		memmove(ctx->pipeline_buf, &ctx->pipeline_buf[ctx->pipeline_head],
+			ctx->pipeline_used - ctx->pipeline_head);
+		ctx->pipeline_used -= ctx->pipeline_head;
+		ctx->pipeline_head = 0;
+	}
+	item = &ctx->pipeline_buf[ctx->pipeline_used];
+	ctx->pipeline_used += size;
+
+	return item;
+}
+
+static int pipeline_put(struct sm_at_host_ctx *ctx, const uint8_t *cmd, size_t len)
+{
+	uint8_t *item = pipeline_reserve(ctx, len + 1);
+
+	if (!item) {
+		return -ENOBUFS;
+	}
+	memcpy(item, cmd, len);
+	item[len] = '\0';
+
+	return 0;
+}
+
+static int pipeline_echo_put(struct sm_at_host_ctx *ctx, const uint8_t *echo, size_t len)
+{
+	const uint16_t echo_len = len;
+	uint8_t *item = pipeline_reserve(ctx, PIPELINE_ECHO_HDR_SIZE + len);
+
+	if (!item) {
+		return -ENOBUFS;
+	}
+	item[0] = '\0';
+	memcpy(&item[1], &echo_len, sizeof(echo_len));
+	memcpy(&item[PIPELINE_ECHO_HDR_SIZE], echo, len);
+
+	return 0;
+}
+
+/* Execute queued commands in order, each one after the previous one has completed. */
+static void pipeline_run(struct sm_at_host_ctx *ctx)
+{
+	while (!pipeline_is_empty(ctx) && atomic_get(&ctx->executing_lock) == 0) {
+		if (get_sm_mode(ctx) != SM_AT_COMMAND_MODE) {
+			LOG_WRN("Left AT command mode, discarding pipelined commands");
+			ctx->pipeline_head = 0;
+			ctx->pipeline_used = 0;
+			break;
+		}
+
+		uint8_t *item = &ctx->pipeline_buf[ctx->pipeline_head];
+		size_t len;
+
+		if (item[0] == '\0') {
+			uint16_t echo_len;
+
+			memcpy(&echo_len, &item[1], sizeof(echo_len));
+			(void)sm_at_send_internal(ctx, &item[PIPELINE_ECHO_HDR_SIZE], echo_len,
+						  false, SM_DEBUG_PRINT_NONE);
+			len = PIPELINE_ECHO_HDR_SIZE + echo_len;
+		} else {
+			len = strlen((const char *)item);
+			cmd_send(ctx, item, len);
+			len++;
+		}
+
+		ctx->pipeline_head += len;
+		if (pipeline_is_empty(ctx)) {
+			ctx->pipeline_head = 0;
+			ctx->pipeline_used = 0;
+		}
+	}
+}
+
+/* Queue a terminated command and execute it once the commands before it have completed. */
+static void pipeline_cmd_send(struct sm_at_host_ctx *ctx, uint8_t *buf, size_t len)
+{
+	if (pipeline_put(ctx, buf, len)) {
+		LOG_ERR("Pipelined command queue full, command dropped");
+		rsp_send_error();
+		return;
+	}
+
+	pipeline_run(ctx);
+}
+
+static void echo_flush(struct sm_at_host_ctx *ctx, struct echo_buf *echo)
+{
+	if (echo->len == 0) {
+		return;
+	}
+
+	/* Echo of a queued command must not precede the responses of the commands before it. */
+	if (!pipeline_is_busy(ctx) || pipeline_echo_put(ctx, echo->data, echo->len)) {
+		(void)sm_at_send_internal(ctx, echo->data, echo->len, false, SM_DEBUG_PRINT_NONE);
+	}
+	echo->len = 0;
+}
+
+static void echo_put(struct sm_at_host_ctx *ctx, struct echo_buf *echo, const char *data,
+		     size_t len)
+{
+	if (echo->len + len > sizeof(echo->data)) {
+		echo_flush(ctx, echo);
+	}
+	memcpy(&echo->data[echo->len], data, len);
+	echo->len += len;
+}
+
+/* Handle a single character in AT command mode. Returns true if a command was terminated.
+ * Echo is gathered in the echo buffer, which is flushed before a command is executed.
+ */
+static bool cmd_rx_char(struct sm_at_host_ctx *ctx, struct echo_buf *echo, uint8_t c)
+{
+	bool send = false;
 
 	/* Don't buffer anything until "AT" is received */
 	if ((ctx->at_cmd_len == 0 && toupper(c) != 'A') ||
@@ -1254,6 +2270,7 @@ static size_t cmd_rx_handler(struct sm_at_host_ctx *ctx, uint8_t c)
 
 		if (new_size > AT_BUF_MAX_SIZE) {
 			LOG_ERR("AT command buffer overflow, max size reached");
+			echo_flush(ctx, echo);
 			rsp_send_error();
 			goto cmd_finnish_or_fail;
 		}
@@ -1261,6 +2278,7 @@ static size_t cmd_rx_handler(struct sm_at_host_ctx *ctx, uint8_t c)
 
 		if (!new_buf) {
 			LOG_ERR("Failed to expand AT command buffer");
+			echo_flush(ctx, echo);
 			rsp_send_error();
 			goto cmd_finnish_or_fail;
 		}
@@ -1335,32 +2353,33 @@ handle_echo:
 
 		/* Check if echo should be truncated. */
 		if (!truncate) {
-			(void)sm_at_send_internal(ctx, (uint8_t *)&c, 1, false,
-						SM_DEBUG_PRINT_NONE);
+			echo_put(ctx, echo, (const char *)&c, 1);
 		}
 
 		/* Send truncated termination characters.*/
 		if (send && truncate) {
 			if (IS_ENABLED(CONFIG_SM_CR_TERMINATION)) {
-				(void)sm_at_send_internal(ctx, (uint8_t *)"\r", 1, false,
-							  SM_DEBUG_PRINT_NONE);
+				echo_put(ctx, echo, "\r", 1);
 			} else if (IS_ENABLED(CONFIG_SM_LF_TERMINATION)) {
-				(void)sm_at_send_internal(ctx, (uint8_t *)"\n", 1, false,
-							  SM_DEBUG_PRINT_NONE);
+				echo_put(ctx, echo, "\n", 1);
 			} else {
-				(void)sm_at_send_internal(ctx, (uint8_t *)"\r\n", 2, false,
-							  SM_DEBUG_PRINT_NONE);
+				echo_put(ctx, echo, "\r\n", 2);
 			}
 		}
 	}
 
 	if (send) {
+		echo_flush(ctx, echo);
 		if (ctx->at_cmd_len > ctx->at_buf_size - 1) {
 			LOG_ERR("AT command buffer overflow, %d dropped", ctx->at_cmd_len);
 			rsp_send_error();
 		} else if (ctx->at_cmd_len > 0) {
 			ctx->at_buf[ctx->at_cmd_len] = '\0';
-			cmd_send(ctx, ctx->at_buf, ctx->at_cmd_len);
+			if (ctx->pipeline || !pipeline_is_empty(ctx)) {
+				pipeline_cmd_send(ctx, ctx->at_buf, ctx->at_cmd_len);
+			} else {
+				cmd_send(ctx, ctx->at_buf, ctx->at_cmd_len);
+			}
 		} else {
 			/* Ignore 0 size command. */
 		}
@@ -1382,69 +2401,119 @@ cmd_finnish_or_fail:
 		sm_at_host_event_notify(ctx, SM_EVENT_URC);
 	}
 
-	return 1;
+	return send;
+}
+
+/* Returns the number of bytes consumed. Processing stops after a terminated command, because
+ * the command may have changed the operation mode of the context.
+ */
+static size_t cmd_rx_handler(struct sm_at_host_ctx *ctx, const uint8_t *buf, size_t len)
+{
+	check_idle_timer(ctx, true);
+
+	for (size_t i = 0; i < len; i++) {
+		if (cmd_rx_char(ctx, &ctx->echo, buf[i])) {
+			return i + 1;
+		}
+	}
+	echo_flush(ctx, &ctx->echo);
+
+	return len;
 }
 
-/* Search for quit_str and exit datamode when one is found. */
-static size_t null_handler(struct sm_at_host_ctx *ctx, uint8_t c)
+/* Search for quit_str and exit datamode when one is found.
+ * Returns the number of bytes consumed, which is less than len if data mode was exited.
+ */
+static size_t null_handler(struct sm_at_host_ctx *ctx, const uint8_t *buf, size_t len)
 {
 	const char *const quit_str = CONFIG_SM_DATAMODE_TERMINATOR;
-	bool match = false;
+	size_t processed = 0;
 
 	if (ctx->null_dropped_count == 0) {
 		LOG_WRN("Data pipe broken. Dropping data until data mode is terminated.");
 	}
 
-	if (c == quit_str[ctx->null_match_count]) {
-		ctx->null_match_count++;
-		if (ctx->null_match_count == strlen(quit_str)) {
-			match = true;
+	while (processed < len) {
+		const uint8_t c = buf[processed++];
+
+		ctx->null_dropped_count++;
+		if (c != quit_str[ctx->null_match_count]) {
+			ctx->null_match_count = 0;
+			continue;
 		}
-	} else {
-		ctx->null_match_count = 0;
-	}
-	ctx->null_dropped_count++;
 
-	if (match) {
-		ctx->null_dropped_count -= strlen(quit_str);
-		ctx->null_dropped_count += ring_buf_size_get(&ctx->data_rb);
-		LOG_WRN("Terminating data mode. Dropped %d bytes", ctx->null_dropped_count);
-		(void)exit_datamode(ctx);
+		ctx->null_match_count++;
+		if (ctx->null_match_count == strlen(quit_str)) {
+			ctx->null_dropped_count -= strlen(quit_str);
+			ctx->null_dropped_count += ring_buf_size_get(&ctx->data_rb);
+			LOG_WRN("Terminating data mode. Dropped %d bytes", ctx->null_dropped_count);
+			(void)exit_datamode(ctx);
 
-		ctx->null_match_count = 0;
-		ctx->null_dropped_count = 0;
+			ctx->null_match_count = 0;
+			ctx->null_dropped_count = 0;
+			break;
+		}
 	}
 
-	return 1;
+	return processed;
 }
 
-static size_t sm_at_receive(struct sm_at_host_ctx *ctx, uint8_t c)
+/* Dispatch a received chunk to the handler of the current mode.
+ * Handlers consume the chunk partially if they change the mode, in which case the remaining
+ * bytes are passed to the handler of the new mode. Dispatching stops when a command hands the
+ * pipe over to another user (AT+CMUX, AT+CGDATA, AT#XPPP), or when a command is still executing
+ * and commands are not pipelined.
+ *
+ * Returns the number of bytes consumed. The rest must be left in the pipe.
+ */
+static size_t sm_at_receive(struct sm_at_host_ctx *ctx, struct modem_pipe *pipe,
+			    const uint8_t *buf, size_t len)
 {
-	size_t ret = 0;
-
-	k_timer_stop(&ctx->data_inactivity_timer);
+	const uint32_t handle = ctx_handle_get(ctx);
+	size_t processed = 0;
+	size_t ret;
 
-	switch (get_sm_mode(ctx)) {
-	case SM_AT_COMMAND_MODE:
-		ret = cmd_rx_handler(ctx, c);
-		break;
-	case SM_DATA_MODE:
-		ret = raw_rx_handler(ctx, c);
-		break;
-	case SM_NULL_MODE:
-		ret = null_handler(ctx, c);
-		break;
-	default:
-		break;
+	while (processed < len) {
+		if (atomic_ptr_get(&ctx->pipe) != pipe || ctx_handle_get(ctx) != handle) {
+			break;
+		}
+		switch (get_sm_mode(ctx)) {
+		case SM_AT_COMMAND_MODE:
+			if (atomic_get(&ctx->executing_lock) > 0 && !ctx->pipeline) {
+				/* Continued from sm_at_host_cmd_done(). */
+				ret = 0;
+				break;
+			}
+			ret = cmd_rx_handler(ctx, buf + processed, len - processed);
+			break;
+		case SM_DATA_MODE:
+			ret = raw_rx_handler(ctx, buf + processed, len - processed);
+			break;
+		case SM_NULL_MODE:
+			ret = null_handler(ctx, buf + processed, len - processed);
+			break;
+		default:
+			ret = 0;
+			break;
+		}
+		if (ret == 0) {
+			break;
+		}
+		processed += ret;
 	}
 
-	/* start inactivity timer in datamode */
-	if (get_sm_mode(ctx) == SM_DATA_MODE) {
-		k_timer_start(&ctx->data_inactivity_timer, K_MSEC(ctx->data_mode.time_limit),
-			      K_NO_WAIT);
+	/* Record the RX time and start the inactivity timer in datamode, if not yet running.
+	 * A running timer checks the recorded RX time when it expires.
+	 */
+	if (processed > 0 && get_sm_mode(ctx) == SM_DATA_MODE) {
+		atomic_set(&ctx->data_rx_ticks, (atomic_val_t)k_uptime_ticks());
+		if (k_timer_remaining_ticks(&ctx->data_inactivity_timer) == 0) {
+			k_timer_start(&ctx->data_inactivity_timer,
+				      K_MSEC(ctx->data_mode.time_limit), K_NO_WAIT);
+		}
 	}
 
-	return ret;
+	return processed;
 }
 
 AT_MONITOR(at_notify, ANY, notification_handler);
@@ -1811,7 +2880,7 @@ static void flush_pipe_urcs(struct sm_at_host_ctx *ctx)
 		struct urc_msg *msg = CONTAINER_OF(node, struct urc_msg, node);
 
 		sm_at_host_pipe_tx_blocking(ctx, (uint8_t *)msg->urc, strlen(msg->urc));
-		free(msg);
+		urc_msg_free(msg);
 	} while (true);
 }
 
@@ -1883,9 +2952,28 @@ static int sm_at_host_ctx_init(struct sm_at_host_ctx *ctx, struct modem_pipe *pi
 	return 0;
 }
 
+/* Destroy the contexts whose pipe has been closed, without waiting for the closure messages.
+ * The messages may still be queued, or lost if the message queue was purged.
+ */
+static void ctx_reclaim_closed(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(ctx_pool); i++) {
+		struct sm_at_host_ctx *ctx = &ctx_pool[i];
+
+		if (ctx == current_ctx || !sm_at_ctx_check(ctx)) {
+			continue;
+		}
+		if (atomic_ptr_cas(&ctx->pipe, NULL, CTX_PIPE_DESTROYING) &&
+		    sm_at_host_destroy(ctx) != 0) {
+			atomic_ptr_set(&ctx->pipe, NULL);
+		}
+	}
+}
+
 static struct sm_at_host_ctx *sm_at_host_create(struct modem_pipe *pipe)
 {
 	struct sm_at_host_ctx *ctx;
+	int index;
 	int err;
 
 	if (!pipe) {
@@ -1893,7 +2981,7 @@ static struct sm_at_host_ctx *sm_at_host_create(struct modem_pipe *pipe)
 		return NULL;
 	}
 
-	bool urcs_queued = !ring_buf_is_empty(&urc_buf);
+	bool urcs_queued = !urc_queue_is_empty();
 
 	/* If the first instance already exists, and is
 	 * not attached to any pipe, use it
@@ -1902,33 +2990,43 @@ static struct sm_at_host_ctx *sm_at_host_create(struct modem_pipe *pipe)
 	if (ctx && atomic_ptr_cas(&ctx->pipe, NULL, pipe)) {
 		LOG_DBG("Reusing first AT host instance %p for pipe %p", (void *)ctx, (void *)pipe);
 		atomic_set(&ctx->executing_lock, 0);
-		modem_pipe_attach(pipe, at_pipe_event_handler, ctx);
+		at_pipe_attach(ctx, pipe);
+		sm_uart_rx_fc_mode_update();
 		if (urcs_queued) {
 			sm_at_host_event_notify(ctx, SM_EVENT_URC);
 		}
 		return ctx;
 	}
 
-	/* Allocate new instance from heap */
-	ctx = malloc(sizeof(*ctx));
-	if (!ctx) {
+	/* Allocate new instance from the context table */
+	index = ctx_slot_alloc();
+	if (index < 0) {
+		/* The closure of some pipes may not have been processed yet. */
+		ctx_reclaim_closed();
+		index = ctx_slot_alloc();
+	}
+	if (index < 0) {
 		LOG_ERR("Failed to allocate AT host context");
 		return NULL;
 	}
+	ctx = &ctx_pool[index];
 
 	/* Initialize the context */
 	err = sm_at_host_ctx_init(ctx, pipe);
 	if (err) {
-		free(ctx);
+		ctx_slot_free(ctx);
 		return NULL;
 	}
 
-	/* Add to instance list */
+	/* Add to instance list and make the handle valid */
 	K_SPINLOCK(&sm_at_host_lock) {
 		sys_slist_append(&instance_list, &ctx->node);
+		atomic_set(&ctx->handle, ((atomic_val_t)ctx_slots[index].generation
+					  << CTX_HANDLE_INDEX_BITS) | index);
 	}
 
-	modem_pipe_attach(pipe, at_pipe_event_handler, ctx);
+	at_pipe_attach(ctx, pipe);
+	sm_uart_rx_fc_mode_update();
 
 	LOG_INF("Created AT host instance %p for pipe %p", (void *)ctx, (void *)pipe);
 	return ctx;
@@ -1941,15 +3039,40 @@ static void send_urcs(struct sm_at_host_ctx *ctx)
 		return;
 	}
 
-	while (!ring_buf_is_empty(&urc_buf)) {
-		uint8_t *p;
-		size_t len = ring_buf_get_claim(&urc_buf, &p, UINT16_MAX);
-		int send = sm_at_host_pipe_tx_blocking(ctx, p, len);
-
-		if (send < len) {
+	while (true) {
+		struct urc_entry entry;
+		size_t first;
+		size_t pos;
+		int send;
+
+		k_mutex_lock(&urc_queue_mutex, K_FOREVER);
+		if (urc_queue_is_empty() || urc_queue.sending) {
+			k_mutex_unlock(&urc_queue_mutex);
+			break;
+		}
+		/* The first URC stays in place while it is sent, so the lock can be released. */
+		urc_queue.sending = true;
+		entry = urc_queue_entry(0);
+		pos = urc_queue_pos(sizeof(entry));
+		k_mutex_unlock(&urc_queue_mutex);
+
+		/* The URC may wrap around the end of the buffer. */
+		first = MIN(entry.len, sizeof(urc_queue.buf) - pos);
+		send = sm_at_host_pipe_tx_blocking(ctx, &urc_queue.buf[pos], first);
+		if (send == (int)first && first < entry.len) {
+			send = sm_at_host_pipe_tx_blocking(ctx, urc_queue.buf, entry.len - first);
+			if (send >= 0) {
+				send += first;
+			}
+		}
+		if (send < entry.len) {
 			LOG_ERR("Failed to send URC: %d (ctx %p)", send, ctx);
 		}
-		ring_buf_get_finish(&urc_buf, len);
+
+		k_mutex_lock(&urc_queue_mutex, K_FOREVER);
+		urc_queue_remove(0);
+		urc_queue.sending = false;
+		k_mutex_unlock(&urc_queue_mutex);
 	}
 }
 
@@ -1958,7 +3081,7 @@ static void sm_at_host_work_fn(struct k_work *work)
 	struct sm_at_host_msg msg;
 
 	while (k_msgq_get(&sm_at_host_msgq, &msg, K_NO_WAIT) == 0) {
-		struct sm_at_host_ctx *ctx = sm_at_ctx_check(msg.ctx) ? msg.ctx : NULL;
+		struct sm_at_host_ctx *ctx = ctx_from_handle(msg.ctx_handle);
 
 		switch (msg.pipe_event) {
 		case SM_PIPE_EVENT_OPENED:
@@ -1977,7 +3100,7 @@ static void sm_at_host_work_fn(struct k_work *work)
 						(void *)ctx, (void *)current, (void *)msg.pipe);
 					break;
 				}
-				modem_pipe_attach(msg.pipe, at_pipe_event_handler, ctx);
+				at_pipe_attach(ctx, msg.pipe);
 				LOG_DBG("AT ctx %p reopened pipe %p", (void *)ctx,
 					(void *)msg.pipe);
 				break;
@@ -1989,13 +3112,12 @@ static void sm_at_host_work_fn(struct k_work *work)
 			 * before context is attached to a new pipe, we need to ignore the event
 			 */
 			if (ctx) {
-				if (atomic_ptr_cas(&ctx->pipe, NULL, (void *)0xdeadbeef)) {
-					if (msg.pipe->user_data == ctx) {
+				if (atomic_ptr_cas(&ctx->pipe, NULL, CTX_PIPE_DESTROYING)) {
+					if (pipe_handle_get(msg.pipe) == msg.ctx_handle) {
 						/* Detach, in case new user have not attached yet */
 						LOG_DBG("Detached CTX from pipe %p",
 							(void *)msg.pipe);
-						modem_pipe_attach(msg.pipe, null_pipe_handler,
-								  NULL);
+						at_pipe_detach(msg.pipe);
 					}
 					sm_at_host_destroy(ctx);
 				} else {
@@ -2005,9 +3127,9 @@ static void sm_at_host_work_fn(struct k_work *work)
 						(void *)atomic_ptr_get(&ctx->pipe));
 				}
 			} else {
-				if (msg.pipe->callback == at_pipe_event_handler) {
+				if (pipe_handle_get(msg.pipe) == msg.ctx_handle) {
 					/* Detach, in case new user have not attached yet */
-					modem_pipe_attach(msg.pipe, null_pipe_handler, NULL);
+					at_pipe_detach(msg.pipe);
 					LOG_DBG("Detached from pipe %p", (void *)msg.pipe);
 				}
 			}
@@ -2085,17 +3207,26 @@ static int sm_at_host_destroy(struct sm_at_host_ctx *ctx)
 	k_timer_stop(&ctx->data_inactivity_timer);
 	k_work_cancel_sync(&ctx->rx_work, &sync);
 	k_work_cancel_sync(&ctx->raw_send_scheduled_work, &sync);
+	k_work_cancel_sync(&ctx->poll_ctx.poll_work, &sync);
+	k_work_cancel_sync(&ctx->poll_ctx.idle_work, &sync);
 
 	/* Remove from instance list and free buffered URCs */
 	K_SPINLOCK(&sm_at_host_lock) {
 		sys_snode_t *node;
 		sys_snode_t *next;
+		struct sm_at_host_ctx *other;
 		struct urc_msg *msg;
 
 		sys_slist_find_and_remove(&instance_list, &ctx->node);
+		atomic_set(&ctx->handle, 0);
+		/* The poll idle work of the context may be queued on any context. */
+		SYS_SLIST_FOR_EACH_CONTAINER(&instance_list, other, node) {
+			sys_slist_find_and_remove(&other->idle_work_list,
+						  &ctx->poll_ctx.idle_work.node);
+		}
 		SYS_SLIST_FOR_EACH_NODE_SAFE(&ctx->buffered_urcs, node, next) {
 			msg = CONTAINER_OF(node, struct urc_msg, node);
-			free(msg);
+			urc_msg_free(msg);
 		}
 	}
 
@@ -2104,7 +3235,8 @@ static int sm_at_host_destroy(struct sm_at_host_ctx *ctx)
 	/* Free the context */
 	free(ctx->data_rb_buf);
 	free(ctx->at_buf);
-	free(ctx);
+	free(ctx->pipeline_buf);
+	ctx_slot_free(ctx);
 
 	return 0;
 }
@@ -2131,6 +3263,7 @@ static int sm_at_host_init(void)
 	if (err) {
 		LOG_ERR("Failed to open AT pipe: %d", err);
 		modem_pipe_release(pipe);
+		pipe_handle_set(pipe, 0);
 		sm_at_host_destroy(ctx);
 		return err;
 	}
@@ -2181,6 +3314,73 @@ STATIC int handle_at_datactrl(enum at_parser_cmd_type cmd_type, struct at_parser
 	return ret;
 }
 
+SM_AT_CMD_CUSTOM(xpipeline, "AT#XPIPELINE", handle_at_pipeline);
+STATIC int handle_at_pipeline(enum at_parser_cmd_type cmd_type, struct at_parser *parser,
+			      uint32_t)
+{
+	struct sm_at_host_ctx *ctx = sm_at_host_get_current();
+	uint16_t enable;
+	int ret;
+
+	switch (cmd_type) {
+	case AT_PARSER_CMD_TYPE_SET:
+		ret = at_parser_num_get(parser, 1, &enable);
+		if (ret) {
+			return ret;
+		}
+		if (enable > 1) {
+			return -EINVAL;
+		}
+		if (enable && !ctx->pipeline_buf) {
+			ctx->pipeline_buf = malloc(CONFIG_SM_AT_PIPELINE_BUF_SIZE);
+			if (!ctx->pipeline_buf) {
+				LOG_ERR("Failed to allocate pipelined command queue");
+				return -ENOMEM;
+			}
+		}
+		/* Commands already queued are still executed in order. */
+		ctx->pipeline = enable;
+		break;
+
+	case AT_PARSER_CMD_TYPE_READ:
+		rsp_send("\r\n#XPIPELINE: %d\r\n", ctx->pipeline);
+		break;
+
+	case AT_PARSER_CMD_TYPE_TEST:
+		rsp_send("\r\n#XPIPELINE: (0,1)\r\n");
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+SM_AT_CMD_CUSTOM(xurcstat, "AT#XURCSTAT", handle_at_urcstat);
+STATIC int handle_at_urcstat(enum at_parser_cmd_type cmd_type, struct at_parser *, uint32_t)
+{
+	switch (cmd_type) {
+	case AT_PARSER_CMD_TYPE_READ:
+		rsp_send("\r\n#XURCSTAT: %u,%u,%u,%u,%u\r\n",
+			 (unsigned int)atomic_get(&urc_stats.coalesced),
+			 (unsigned int)atomic_get(&urc_stats.dropped),
+			 (unsigned int)atomic_get(&urc_stats.queue_max_used),
+			 (unsigned int)atomic_get(&urc_msg_classes[0].max_used),
+			 (unsigned int)atomic_get(&urc_msg_classes[1].max_used));
+		break;
+
+	case AT_PARSER_CMD_TYPE_TEST:
+		rsp_send("\r\n#XURCSTAT?\r\n");
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 #if defined(CONFIG_SM_CMUX)
 
 SM_AT_CMD_CUSTOM(xcmuxurc, "AT#XCMUXURC", handle_at_xcmuxurc);
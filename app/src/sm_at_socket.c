@@ -17,6 +17,7 @@
 #include "sm_util.h"
 #include "sm_at_socket.h"
 #include "sm_at_host.h"
+#include "sm_cmux.h"
 #include "sm_sockopt.h"
 #include "sm_at_httpc.h"
 
@@ -412,7 +413,13 @@ void sm_at_socket_poll_work_handler(struct k_work *work)
 			/* Automatic data reception may reactivate POLLIN. */
 			if (((at_and_idle && (sock->async_poll.adr_flags & SM_ADR_AT_MODE)) ||
 			     (data_mode && (sock->async_poll.adr_flags & SM_ADR_DATA_MODE)))) {
-				auto_reception(sock);
+				if (sm_cmux_is_flow_off(pipe)) {
+					/* Leave the data in the modem until there is room. */
+					atomic_or(&sock->async_poll.revents, ZSOCK_POLLIN);
+					sm_cmux_flow_on_notify(pipe, &poll_ctx->poll_work);
+				} else {
+					auto_reception(sock);
+				}
 			}
 		}
 
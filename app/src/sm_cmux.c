@@ -9,16 +9,16 @@
 #include "sm_trace_backend_cmux.h"
 #include "sm_util.h"
 #include "sm_uart_handler.h"
-#include "sm_trace_backend_cmux.h"
 #include <zephyr/logging/log.h>
 #include <zephyr/modem/cmux.h>
 #include <zephyr/modem/pipe.h>
 #include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 /* This makes use of part of the Zephyr modem subsystem which has a CMUX module. */
 LOG_MODULE_REGISTER(sm_cmux, CONFIG_SM_LOG_LEVEL);
 
-#define RECV_BUF_LEN     SM_AT_MAX_CMD_LEN
 /* The CMUX module reserves some spare buffer bytes. To achieve a maximum
  * response length of SM_AT_MAX_RSP_LEN (comprising the "OK" or "ERROR"
  * that is sent separately), the transmit buffer must be made a bit bigger.
@@ -30,7 +30,32 @@ LOG_MODULE_REGISTER(sm_cmux, CONFIG_SM_LOG_LEVEL);
 #define INDEX_TO_DLCI(index) ((index) + 1)
 #define STOP_DELAY           K_MSEC(10)
 
+/* 3GPP TS 27.010 system parameters; N1 is limited by the CMUX work buffer sizes. */
+#define CMUX_N1_MAX          CONFIG_MODEM_CMUX_MTU
+#define CMUX_T1_DEFAULT      10
+#define CMUX_N2_DEFAULT      3
+#define CMUX_T2_DEFAULT      30
+#define CMUX_T3_DEFAULT      10
+#define CMUX_K_DEFAULT       2
+
+#define SCHED_WEIGHT_DEFAULT 1
+#define SCHED_WEIGHT_MAX     255
+/* A round ends at the latest after this time, even if some DLCI has credit left. */
+#define SCHED_ROUND_MAX_MS   20
+/* Maximum time the other DLCIs are held back while the AT channel is blocked */
+#define SCHED_AT_HOLD_MS     500
+/* Interval for rechecking the flow of a flow controlled DLCI */
+#define SCHED_FLOW_RETRY_MS  10
+
 static void stop_work_fn(struct k_work *work);
+static void sched_work_fn(struct k_work *work);
+static void fc_work_fn(struct k_work *work);
+
+/* CMUX work buffers, allocated from the heap while CMUX is in use */
+struct cmux_bufs {
+	uint8_t receive_buf[MODEM_CMUX_WORK_BUFFER_SIZE];
+	uint8_t transmit_buf[MODEM_CMUX_WORK_BUFFER_SIZE];
+};
 
 static struct {
 	/* UART backend */
@@ -38,19 +63,74 @@ static struct {
 
 	/* CMUX */
 	struct modem_cmux instance;
-	uint8_t cmux_receive_buf[MODEM_CMUX_WORK_BUFFER_SIZE];
-	uint8_t cmux_transmit_buf[MODEM_CMUX_WORK_BUFFER_SIZE];
+	struct cmux_bufs *bufs;
+
+	/* Serializes the use of the CMUX module DLCI pipes with stopping CMUX */
+	struct k_mutex dlci_lock;
+	/* The AT host is attached to the DLCI pipes. */
+	bool dlcis_attached;
 
 	/* CMUX channels (Data Link Connection Identifier); index = address - 1 */
 	struct cmux_dlci {
-		struct modem_cmux_dlci instance;
-		struct modem_pipe *pipe;
-		uint8_t receive_buf[RECV_BUF_LEN];
-		struct k_work open_work;
+		/* Pipe given to the users of the DLCI. It forwards to the pipe of the CMUX
+		 * module and puts the transmit scheduler in between.
+		 */
+		struct modem_pipe pipe;
+		/* DLCI of the CMUX module and its receive buffer, allocated from the heap when
+		 * the host opens the DLCI. The receive buffer is freed when the DLCI is closed,
+		 * the DLCI when CMUX is stopped.
+		 */
+		struct modem_cmux_dlci *instance;
+		uint8_t *receive_buf;
+		/* Pipe of the CMUX module, NULL until the host opens the DLCI */
+		struct modem_pipe *cmux_pipe;
+
+		/* Transmit scheduler state, 0 weight is the strict priority lane. */
+		uint8_t weight;
+		int32_t credit;
+		/* Transmitted during the current round */
+		bool active;
+		/* A transmit was deferred, notify transmit idle when the DLCI may continue. */
+		bool deferred;
+		uint32_t sent;
+		uint32_t deferrals;
+		/* Transmits are backpressured, the producers hold back until the flow is on. */
+		bool flow_off;
+		uint32_t flow_offs;
+		struct k_work *flow_on_work;
 	} dlcis[CONFIG_SM_CMUX_CHANNEL_COUNT];
 	/* Index of the DLCI used for AT communication; defaults to 0. */
 	unsigned int at_channel;
 
+	/* System parameters set with AT+CMUX */
+	struct cmux_params {
+		/* Maximum information field length of the transmitted frames */
+		unsigned int n1;
+		/* Timers and retransmissions, in units of 10 ms for T1 and T2, seconds for T3 */
+		unsigned int t1;
+		unsigned int n2;
+		unsigned int t2;
+		unsigned int t3;
+		unsigned int k;
+	} params;
+
+	/* Transmit scheduler in front of the DLCI pipes */
+	struct {
+		struct k_spinlock lock;
+		uint32_t round_start;
+		/* Set when a priority lane transmit did not fit, other DLCIs are held back. */
+		bool prio_blocked;
+		uint32_t prio_blocked_since;
+		struct k_work_delayable work;
+	} sched;
+
+	/* FCoff and FCon sent to the host for the UART receive backpressure */
+	struct {
+		atomic_t fcoff;
+		bool fcoff_sent;
+		struct k_work_delayable work;
+	} fc;
+
 	/* CMUX control */
 	struct k_work_delayable stop_work;
 } cmux;
@@ -70,21 +150,441 @@ static void cmux_event_handler(struct modem_cmux *, enum modem_cmux_event event,
 	}
 }
 
-static void init_dlci(size_t dlci_idx, uint16_t recv_buf_size,
-		      uint8_t recv_buf[static recv_buf_size])
+static const struct cmux_params cmux_params_default = {
+	.n1 = CMUX_N1_MAX,
+	.t1 = CMUX_T1_DEFAULT,
+	.n2 = CMUX_N2_DEFAULT,
+	.t2 = CMUX_T2_DEFAULT,
+	.t3 = CMUX_T3_DEFAULT,
+	.k = CMUX_K_DEFAULT,
+};
+
+static bool sched_is_prio(const struct cmux_dlci *dlci)
 {
-	assert(ARRAY_SIZE(cmux.dlcis) > dlci_idx);
+	/* The channels used for AT commands and URCs are always in the priority lane. */
+	return dlci->weight == 0 || sm_at_host_get_ctx_from(&dlci->pipe) != NULL;
+}
 
-	struct cmux_dlci *const dlci = &cmux.dlcis[dlci_idx];
-	const struct modem_cmux_dlci_config dlci_config = {
-		.dlci_address = dlci_idx + 1,
-		.receive_buf = recv_buf,
-		.receive_buf_size = recv_buf_size
-	};
+/* Lock sched.lock before calling. */
+static void sched_round_start(void)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		struct cmux_dlci *dlci = &cmux.dlcis[i];
+		const int32_t quantum = dlci->weight * cmux.params.n1;
+
+		/* Unused credit is carried over for at most one round. */
+		dlci->credit = MIN(dlci->credit + quantum, quantum);
+		dlci->active = false;
+	}
+	cmux.sched.round_start = k_uptime_get_32();
+}
+
+/* Lock sched.lock before calling. Returns whether a new round may be started for dlci. */
+static bool sched_round_done(const struct cmux_dlci *dlci)
+{
+	if (k_uptime_get_32() - cmux.sched.round_start >= SCHED_ROUND_MAX_MS) {
+		return true;
+	}
+	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		const struct cmux_dlci *other = &cmux.dlcis[i];
+
+		if (other != dlci && other->active && other->credit > 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Lock sched.lock before calling. */
+static bool sched_prio_blocked(void)
+{
+	if (cmux.sched.prio_blocked &&
+	    k_uptime_get_32() - cmux.sched.prio_blocked_since >= SCHED_AT_HOLD_MS) {
+		/* The AT channel producer gave up. */
+		cmux.sched.prio_blocked = false;
+	}
+	return cmux.sched.prio_blocked;
+}
+
+/* Lock sched.lock before calling. Returns the work to submit when the flow goes on. */
+static struct k_work *sched_flow_on(struct cmux_dlci *dlci)
+{
+	struct k_work *work = dlci->flow_on_work;
+
+	dlci->flow_off = false;
+	dlci->flow_on_work = NULL;
+	return work;
+}
+
+/* Notify the DLCIs with deferred transmits and let the flow controlled producers retry. */
+static void sched_work_fn(struct k_work *work)
+{
+	bool notify[ARRAY_SIZE(cmux.dlcis)] = { 0 };
+	struct k_work *flow_on[ARRAY_SIZE(cmux.dlcis)] = { 0 };
+
+	ARG_UNUSED(work);
+
+	K_SPINLOCK(&cmux.sched.lock) {
+		if (sched_round_done(NULL)) {
+			sched_round_start();
+		}
+		for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+			notify[i] = cmux.dlcis[i].deferred;
+			cmux.dlcis[i].deferred = false;
+			if (cmux.dlcis[i].flow_off) {
+				flow_on[i] = sched_flow_on(&cmux.dlcis[i]);
+			}
+		}
+	}
+	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		if (notify[i] && cmux.dlcis[i].cmux_pipe) {
+			modem_pipe_notify_transmit_idle(&cmux.dlcis[i].pipe);
+		}
+		if (flow_on[i]) {
+			k_work_submit_to_queue(&sm_work_q, flow_on[i]);
+		}
+	}
+}
+
+/* Turn the flow of the DLCI off when a transmit did not fit completely, on when it did. */
+static void sched_flow_update(struct cmux_dlci *dlci, bool blocked)
+{
+	struct k_work *work = NULL;
+
+	K_SPINLOCK(&cmux.sched.lock) {
+		if (blocked && !dlci->flow_off) {
+			dlci->flow_off = true;
+			dlci->flow_offs++;
+		} else if (!blocked && dlci->flow_off) {
+			work = sched_flow_on(dlci);
+		}
+	}
+	if (blocked) {
+		/* Recheck the flow in case the CMUX module does not notify transmit idle. */
+		k_work_schedule_for_queue(&sm_work_q, &cmux.sched.work,
+					  K_MSEC(SCHED_FLOW_RETRY_MS));
+	}
+	if (work) {
+		k_work_submit_to_queue(&sm_work_q, work);
+	}
+}
+
+static struct cmux_dlci *dlci_from_pipe(const struct modem_pipe *pipe)
+{
+	for (size_t i = 0; pipe && i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		if (&cmux.dlcis[i].pipe == pipe) {
+			return &cmux.dlcis[i];
+		}
+	}
+	return NULL;
+}
+
+bool sm_cmux_is_flow_off(struct modem_pipe *pipe)
+{
+	const struct cmux_dlci *dlci = dlci_from_pipe(pipe);
+
+	return dlci && dlci->flow_off;
+}
+
+void sm_cmux_flow_on_notify(struct modem_pipe *pipe, struct k_work *work)
+{
+	struct cmux_dlci *dlci = dlci_from_pipe(pipe);
+	struct k_work *submit = work;
+
+	if (dlci) {
+		K_SPINLOCK(&cmux.sched.lock) {
+			if (dlci->flow_off) {
+				/* A replaced work is submitted right away to recheck the flow. */
+				submit = (dlci->flow_on_work != work) ? dlci->flow_on_work : NULL;
+				dlci->flow_on_work = work;
+			}
+		}
+	}
+	if (submit) {
+		k_work_submit_to_queue(&sm_work_q, submit);
+	}
+}
+
+
+static void fc_work_fn(struct k_work *work)
+{
+	const bool fcoff = atomic_get(&cmux.fc.fcoff);
+	int ret;
+
+	ARG_UNUSED(work);
+
+	if (!sm_cmux_is_started() || fcoff == cmux.fc.fcoff_sent) {
+		return;
+	}
+	ret = modem_cmux_flow_control_send(&cmux.instance, !fcoff);
+	if (ret == -EAGAIN) {
+		k_work_reschedule_for_queue(&sm_work_q, &cmux.fc.work,
+					    K_MSEC(SCHED_FLOW_RETRY_MS));
+		return;
+	}
+	if (ret) {
+		/* Not connected, the host has nothing to stop. */
+		LOG_DBG("%s not sent. (%d)", fcoff ? "FCoff" : "FCon", ret);
+	}
+	cmux.fc.fcoff_sent = fcoff;
+}
+
+void sm_cmux_fcoff_set(bool fcoff)
+{
+	if (atomic_set(&cmux.fc.fcoff, fcoff) != fcoff) {
+		k_work_reschedule_for_queue(&sm_work_q, &cmux.fc.work, K_NO_WAIT);
+	}
+}
+
+static int dlci_pipe_open(void *data)
+{
+	struct cmux_dlci *dlci = data;
+	int ret = -EPERM;
+
+	k_mutex_lock(&cmux.dlci_lock, K_FOREVER);
+	if (dlci->cmux_pipe) {
+		ret = modem_pipe_open_async(dlci->cmux_pipe);
+	}
+	k_mutex_unlock(&cmux.dlci_lock);
+	return ret;
+}
+
+static int dlci_pipe_receive(void *data, uint8_t *buf, size_t size)
+{
+	struct cmux_dlci *dlci = data;
+	int ret = -EPERM;
+
+	k_mutex_lock(&cmux.dlci_lock, K_FOREVER);
+	if (dlci->cmux_pipe) {
+		ret = modem_pipe_receive(dlci->cmux_pipe, buf, size);
+	}
+	k_mutex_unlock(&cmux.dlci_lock);
+	return ret;
+}
+
+static int dlci_pipe_close(void *data)
+{
+	struct cmux_dlci *dlci = data;
+	int ret = -EPERM;
+
+	k_mutex_lock(&cmux.dlci_lock, K_FOREVER);
+	if (dlci->cmux_pipe) {
+		ret = modem_pipe_close_async(dlci->cmux_pipe);
+	}
+	k_mutex_unlock(&cmux.dlci_lock);
+	return ret;
+}
+
+/* Transmit in chunks of N1 bytes, so that no frame exceeds the negotiated frame size. */
+static int dlci_transmit(struct cmux_dlci *dlci, const uint8_t *buf, size_t size)
+{
+	size_t sent = 0;
+	int ret = 0;
+
+	k_mutex_lock(&cmux.dlci_lock, K_FOREVER);
+	if (!dlci->cmux_pipe || !sm_pipe_is_open(&dlci->pipe)) {
+		ret = -EPERM;
+	}
+	while (!ret && sent < size) {
+		const size_t len = MIN(size - sent, cmux.params.n1);
+
+		ret = modem_pipe_transmit(dlci->cmux_pipe, buf + sent, len);
+		if (ret < 0) {
+			break;
+		}
+		sent += ret;
+		ret = ((size_t)ret < len) ? -EAGAIN : 0;
+	}
+	k_mutex_unlock(&cmux.dlci_lock);
+
+	if (ret == -EAGAIN) {
+		/* Notify transmit idle when the retry finds room, if the CMUX module does not. */
+		K_SPINLOCK(&cmux.sched.lock) {
+			dlci->deferred = true;
+		}
+	} else if (ret < 0 && !sent) {
+		return ret;
+	}
+	return (int)sent;
+}
+
+/* Weighted-fair transmit: each DLCI may send weight * N1 bytes per round,
+ * and the DLCIs in the priority lane are never held back. Deferred transmits return 0,
+ * the DLCI is notified with transmit idle when it may continue.
+ */
+static int dlci_pipe_transmit(void *data, const uint8_t *buf, size_t size)
+{
+	struct cmux_dlci *dlci = data;
+	size_t allowed = size;
+	bool notify = false;
+	int ret;
+
+	if (sched_is_prio(dlci)) {
+		ret = dlci_transmit(dlci, buf, size);
+		K_SPINLOCK(&cmux.sched.lock) {
+			if (ret >= 0 && (size_t)ret < size) {
+				if (!cmux.sched.prio_blocked) {
+					cmux.sched.prio_blocked = true;
+					cmux.sched.prio_blocked_since = k_uptime_get_32();
+				}
+			} else if (cmux.sched.prio_blocked) {
+				cmux.sched.prio_blocked = false;
+				notify = true;
+			}
+		}
+		if (ret > 0) {
+			dlci->sent += ret;
+		}
+		goto out;
+	}
+
+	K_SPINLOCK(&cmux.sched.lock) {
+		if (sched_prio_blocked()) {
+			allowed = 0;
+		} else {
+			if (dlci->credit <= 0 && sched_round_done(dlci)) {
+				sched_round_start();
+				notify = true;
+			}
+			allowed = (dlci->credit > 0) ? MIN(size, dlci->credit) : 0;
+		}
+		if (allowed == 0) {
+			dlci->deferred = true;
+			dlci->deferrals++;
+		} else {
+			/* Reserve the credit, the unused part is returned below. */
+			dlci->credit -= allowed;
+			dlci->active = true;
+		}
+	}
+
+	if (allowed == 0) {
+		/* Retry when the round or the priority hold ends at the latest.
+		 * The scheduler holding the DLCI back does not turn its flow off.
+		 */
+		k_work_schedule_for_queue(&sm_work_q, &cmux.sched.work,
+					  K_MSEC(MIN(SCHED_ROUND_MAX_MS, SCHED_AT_HOLD_MS)));
+		return 0;
+	}
+
+	ret = dlci_transmit(dlci, buf, allowed);
+	K_SPINLOCK(&cmux.sched.lock) {
+		dlci->credit += allowed - MAX(ret, 0);
+	}
+	if (ret > 0) {
+		dlci->sent += ret;
+	}
+out:
+	/* Only what the scheduler allowed counts, the rest was held back by it. */
+	sched_flow_update(dlci, ret >= 0 && (size_t)ret < allowed);
+	if (notify) {
+		k_work_reschedule_for_queue(&sm_work_q, &cmux.sched.work, K_NO_WAIT);
+	}
+	return ret;
+}
+
+static const struct modem_pipe_api dlci_pipe_api = {
+	.open = dlci_pipe_open,
+	.transmit = dlci_pipe_transmit,
+	.receive = dlci_pipe_receive,
+	.close = dlci_pipe_close,
+};
+
+/* Free the receive buffer of a DLCI when the host closes it. The DLCI instance is kept,
+ * so that the CMUX module can find the DLCI when it is opened again.
+ */
+static void dlci_receive_buf_free(struct cmux_dlci *dlci)
+{
+	if (dlci->instance) {
+		modem_cmux_dlci_receive_buf_set(dlci->instance, NULL, 0);
+	}
+	free(dlci->receive_buf);
+	dlci->receive_buf = NULL;
+}
 
-	dlci->pipe = modem_cmux_dlci_init(&cmux.instance, &dlci->instance, &dlci_config);
+/* Forward the events of the CMUX module pipe to the users of the DLCI. */
+static void cmux_pipe_event_handler(struct modem_pipe *pipe, enum modem_pipe_event event,
+				    void *user_data)
+{
+	struct cmux_dlci *dlci = user_data;
 
-	sm_at_host_attach(dlci->pipe);
+	ARG_UNUSED(pipe);
+
+	switch (event) {
+	case MODEM_PIPE_EVENT_OPENED:
+		modem_pipe_notify_opened(&dlci->pipe);
+		break;
+	case MODEM_PIPE_EVENT_CLOSED:
+		dlci_receive_buf_free(dlci);
+		modem_pipe_notify_closed(&dlci->pipe);
+		break;
+	case MODEM_PIPE_EVENT_RECEIVE_READY:
+		modem_pipe_notify_receive_ready(&dlci->pipe);
+		break;
+	case MODEM_PIPE_EVENT_TRANSMIT_IDLE:
+		sched_flow_update(dlci, false);
+		modem_pipe_notify_transmit_idle(&dlci->pipe);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Allocate a DLCI and its receive buffer when the host opens it (SABM).
+ * Called by the CMUX module before it looks the DLCI up; an error refuses the DLCI.
+ */
+static int dlci_open_request(struct modem_cmux *, uint16_t address, void *)
+{
+	const int i = DLCI_TO_INDEX(address);
+	struct cmux_dlci *dlci;
+	struct modem_pipe *cmux_pipe;
+	int ret = 0;
+
+	if (i < 0 || i >= ARRAY_SIZE(cmux.dlcis)) {
+		return -ENOENT;
+	}
+	dlci = &cmux.dlcis[i];
+
+	k_mutex_lock(&cmux.dlci_lock, K_FOREVER);
+	if (!cmux.dlcis_attached) {
+		/* CMUX is being stopped. */
+		ret = -EPERM;
+		goto out;
+	}
+	if (dlci->receive_buf) {
+		/* Already open */
+		goto out;
+	}
+	dlci->receive_buf = malloc(CONFIG_SM_CMUX_RX_BUF_SIZE);
+	if (!dlci->instance) {
+		dlci->instance = malloc(sizeof(*dlci->instance));
+	}
+	if (!dlci->receive_buf || !dlci->instance) {
+		LOG_ERR("Failed to allocate DLCI %u.", address);
+		free(dlci->receive_buf);
+		dlci->receive_buf = NULL;
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (dlci->cmux_pipe) {
+		modem_cmux_dlci_receive_buf_set(dlci->instance, dlci->receive_buf,
+						CONFIG_SM_CMUX_RX_BUF_SIZE);
+	} else {
+		const struct modem_cmux_dlci_config dlci_config = {
+			.dlci_address = address,
+			.receive_buf = dlci->receive_buf,
+			.receive_buf_size = CONFIG_SM_CMUX_RX_BUF_SIZE,
+		};
+
+		cmux_pipe = modem_cmux_dlci_init(&cmux.instance, dlci->instance, &dlci_config);
+		modem_pipe_attach(cmux_pipe, cmux_pipe_event_handler, dlci);
+		dlci->cmux_pipe = cmux_pipe;
+	}
+	LOG_DBG("Allocated DLCI %u.", address);
+out:
+	k_mutex_unlock(&cmux.dlci_lock);
+	return ret;
 }
 
 bool sm_cmux_is_started(void)
@@ -92,25 +592,132 @@ bool sm_cmux_is_started(void)
 	return (cmux.uart_pipe != NULL);
 }
 
-static int sm_cmux_init(void)
+/* Attach the AT host to the DLCI pipes when CMUX is taken into use. */
+static void cmux_setup(void)
+{
+	k_mutex_lock(&cmux.dlci_lock, K_FOREVER);
+	if (cmux.dlcis_attached) {
+		/* Already set up. */
+		k_mutex_unlock(&cmux.dlci_lock);
+		return;
+	}
+	cmux.dlcis_attached = true;
+	k_mutex_unlock(&cmux.dlci_lock);
+
+	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		sm_at_host_attach(&cmux.dlcis[i].pipe);
+	}
+}
+
+/* The CMUX module parses the received frames in place in the UART receive buffers. */
+static int cmux_receive_claim(struct modem_cmux *, const uint8_t **data, size_t max_len, void *)
+{
+	return sm_uart_pipe_rx_claim(data, max_len);
+}
+
+static void cmux_receive_release(struct modem_cmux *, size_t len, void *)
+{
+	sm_uart_pipe_rx_release(len);
+}
+
+/* Allocate the CMUX work buffers and initialize the CMUX module when CMUX is started.
+ * The DLCIs are allocated only when the host opens them.
+ */
+static int cmux_bufs_alloc(void)
 {
-	const struct modem_cmux_config cmux_config = {
+	struct modem_cmux_config cmux_config = {
 		.callback = cmux_event_handler,
-		.receive_buf = cmux.cmux_receive_buf,
-		.receive_buf_size = sizeof(cmux.cmux_receive_buf),
-		.transmit_buf = cmux.cmux_transmit_buf,
-		.transmit_buf_size = sizeof(cmux.cmux_transmit_buf),
+		.dlci_request = dlci_open_request,
+		.receive_claim = cmux_receive_claim,
+		.receive_release = cmux_receive_release,
+		.receive_buf_size = sizeof(cmux.bufs->receive_buf),
+		.transmit_buf_size = sizeof(cmux.bufs->transmit_buf),
 	};
 
+	cmux.bufs = malloc(sizeof(*cmux.bufs));
+	if (!cmux.bufs) {
+		LOG_ERR("Failed to allocate CMUX buffers.");
+		return -ENOMEM;
+	}
+	cmux_config.receive_buf = cmux.bufs->receive_buf;
+	cmux_config.transmit_buf = cmux.bufs->transmit_buf;
 	modem_cmux_init(&cmux.instance, &cmux_config);
+	cmux.fc.fcoff_sent = false;
+
+	LOG_DBG("Allocated %zu bytes for CMUX.", sizeof(*cmux.bufs));
+	return 0;
+}
+
+static void cmux_bufs_free(void)
+{
+	free(cmux.bufs);
+	cmux.bufs = NULL;
+}
+
+/* Release the DLCIs when CMUX is stopped. */
+static void cmux_free(void)
+{
+	struct modem_pipe *cmux_pipes[ARRAY_SIZE(cmux.dlcis)];
+
+	/* Cut the users off from the CMUX module before it is released.
+	 * They may still be using the DLCI pipes, which stay valid and return -EPERM.
+	 */
+	k_mutex_lock(&cmux.dlci_lock, K_FOREVER);
+	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		cmux_pipes[i] = cmux.dlcis[i].cmux_pipe;
+		cmux.dlcis[i].cmux_pipe = NULL;
+	}
+	cmux.dlcis_attached = false;
+	k_mutex_unlock(&cmux.dlci_lock);
+
+	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		struct cmux_dlci *dlci = &cmux.dlcis[i];
+		struct k_work *work;
+
+		/* Let the flow controlled producers see that the DLCI is gone. */
+		K_SPINLOCK(&cmux.sched.lock) {
+			work = sched_flow_on(dlci);
+		}
+		if (work) {
+			k_work_submit_to_queue(&sm_work_q, work);
+		}
+		sm_at_host_release(sm_at_host_get_ctx_from(&dlci->pipe));
+		modem_pipe_release(&dlci->pipe);
+		if (cmux_pipes[i]) {
+			modem_pipe_release(cmux_pipes[i]);
+		}
+		/* Reset the pipe to the closed state. */
+		modem_pipe_notify_closed(&dlci->pipe);
+	}
+}
+
+/* Free the DLCIs after the CMUX module has been released. */
+static void dlcis_free(void)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+		struct cmux_dlci *dlci = &cmux.dlcis[i];
+
+		free(dlci->receive_buf);
+		dlci->receive_buf = NULL;
+		free(dlci->instance);
+		dlci->instance = NULL;
+	}
+}
 
+static int sm_cmux_init(void)
+{
 	for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
-		init_dlci(i, sizeof(cmux.dlcis[i].receive_buf), cmux.dlcis[i].receive_buf);
+		modem_pipe_init(&cmux.dlcis[i].pipe, &cmux.dlcis[i], &dlci_pipe_api);
+		cmux.dlcis[i].weight = SCHED_WEIGHT_DEFAULT;
 	}
 
+	k_mutex_init(&cmux.dlci_lock);
 	k_work_init_delayable(&cmux.stop_work, stop_work_fn);
+	k_work_init_delayable(&cmux.sched.work, sched_work_fn);
+	k_work_init_delayable(&cmux.fc.work, fc_work_fn);
 
 	cmux.at_channel = 0;
+	cmux.params = cmux_params_default;
 	return 0;
 }
 SYS_INIT(sm_cmux_init, APPLICATION, 0);
@@ -120,6 +727,8 @@ static void stop_work_fn(struct k_work *work)
 	ARG_UNUSED(work);
 
 	if (sm_cmux_is_started()) {
+		struct modem_pipe *pipe = cmux.uart_pipe;
+
 		if (IS_ENABLED(CONFIG_SM_PPP)) {
 			sm_ppp_detach();
 		}
@@ -128,18 +737,18 @@ static void stop_work_fn(struct k_work *work)
 			sm_trace_backend_detach();
 		}
 
+		/* Release the DLCIs (modem_cmux_release does not clean up) */
+		cmux_free();
 		modem_cmux_release(&cmux.instance);
+		dlcis_free();
+		cmux_bufs_free();
 		cmux.at_channel = 0;
+		cmux.params = cmux_params_default;
 
 		/* Return AT host to UART pipe */
-		struct modem_pipe *pipe = cmux.uart_pipe;
 		cmux.uart_pipe = NULL;
 		sm_at_host_set_pipe(sm_at_host_get_urc_ctx(), pipe);
-
-		/* Reset all DLCI pipes to a closed state (modem_cmux_release does not clean up) */
-		for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
-			init_dlci(i, sizeof(cmux.dlcis[i].receive_buf), cmux.dlcis[i].receive_buf);
-		}
+		sm_uart_rx_fc_mode_update();
 	}
 	LOG_INF("Returned to AT command mode.");
 }
@@ -148,10 +757,11 @@ struct modem_pipe *sm_cmux_get_dlci(uint8_t address)
 {
 	int i = DLCI_TO_INDEX(address);
 
-	if (i < 0 || i >= ARRAY_SIZE(cmux.dlcis)) {
+	/* The DLCI pipes exist before the host opens the DLCIs. */
+	if (i < 0 || i >= ARRAY_SIZE(cmux.dlcis) || !cmux.dlcis_attached) {
 		return NULL;
 	}
-	return cmux.dlcis[i].pipe;
+	return &cmux.dlcis[i].pipe;
 }
 
 static void assign_default_channels(void)
@@ -165,7 +775,7 @@ static void assign_default_channels(void)
 		/* Reserve PPP channel pipe for PPP module */
 		struct modem_pipe *ppp_pipe = cmux.at_channel == 0
 						      ? sm_cmux_get_dlci(CMUX_PPP_CHANNEL)
-						      : cmux.dlcis[!cmux.at_channel].pipe;
+						      : &cmux.dlcis[!cmux.at_channel].pipe;
 
 		LOG_DBG("Reserving CMUX PPP channel pipe %p for PPP module", (void *)ppp_pipe);
 		sm_at_host_release(sm_at_host_get_ctx_from(ppp_pipe));
@@ -182,6 +792,7 @@ static void assign_default_channels(void)
 	}
 }
 
+
 static int do_at_and_ppp_channel_switch(int new_at_channel)
 {
 	/*
@@ -206,7 +817,7 @@ static int do_at_and_ppp_channel_switch(int new_at_channel)
 	struct sm_at_host_ctx *ctx = sm_at_host_get_current();
 
 	cmux.at_channel = new_at_channel;
-	int ret = sm_at_host_set_pipe(ctx, cmux.dlcis[cmux.at_channel].pipe);
+	int ret = sm_at_host_set_pipe(ctx, &cmux.dlcis[cmux.at_channel].pipe);
 
 	if (ret) {
 		LOG_ERR("Failed to switch AT host to CMUX DLCI pipe. (%d)", ret);
@@ -214,7 +825,7 @@ static int do_at_and_ppp_channel_switch(int new_at_channel)
 	}
 	if (IS_ENABLED(CONFIG_SM_PPP)) {
 		/* Switch PPP pipe to where AT channel was earlier */
-		struct modem_pipe *ppp_pipe = cmux.dlcis[!cmux.at_channel].pipe;
+		struct modem_pipe *ppp_pipe = &cmux.dlcis[!cmux.at_channel].pipe;
 
 		LOG_DBG("Switching CMUX PPP channel to %d", !cmux.at_channel + 1);
 		sm_at_host_release(sm_at_host_get_ctx_from(ppp_pipe));
@@ -224,6 +835,7 @@ static int do_at_and_ppp_channel_switch(int new_at_channel)
 	return -SILENT_AT_COMMAND_RET;
 }
 
+
 static int cmux_start(void)
 {
 	int ret;
@@ -237,27 +849,65 @@ static int cmux_start(void)
 	}
 
 	/* Get the UART pipe (already open and attached to AT host) */
-	cmux.uart_pipe = sm_uart_pipe_get();
-	if (!cmux.uart_pipe) {
+	struct modem_pipe *uart_pipe = sm_uart_pipe_get();
+
+	if (!uart_pipe) {
 		return -ENODEV;
 	}
 
+	ret = cmux_bufs_alloc();
+	if (ret) {
+		return ret;
+	}
+	cmux.uart_pipe = uart_pipe;
+
 	/* Switch AT host to CMUX DLCI pipe */
 	struct sm_at_host_ctx *ctx = sm_at_host_get_current();
 
-	ret = sm_at_host_set_pipe(ctx, cmux.dlcis[cmux.at_channel].pipe);
+	ret = sm_at_host_set_pipe(ctx, &cmux.dlcis[cmux.at_channel].pipe);
 	if (ret) {
 		LOG_ERR("Failed to switch AT host to CMUX DLCI pipe. (%d)", ret);
-		return ret;
+		goto free_bufs;
 	}
 
 	/* Attach CMUX to UART pipe (AT host will be detached by transition) */
 	ret = modem_cmux_attach(&cmux.instance, cmux.uart_pipe);
 	if (ret) {
 		LOG_ERR("Failed to attach CMUX to UART pipe. (%d)", ret);
-		return ret;
+		goto restore_pipe;
 	}
 
+	sm_uart_rx_fc_mode_update();
+	return 0;
+
+restore_pipe:
+	/* Return AT host to UART pipe, which also takes the UART pipe back from CMUX. */
+	sm_at_host_set_pipe(ctx, uart_pipe);
+free_bufs:
+	cmux.uart_pipe = NULL;
+	cmux_bufs_free();
+	sm_uart_rx_fc_mode_update();
+	return ret;
+}
+
+/* Set the transmit scheduler weights given after the AT channel in AT#XCMUX. */
+static int sched_weights_set(struct at_parser *parser, uint32_t param_count)
+{
+	unsigned int weights[ARRAY_SIZE(cmux.dlcis)];
+	const size_t count = param_count - 2;
+	int ret;
+
+	for (size_t i = 0; i != count; ++i) {
+		ret = at_parser_num_get(parser, i + 2, &weights[i]);
+		if (ret || weights[i] > SCHED_WEIGHT_MAX) {
+			return -EINVAL;
+		}
+	}
+	K_SPINLOCK(&cmux.sched.lock) {
+		for (size_t i = 0; i != count; ++i) {
+			cmux.dlcis[i].weight = weights[i];
+		}
+	}
 	return 0;
 }
 
@@ -271,9 +921,21 @@ static int handle_at_xcmux(enum at_parser_cmd_type cmd_type, struct at_parser *p
 	if (cmd_type == AT_PARSER_CMD_TYPE_READ) {
 		rsp_send("\r\n#XCMUX: %u,%u\r\n", cmux.at_channel + 1,
 			 CONFIG_SM_CMUX_CHANNEL_COUNT);
+		for (size_t i = 0; i != ARRAY_SIZE(cmux.dlcis); ++i) {
+			const struct cmux_dlci *dlci = &cmux.dlcis[i];
+
+			rsp_send("\r\n#XCMUX: %u,%u,%d,%u,%u,%d,%u\r\n", INDEX_TO_DLCI(i),
+				 dlci->weight, sched_is_prio(dlci), dlci->sent, dlci->deferrals,
+				 dlci->flow_off, dlci->flow_offs);
+		}
 		return 0;
 	}
-	if (cmd_type != AT_PARSER_CMD_TYPE_SET || param_count > 2) {
+	if (cmd_type == AT_PARSER_CMD_TYPE_TEST) {
+		rsp_send("\r\n#XCMUX: (%s),(0-%d)\r\n", IS_ENABLED(CONFIG_SM_PPP) ? "1,2" : "1",
+			 SCHED_WEIGHT_MAX);
+		return 0;
+	}
+	if (cmd_type != AT_PARSER_CMD_TYPE_SET || param_count > 2 + ARRAY_SIZE(cmux.dlcis)) {
 		return -EINVAL;
 	}
 
@@ -281,7 +943,7 @@ static int handle_at_xcmux(enum at_parser_cmd_type cmd_type, struct at_parser *p
 		return -EALREADY;
 	}
 
-	if (param_count == 2) {
+	if (param_count >= 2) {
 		ret = at_parser_num_get(parser, 1, &at_dlci);
 		if (ret || (at_dlci != 1 && (!IS_ENABLED(CONFIG_SM_PPP) || at_dlci != 2))) {
 			return -EINVAL;
@@ -295,11 +957,20 @@ static int handle_at_xcmux(enum at_parser_cmd_type cmd_type, struct at_parser *p
 				return -ENOTSUP;
 			}
 		}
+		ret = sched_weights_set(parser, param_count);
+		if (ret) {
+			return ret;
+		}
 		if (sm_cmux_is_started()) {
+			if (param_count > 2 && at_channel == cmux.at_channel) {
+				/* Only the weights were changed. */
+				return 0;
+			}
 			return do_at_and_ppp_channel_switch(at_channel);
 		}
 		cmux.at_channel = at_channel;
 	}
+	cmux_setup();
 	assign_default_channels();
 
 	/* Respond before starting CMUX. */
@@ -333,36 +1004,84 @@ static int handle_at_xcmuxcld(enum at_parser_cmd_type cmd_type, struct at_parser
 	return -SILENT_AT_COMMAND_RET;
 }
 
+/* <port_speed> values of AT+CMUX */
+static const uint32_t cmux_port_speeds[] = {
+	9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600, 1000000
+};
+
+static unsigned int cmux_port_speed_get(void)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(cmux_port_speeds); ++i) {
+		if (cmux_port_speeds[i] == sm_uart_baudrate) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+/* Get an optional AT+CMUX parameter. The value is left unchanged if the parameter is omitted. */
+static int cmux_param_get(struct at_parser *parser, uint32_t param_count, size_t index,
+			  unsigned int min, unsigned int max, unsigned int *value)
+{
+	unsigned int val;
+	int ret;
+
+	if (index >= param_count) {
+		return 0;
+	}
+	ret = at_parser_num_get(parser, index, &val);
+	if (ret == -ENODATA) {
+		return 0;
+	}
+	if (ret || val < min || val > max) {
+		return -EINVAL;
+	}
+	*value = val;
+	return 0;
+}
+
 SM_AT_CMD_CUSTOM(atcmux, "AT+CMUX", handle_at_cmux);
 static int handle_at_cmux(enum at_parser_cmd_type cmd_type, struct at_parser *parser,
 			  uint32_t param_count)
 {
 	/* AT+CMUX follows the 3GPP TS 27.010 specification.
 	 *
-	 * Only following commands are supported:
-	 * AT+CMUX=0       (basic mode)
-	 * AT+CMUX=0,0     (basic mode, subset 0)
-	 * AT+CMUX?        (read current configuration)
-	 * AT+CMUX=?       (list supported parameter ranges)
-	 * All other parameter combinations are rejected with an error response.
+	 * AT+CMUX=<mode>[,<subset>[,<port_speed>[,<N1>[,<T1>[,<N2>[,<T2>[,<T3>[,<k>]]]]]]]]
+	 *
+	 * Only basic mode (0) with subset 0 is supported. <port_speed> must match the
+	 * current baud rate, if it has a value. <N1> limits the size of the frames.
+	 * The CMUX module has fixed timers, retransmissions and window size, so only the
+	 * default values of <T1>, <N2>, <T2>, <T3> and <k> are accepted.
 	 */
+	struct cmux_params params = cmux_params_default;
 	unsigned int mode;
-	unsigned int subset;
+	unsigned int subset = 0;
+	unsigned int port_speed = cmux_port_speed_get();
+	/* Any <port_speed> is accepted when the baud rate has no value of its own. */
+	const unsigned int port_speed_max = port_speed ? port_speed : ARRAY_SIZE(cmux_port_speeds);
+	char port_speeds[sizeof("(0-99)")];
 	int ret;
 
 	switch (cmd_type) {
 	case AT_PARSER_CMD_TYPE_TEST:
-		/* Report supported ranges: only mode 0, subset 0 */
-		rsp_send("\r\n+CMUX: (0),(0)\r\n");
+		if (port_speed) {
+			snprintf(port_speeds, sizeof(port_speeds), "(%u)", port_speed);
+		} else {
+			snprintf(port_speeds, sizeof(port_speeds), "(0-%u)", port_speed_max);
+		}
+		rsp_send("\r\n+CMUX: (0),(0),%s,(1-%d),(%d),(%d),(%d),(%d),(%d)\r\n", port_speeds,
+			 CMUX_N1_MAX, CMUX_T1_DEFAULT, CMUX_N2_DEFAULT, CMUX_T2_DEFAULT,
+			 CMUX_T3_DEFAULT, CMUX_K_DEFAULT);
 		return 0;
 
 	case AT_PARSER_CMD_TYPE_READ:
-		/* Report current (and only) configuration */
-		rsp_send("\r\n+CMUX: 0,0\r\n");
+		rsp_send("\r\n+CMUX: 0,0,%u,%u,%u,%u,%u,%u,%u\r\n", port_speed, cmux.params.n1,
+			 cmux.params.t1, cmux.params.n2, cmux.params.t2, cmux.params.t3,
+			 cmux.params.k);
 		return 0;
 
 	case AT_PARSER_CMD_TYPE_SET:
-		if (param_count < 2 || param_count > 3) {
+		if (param_count < 2 || param_count > 10) {
 			return -EINVAL;
 		}
 
@@ -371,16 +1090,34 @@ static int handle_at_cmux(enum at_parser_cmd_type cmd_type, struct at_parser *pa
 			return -EINVAL;
 		}
 
-		if (param_count == 3) {
-			ret = at_parser_num_get(parser, 2, &subset);
-			if (ret || subset != 0) {
-				return -EINVAL;
+		const struct {
+			unsigned int min;
+			unsigned int max;
+			unsigned int *value;
+		} fields[] = {
+			{ 0, 0, &subset },
+			{ port_speed, port_speed_max, &port_speed },
+			{ 1, CMUX_N1_MAX, &params.n1 },
+			{ CMUX_T1_DEFAULT, CMUX_T1_DEFAULT, &params.t1 },
+			{ CMUX_N2_DEFAULT, CMUX_N2_DEFAULT, &params.n2 },
+			{ CMUX_T2_DEFAULT, CMUX_T2_DEFAULT, &params.t2 },
+			{ CMUX_T3_DEFAULT, CMUX_T3_DEFAULT, &params.t3 },
+			{ CMUX_K_DEFAULT, CMUX_K_DEFAULT, &params.k },
+		};
+
+		for (size_t i = 0; i != ARRAY_SIZE(fields); ++i) {
+			ret = cmux_param_get(parser, param_count, i + 2, fields[i].min,
+					     fields[i].max, fields[i].value);
+			if (ret) {
+				return ret;
 			}
 		}
 
 		if (sm_cmux_is_started()) {
 			return -EALREADY;
 		}
+		cmux_setup();
+		cmux.params = params;
 
 		/* Respond before starting CMUX. */
 		rsp_send_ok();
@@ -409,6 +1146,22 @@ static int handle_at_xcmuxtrace(enum at_parser_cmd_type cmd_type, struct at_pars
 		rsp_send("\r\n#XCMUXTRACE: (1 ... %d)\r\n", CONFIG_SM_CMUX_CHANNEL_COUNT);
 		return 0;
 	}
+	if (cmd_type == AT_PARSER_CMD_TYPE_READ) {
+		struct sm_trace_backend_stats stats;
+		uint32_t ratio = 0;
+		uint32_t us_per_kb = 0;
+
+		sm_trace_backend_stats_get(&stats);
+		if (stats.trace_bytes) {
+			/* Sent bytes in percent of the trace bytes, CPU time per kilobyte */
+			ratio = 100ULL * stats.sent_bytes / stats.trace_bytes;
+			us_per_kb = 1024ULL * stats.compress_us / stats.trace_bytes;
+		}
+		rsp_send("\r\n#XCMUXTRACE: %d,%u,%u,%u,%u,%u\r\n",
+			 IS_ENABLED(CONFIG_SM_MODEM_TRACE_COMPRESS), stats.trace_bytes,
+			 stats.sent_bytes, stats.dropped_bytes, ratio, us_per_kb);
+		return 0;
+	}
 	if (cmd_type != AT_PARSER_CMD_TYPE_SET || param_count > 2) {
 		return -EINVAL;
 	}
@@ -420,6 +1173,7 @@ static int handle_at_xcmuxtrace(enum at_parser_cmd_type cmd_type, struct at_pars
 		if (ret || (ch < 2 || ch >= CONFIG_SM_CMUX_CHANNEL_COUNT)) {
 			return -EINVAL;
 		}
+		cmux_setup();
 		pipe = sm_cmux_get_dlci(ch);
 	} else {
 		pipe = sm_at_host_get_current_pipe();
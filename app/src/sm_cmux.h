@@ -18,13 +18,60 @@ enum cmux_channel {
 	CMUX_MODEM_TRACE_CHANNEL = 3,
 };
 
+struct k_work;
+
 #if CONFIG_SM_CMUX
 bool sm_cmux_is_started(void);
+
+/**
+ * @brief Check whether the CMUX channel of a pipe is flow controlled.
+ *
+ * The flow is turned off when the channel cannot take all the data given to it,
+ * or when the host stops the channel with CMUX flow control.
+ * Producers should then stop reading data for the channel until the flow is on again.
+ *
+ * @param pipe The pipe. Pipes that are not CMUX channels are never flow controlled.
+ * @return true if the flow is off.
+ */
+bool sm_cmux_is_flow_off(struct modem_pipe *pipe);
+
+/**
+ * @brief Submit a work item to sm_work_q when the flow of a CMUX channel is on again.
+ *
+ * One work item is kept per channel. The work item is submitted right away
+ * if the flow is already on.
+ *
+ * @param pipe The pipe of the CMUX channel.
+ * @param work The work item to submit.
+ */
+void sm_cmux_flow_on_notify(struct modem_pipe *pipe, struct k_work *work);
+
+/**
+ * @brief Stop or let the host continue sending on all CMUX channels (FCoff and FCon).
+ *
+ * The command is sent from sm_work_q. Can be called from an ISR.
+ *
+ * @param fcoff true to send FCoff, false to send FCon.
+ */
+void sm_cmux_fcoff_set(bool fcoff);
 #else
 static inline bool sm_cmux_is_started(void)
 {
 	return false;
 }
+
+static inline bool sm_cmux_is_flow_off(struct modem_pipe *pipe)
+{
+	return false;
+}
+
+static inline void sm_cmux_flow_on_notify(struct modem_pipe *pipe, struct k_work *work)
+{
+}
+
+static inline void sm_cmux_fcoff_set(bool fcoff)
+{
+}
 #endif
 
 /**
@@ -5,6 +5,8 @@
  */
 
 #include "sm_ppp.h"
+#include "sm_ppp_hdlc.h"
+#include "sm_ppp_mss.h"
 #include "sm_at_host.h"
 #include "sm_util.h"
 #include "sm_defines.h"
@@ -19,6 +21,8 @@
 #include <zephyr/posix/sys/eventfd.h>
 #include <zephyr/posix/sys/socket.h>
 #include <zephyr/random/random.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
 #include <zephyr/pm/device.h>
 #include <assert.h>
 #include <strings.h>
@@ -28,6 +32,8 @@ LOG_MODULE_REGISTER(sm_ppp, CONFIG_SM_LOG_LEVEL);
 #define CONNECT "\r\nCONNECT\r\n"
 #define NO_CARRIER "\r\nNO CARRIER\r\n"
 #define PDN_ACTIVATION_TIMEOUT K_SECONDS(30)
+/* Networks can send packets larger than the MTU, so the buffers are bigger. */
+#define PPP_PKT_SIZE 1500
 
 /* This keeps track of whether the user is registered to the CGEV notifications.
  * We need them to know when to start/stop the PPP link, but that should not
@@ -35,17 +41,9 @@ LOG_MODULE_REGISTER(sm_ppp, CONFIG_SM_LOG_LEVEL);
  */
 bool sm_fwd_cgev_notifs;
 
-static struct net_if *ppp_iface;
-static bool sm_ppp_auto_start;
-static bool sm_ppp_detach_at_pipe;
-static bool sm_ppp_keep_pipe_attached;
-static uint8_t ppp_data_buf[1500];
-static struct sockaddr_ll ppp_zephyr_dst_addr;
-static struct modem_pipe *ppp_pipe;
-static struct modem_pipe *ppp_urc_pipe;
 static struct k_thread ppp_data_passing_thread_id;
-static k_timepoint_t ppp_pdn_timeout;
 static K_THREAD_STACK_DEFINE(ppp_data_passing_thread_stack, KB(2));
+static K_THREAD_STACK_ARRAY_DEFINE(ppp_fwd_thread_stacks, 2 * CONFIG_SM_PPP_LINK_COUNT, KB(2));
 
 enum ppp_action {
 	PPP_START,
@@ -60,53 +58,148 @@ enum ppp_reason {
 	PPP_REASON_PEER_DISCONNECTED,	/**< Request is originated from peer disconnection */
 };
 
+struct ppp_link;
+
 struct ppp_event {
+	struct ppp_link *link;
 	enum ppp_action action;
 	enum ppp_reason reason;
 };
 
 struct ppp_work {
 	struct k_msgq queue;
-	struct ppp_event queue_buf[4];
+	struct ppp_event queue_buf[4 * CONFIG_SM_PPP_LINK_COUNT];
 };
 static struct ppp_work ppp_work;
 
-static bool ppp_peer_connected;
-
 enum ppp_states {
 	PPP_STATE_STOPPED,
 	PPP_STATE_STARTING,
 	PPP_STATE_RUNNING,
 	PPP_STATE_STOPPING
 };
-static enum ppp_states ppp_state;
 
-MODEM_PPP_DEFINE(ppp_module, NULL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,
-		 sizeof(ppp_data_buf), sizeof(ppp_data_buf));
-AT_MONITOR(sm_ppp_on_cgev, "CGEV", at_notif_on_cgev, PAUSED);
+#define PPP_MODULE_DEFINE(i, _)                                                                    \
+	MODEM_PPP_DEFINE(ppp_module_##i, NULL, CONFIG_KERNEL_INIT_PRIORITY_DEFAULT,                \
+			 PPP_PKT_SIZE, PPP_PKT_SIZE)
+#define PPP_MODULE_REF(i, _) &ppp_module_##i
 
-/* Default PPP PDN is the default PDP context (CID 0). */
-static unsigned int ppp_pdn_cid;
+LISTIFY(CONFIG_SM_PPP_LINK_COUNT, PPP_MODULE_DEFINE, (;));
+AT_MONITOR(sm_ppp_on_cgev, "CGEV", at_notif_on_cgev, PAUSED);
 
 enum {
-	EVENT_FD_IDX,  /* Eventfd to signal incoming PPP events (always valid). */
 	ZEPHYR_FD_IDX, /* Raw Zephyr socket to pass data to/from the PPP link. */
 	MODEM_FD_IDX,  /* Raw modem socket to pass data to/from the LTE link. */
 	PPP_FDS_COUNT
 };
 const char *const ppp_socket_names[PPP_FDS_COUNT] = {
-	[EVENT_FD_IDX] = "event",
 	[ZEPHYR_FD_IDX] = "Zephyr",
 	[MODEM_FD_IDX] = "modem"
 };
-static int ppp_fds[PPP_FDS_COUNT] = { -1, -1, -1 };
+/* Eventfd to signal incoming PPP events to the data passing thread */
+static int ppp_event_fd = -1;
+
+struct ppp_pkt {
+	size_t len;
+	/* Cycle count when the packet was received, for the forwarding latency */
+	uint32_t recv_cycles;
+	uint8_t data[PPP_PKT_SIZE];
+};
+
+/* Upper bounds in milliseconds of the forwarding latency histogram buckets.
+ * The last bucket counts the packets slower than the last bound.
+ */
+static const uint32_t ppp_latency_bounds_ms[] = { 1, 5, 20, 100, 500 };
+#define PPP_LATENCY_BUCKETS (ARRAY_SIZE(ppp_latency_bounds_ms) + 1)
+
+/* Forwarding statistics, updated without locks from the data passing and sending threads */
+struct ppp_fwd_stats {
+	atomic_t packets;
+	atomic_t bytes;
+	/* Downlink packets that are not IP */
+	atomic_t drop_non_ip;
+	/* Packets only partly sent */
+	atomic_t drop_short;
+	/* Packets that failed to be sent */
+	atomic_t drop_error;
+	/* Packets queued when the link went down */
+	atomic_t drop_link_down;
+	atomic_t queue_max;
+	atomic_t latency[PPP_LATENCY_BUCKETS];
+};
+
+/* Forwarding direction with its own buffer pool, queue and sending thread */
+struct ppp_fwd {
+	struct ppp_link *link;
+	size_t src;
+	size_t dst;
+	struct k_mem_slab slab;
+	struct k_msgq queue;
+	/* The data passing thread waits for a buffer to be freed. */
+	atomic_t starved;
+	/* Held while sending, so that the sockets are not closed meanwhile */
+	struct k_mutex send_lock;
+	struct ppp_fwd_stats stats;
+	struct k_thread thread;
+	struct ppp_pkt pkts[CONFIG_SM_PPP_FWD_BUF_COUNT];
+	struct ppp_pkt *queue_buf[CONFIG_SM_PPP_FWD_BUF_COUNT];
+};
+
+static const struct {
+	const char *name;
+	size_t src;
+	size_t dst;
+} ppp_fwd_dirs[] = {
+	{ .name = "ppp_uplink", .src = ZEPHYR_FD_IDX, .dst = MODEM_FD_IDX },
+	{ .name = "ppp_downlink", .src = MODEM_FD_IDX, .dst = ZEPHYR_FD_IDX },
+};
+
+/* PPP link bound to a PDN, with its own PPP module, pipe and sockets */
+struct ppp_link {
+	struct modem_ppp *module;
+	struct net_if *iface;
+	struct modem_pipe *pipe;
+	/* Pipe for the status notifications, the one where AT#XPPP was issued */
+	struct modem_pipe *urc_pipe;
+	unsigned int pdn_cid;
+	/* enum ppp_states, also read by the sending threads */
+	atomic_t state;
+	bool auto_start;
+	bool detach_at_pipe;
+	bool keep_pipe_attached;
+	bool peer_connected;
+	/* +CGEV notifications are monitored to restart the link. */
+	bool cgev_monitor;
+	k_timepoint_t pdn_timeout;
+	struct k_work_delayable activate_pdp_dwork;
+	struct k_work flow_on_work;
+	int fds[PPP_FDS_COUNT];
+	struct sockaddr_ll zephyr_dst_addr;
+	/* MTUs of the PDN, 0 if not known */
+	uint32_t pdn_ipv4_mtu;
+	uint32_t pdn_ipv6_mtu;
+	uint8_t ll_addr[PPP_INTERFACE_IDENTIFIER_LEN];
+	struct ppp_fwd fwd[ARRAY_SIZE(ppp_fwd_dirs)];
+};
+
+static struct modem_ppp *const ppp_modules[] = {
+	LISTIFY(CONFIG_SM_PPP_LINK_COUNT, PPP_MODULE_REF, (,))
+};
+
+/* The first link is the default one, used by AT#XPPP without <dlci> and by AT#XCMUX. */
+static struct ppp_link ppp_links[CONFIG_SM_PPP_LINK_COUNT];
+static struct ppp_link *const ppp_default_link = &ppp_links[0];
+BUILD_ASSERT(ARRAY_SIZE(ppp_modules) == ARRAY_SIZE(ppp_links));
+BUILD_ASSERT(ARRAY_SIZE(ppp_fwd_thread_stacks) ==
+	     ARRAY_SIZE(ppp_links) * ARRAY_SIZE(ppp_fwd_dirs));
 
 /* Forward declarations */
 static void ppp_data_passing_thread(void*, void*, void*);
+static void ppp_fwd_thread(void *arg1, void *, void *);
+static void ppp_flow_on_work_fn(struct k_work *work);
 static void sm_ppp_activate_pdp_dwork_fn(struct k_work *work);
-static int ppp_stop(enum ppp_reason reason);
-static void ppp_cmd_fail_return_to_at_mode(void);
-static K_WORK_DELAYABLE_DEFINE(activate_pdp_dwork,  sm_ppp_activate_pdp_dwork_fn);
+static int ppp_stop(struct ppp_link *link, enum ppp_reason reason);
+static void ppp_cmd_fail_return_to_at_mode(struct ppp_link *link);
 
 static const char *ppp_action_str(enum ppp_action action)
 {
@@ -122,49 +215,88 @@ static const char *ppp_action_str(enum ppp_action action)
 	return "";
 }
 
+static size_t ppp_link_idx(const struct ppp_link *link)
+{
+	return link - ppp_links;
+}
+
+static struct ppp_link *ppp_link_from_iface(struct net_if *iface)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		if (ppp_links[i].iface == iface) {
+			return &ppp_links[i];
+		}
+	}
+	return NULL;
+}
+
+static struct ppp_link *ppp_link_from_pipe(struct modem_pipe *pipe)
+{
+	for (size_t i = 0; pipe && i != ARRAY_SIZE(ppp_links); ++i) {
+		if (ppp_links[i].pipe == pipe) {
+			return &ppp_links[i];
+		}
+	}
+	return NULL;
+}
+
+/* Returns the link that is in use for a PDN, other than the given link. */
+static struct ppp_link *ppp_link_using_cid(unsigned int cid, const struct ppp_link *other_than)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		struct ppp_link *link = &ppp_links[i];
+
+		if (link != other_than && link->pdn_cid == cid &&
+		    (atomic_get(&link->state) != PPP_STATE_STOPPED || link->auto_start)) {
+			return link;
+		}
+	}
+	return NULL;
+}
+
 void sm_ppp_set_auto_start(bool enable)
 {
-	sm_ppp_auto_start = enable;
+	ppp_default_link->auto_start = enable;
 }
 
-static bool open_ppp_sockets(void)
+static bool open_ppp_sockets(struct ppp_link *link)
 {
 	int ret;
 
-	ppp_fds[ZEPHYR_FD_IDX] = zsock_socket(AF_PACKET, SOCK_DGRAM | SOCK_NATIVE,
-					      htons(ETH_P_ALL));
-	if (ppp_fds[ZEPHYR_FD_IDX] < 0) {
+	link->fds[ZEPHYR_FD_IDX] = zsock_socket(AF_PACKET, SOCK_DGRAM | SOCK_NATIVE,
+						htons(ETH_P_ALL));
+	if (link->fds[ZEPHYR_FD_IDX] < 0) {
 		LOG_ERR("Zephyr socket creation failed (%d).", -errno);
 		return false;
 	}
 
-	ppp_zephyr_dst_addr = (struct sockaddr_ll){
+	link->zephyr_dst_addr = (struct sockaddr_ll){
 		.sll_family = AF_PACKET,
-		.sll_ifindex = net_if_get_by_iface(ppp_iface),
+		.sll_ifindex = net_if_get_by_iface(link->iface),
 		.sll_protocol = htons(ETH_P_ALL),
 	};
-	ret = zsock_bind(ppp_fds[ZEPHYR_FD_IDX],
-		   (const struct sockaddr *)&ppp_zephyr_dst_addr, sizeof(ppp_zephyr_dst_addr));
+	ret = zsock_bind(link->fds[ZEPHYR_FD_IDX],
+		   (const struct sockaddr *)&link->zephyr_dst_addr, sizeof(link->zephyr_dst_addr));
 	if (ret < 0) {
 		LOG_ERR("Failed to bind Zephyr socket (%d).", -errno);
 		return false;
 	}
 
-	ppp_fds[MODEM_FD_IDX] = zsock_socket(AF_PACKET, SOCK_RAW, 0);
-	if (ppp_fds[MODEM_FD_IDX] < 0) {
+	link->fds[MODEM_FD_IDX] = zsock_socket(AF_PACKET, SOCK_RAW, 0);
+	if (link->fds[MODEM_FD_IDX] < 0) {
 		LOG_ERR("Modem socket creation failed (%d).", -errno);
 		return false;
 	}
 
 	/* Bind PPP to PDN */
-	int pdn_id = sm_util_pdn_id_get(ppp_pdn_cid);
+	int pdn_id = sm_util_pdn_id_get(link->pdn_cid);
 
 	if (pdn_id < 0) {
 		return false;
 	}
 
 	ret = zsock_setsockopt(
-		ppp_fds[MODEM_FD_IDX],
+		link->fds[MODEM_FD_IDX],
 		SOL_SOCKET, SO_BINDTOPDN,
 		&pdn_id, sizeof(int));
 	if (ret == 0) {
@@ -177,29 +309,36 @@ static bool open_ppp_sockets(void)
 	return true;
 }
 
-static void close_ppp_sockets(void)
+/* Call with the link no longer running. */
+static void close_ppp_sockets(struct ppp_link *link)
 {
-	/* Close only PPP sockets (Zephyr and modem), not the event FD */
-	for (size_t i = EVENT_FD_IDX + 1; i < ARRAY_SIZE(ppp_fds); ++i) {
-		if (ppp_fds[i] < 0) {
+	/* Wait for the packets being sent. The ones still queued are dropped. */
+	for (size_t i = 0; i != ARRAY_SIZE(link->fwd); ++i) {
+		k_mutex_lock(&link->fwd[i].send_lock, K_FOREVER);
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(link->fds); ++i) {
+		if (link->fds[i] < 0) {
 			continue;
 		}
-		if (zsock_close(ppp_fds[i])) {
+		if (zsock_close(link->fds[i])) {
 			LOG_WRN("Failed to close %s socket (%d).",
 				ppp_socket_names[i], -errno);
 		}
-		ppp_fds[i] = -1;
+		link->fds[i] = -1;
+	}
+	for (size_t i = 0; i != ARRAY_SIZE(link->fwd); ++i) {
+		k_mutex_unlock(&link->fwd[i].send_lock);
 	}
 }
 
-static bool configure_ppp_link_ip_addresses(struct ppp_context *ctx)
+static bool configure_ppp_link_ip_addresses(struct ppp_link *link, struct ppp_context *ctx)
 {
-	static uint8_t ppp_ll_addr[PPP_INTERFACE_IDENTIFIER_LEN];
+	uint8_t *ppp_ll_addr = link->ll_addr;
 	uint8_t ll_addr_len;
 	char addr4[NET_INET_ADDRSTRLEN];
 	char addr6[NET_INET6_ADDRSTRLEN];
 
-	util_get_ip_addr(ppp_pdn_cid, addr4, addr6);
+	util_get_ip_addr(link->pdn_cid, addr4, addr6);
 
 	if (*addr4) {
 		if (zsock_inet_pton(NET_AF_INET, addr4, &ctx->ipcp.my_options.address) != 1) {
@@ -217,8 +356,8 @@ static bool configure_ppp_link_ip_addresses(struct ppp_context *ctx)
 			return false;
 		}
 		/* The interface identifier is the last 64 bits of the IPv6 address. */
-		BUILD_ASSERT(sizeof(in6) >= sizeof(ppp_ll_addr));
-		ll_addr_len = sizeof(ppp_ll_addr);
+		BUILD_ASSERT(sizeof(in6) >= sizeof(link->ll_addr));
+		ll_addr_len = sizeof(link->ll_addr);
 		memcpy(ppp_ll_addr, (uint8_t *)(&in6 + 1) - ll_addr_len, ll_addr_len);
 	} else {
 		/* 00-00-5E-00-53-xx as per RFC 7042, as zephyr/drivers/net/ppp.c does. */
@@ -230,16 +369,18 @@ static bool configure_ppp_link_ip_addresses(struct ppp_context *ctx)
 		ppp_ll_addr[4] = 0x53;
 		ppp_ll_addr[5] = sys_rand32_get();
 	}
-	net_if_set_link_addr(ppp_iface, ppp_ll_addr, ll_addr_len, NET_LINK_UNKNOWN);
+	net_if_set_link_addr(link->iface, ppp_ll_addr, ll_addr_len, NET_LINK_UNKNOWN);
 
 	return true;
 }
 
-static void delegate_ppp_event(enum ppp_action action, enum ppp_reason reason)
+static void delegate_ppp_event(struct ppp_link *link, enum ppp_action action,
+			       enum ppp_reason reason)
 {
-	struct ppp_event event = {.action = action, .reason = reason};
+	struct ppp_event event = {.link = link, .action = action, .reason = reason};
 
-	LOG_DBG("PPP %s, reason: %d", ppp_action_str(event.action), event.reason);
+	LOG_DBG("PPP %zu %s, reason: %d", ppp_link_idx(link), ppp_action_str(event.action),
+		event.reason);
 
 	if (k_msgq_put(&ppp_work.queue, &event, K_NO_WAIT)) {
 		LOG_ERR("Failed to queue PPP event.");
@@ -247,47 +388,66 @@ static void delegate_ppp_event(enum ppp_action action, enum ppp_reason reason)
 	}
 
 	/* Signal the PPP thread that an event is available */
-	if (eventfd_write(ppp_fds[EVENT_FD_IDX], 1) != 0) {
+	if (eventfd_write(ppp_event_fd, 1) != 0) {
 		LOG_ERR("Failed to signal PPP event (%d).", errno);
 	}
 }
 
+static bool ppp_link_is_running(const struct ppp_link *link)
+{
+	return (atomic_get(&link->state) == PPP_STATE_RUNNING);
+}
+
+static bool ppp_link_is_stopped(const struct ppp_link *link)
+{
+	return (atomic_get(&link->state) == PPP_STATE_STOPPED);
+}
+
 bool ppp_is_running(void)
 {
-	return (ppp_state == PPP_STATE_RUNNING);
+	return ppp_link_is_running(ppp_default_link);
 }
 
-static void send_status_notification(void)
+bool sm_ppp_is_stopped(void)
 {
-	if (!ppp_urc_pipe) {
+	return ppp_link_is_stopped(ppp_default_link);
+}
+
+static void send_status_notification(struct ppp_link *link)
+{
+	if (!link->urc_pipe) {
 		return;
 	}
-	urc_send_to(ppp_urc_pipe, "\r\n#XPPP: %u,%u,%u\r\n", !sm_ppp_is_stopped(),
-		    ppp_peer_connected, ppp_pdn_cid);
+	urc_send_to(link->urc_pipe, "\r\n#XPPP: %u,%u,%u\r\n", !ppp_link_is_stopped(link),
+		    link->peer_connected, link->pdn_cid);
 }
 
-static void ppp_start_failure(void)
+static void ppp_start_failure(struct ppp_link *link)
 {
-	close_ppp_sockets();
-	net_if_down(ppp_iface);
+	close_ppp_sockets(link);
+	net_if_down(link->iface);
 }
 
-static void ppp_retrieve_pdn_info(struct ppp_context *const ctx)
+static void ppp_retrieve_pdn_info(struct ppp_link *link, struct ppp_context *const ctx)
 {
 	struct sm_pdn_dynamic_info populated_info = {0};
 	unsigned int mtu = CONFIG_SM_PPP_FALLBACK_MTU;
 
-	if (!sm_util_pdn_dynamic_info_get(ppp_pdn_cid, &populated_info)) {
+	link->pdn_ipv4_mtu = 0;
+	link->pdn_ipv6_mtu = 0;
+	if (!sm_util_pdn_dynamic_info_get(link->pdn_cid, &populated_info)) {
+		link->pdn_ipv4_mtu = populated_info.ipv4_mtu;
+		link->pdn_ipv6_mtu = populated_info.ipv6_mtu;
 		if (populated_info.ipv6_mtu) {
 			/* Set the PPP MTU to that of the LTE link. */
 			/* IPv6's MTU has more priority on dual-stack.
 			 * Because, it must be at least 1280 for IPv6,
 			 * while MTU of IPv4 may be less.
 			 */
-			mtu = MIN(populated_info.ipv6_mtu, sizeof(ppp_data_buf));
+			mtu = MIN(populated_info.ipv6_mtu, PPP_PKT_SIZE);
 		} else if (populated_info.ipv4_mtu) {
 			/* Set the PPP MTU to that of the LTE link. */
-			mtu = MIN(populated_info.ipv4_mtu, sizeof(ppp_data_buf));
+			mtu = MIN(populated_info.ipv4_mtu, PPP_PKT_SIZE);
 		}
 
 		/* Try to populate DNS addresses from PDN */
@@ -320,86 +480,93 @@ static void ppp_retrieve_pdn_info(struct ppp_context *const ctx)
 #endif
 	} else {
 		LOG_DBG("Could not retrieve MTU, using fallback value.");
-		BUILD_ASSERT(sizeof(ppp_data_buf) >= CONFIG_SM_PPP_FALLBACK_MTU);
+		BUILD_ASSERT(PPP_PKT_SIZE >= CONFIG_SM_PPP_FALLBACK_MTU);
 	}
-	net_if_set_mtu(ppp_iface, mtu);
+	net_if_set_mtu(link->iface, mtu);
 	LOG_DBG("MTU set to %u.", mtu);
 }
 
-static int ppp_start(void)
+static int ppp_start(struct ppp_link *link)
 {
 	int ret;
 
-	if (ppp_state == PPP_STATE_RUNNING) {
+	if (ppp_link_is_running(link)) {
 		LOG_INF("PPP already running");
-		send_status_notification();
+		send_status_notification(link);
 		return 0;
 	}
+	link->cgev_monitor = true;
 	at_monitor_resume(&sm_ppp_on_cgev);
 
-	struct ppp_context *const ctx = net_if_l2_data(ppp_iface);
+	struct ppp_context *const ctx = net_if_l2_data(link->iface);
 
-	if (!configure_ppp_link_ip_addresses(ctx)) {
+	if (!configure_ppp_link_ip_addresses(link, ctx)) {
 		return -EADDRNOTAVAIL;
 	}
 
-	if (!ppp_pipe) {
+	if (!link->pipe) {
 		return -EINVAL;
 	}
 
-	ppp_state = PPP_STATE_STARTING;
-	ppp_retrieve_pdn_info(ctx);
+	atomic_set(&link->state, PPP_STATE_STARTING);
+	ppp_retrieve_pdn_info(link, ctx);
 
-	ret = net_if_up(ppp_iface);
+	ret = net_if_up(link->iface);
 	if (ret) {
 		LOG_ERR("Failed to bring PPP interface up (%d).", ret);
 		goto error;
 	}
 
-	if (!open_ppp_sockets()) {
-		ppp_start_failure();
+	if (!open_ppp_sockets(link)) {
+		ppp_start_failure(link);
 		ret = -ENOTCONN;
 		goto error;
 	}
 
-	send_status_notification();
+	send_status_notification(link);
 
-	if (sm_ppp_detach_at_pipe) {
-		sm_at_host_release(sm_at_host_get_ctx_from(ppp_pipe));
+	if (link->detach_at_pipe) {
+		sm_at_host_release(sm_at_host_get_ctx_from(link->pipe));
 	}
 
-	modem_ppp_attach(&ppp_module, ppp_pipe);
+	modem_ppp_attach(link->module, sm_ppp_hdlc_attach(link->pipe));
 
-	net_if_carrier_on(ppp_iface);
-	net_if_dormant_off(ppp_iface);
+	net_if_carrier_on(link->iface);
+	net_if_dormant_off(link->iface);
 
-	ppp_state = PPP_STATE_RUNNING;
+	atomic_set(&link->state, PPP_STATE_RUNNING);
 
 	return 0;
 
 error:
-	ppp_stop(PPP_REASON_ERROR);
+	ppp_stop(link, PPP_REASON_ERROR);
 	return ret;
 }
 
-bool sm_ppp_is_stopped(void)
+/* +CGEV notifications are needed as long as some link may be restarted by them. */
+static void ppp_cgev_monitor_update(void)
 {
-	return (ppp_state == PPP_STATE_STOPPED);
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		if (ppp_links[i].cgev_monitor) {
+			return;
+		}
+	}
+	at_monitor_pause(&sm_ppp_on_cgev);
 }
 
-static int ppp_stop(enum ppp_reason reason)
+static int ppp_stop(struct ppp_link *link, enum ppp_reason reason)
 {
 	bool restarting = false;
 
-	if (ppp_state == PPP_STATE_STOPPED) {
+	if (ppp_link_is_stopped(link)) {
 		LOG_INF("PPP already stopped");
 		return 0;
 	}
 
-	ppp_state = PPP_STATE_STOPPING;
-	close_ppp_sockets();
+	atomic_set(&link->state, PPP_STATE_STOPPING);
+	close_ppp_sockets(link);
 
-	if (sm_ppp_keep_pipe_attached) {
+	if (link->keep_pipe_attached) {
 		switch (reason) {
 		case PPP_REASON_NETWORK:
 		case PPP_REASON_ERROR:
@@ -411,81 +578,86 @@ static int ppp_stop(enum ppp_reason reason)
 	}
 
 	if (!restarting) {
-		at_monitor_pause(&sm_ppp_on_cgev);
+		link->cgev_monitor = false;
+		ppp_cgev_monitor_update();
 	}
 
-	if (net_if_is_admin_up(ppp_iface)) {
+	if (net_if_is_admin_up(link->iface)) {
 		/* Bring the interface down before releasing pipes and carrier.
 		 * This is needed for LCP to notify the remote endpoint that the link is going down.
 		 */
-		int ret = net_if_down(ppp_iface);
+		int ret = net_if_down(link->iface);
 
 		if (ret) {
 			LOG_WRN("Failed to bring PPP interface down (%d).", ret);
 			/* Retry later */
-			net_if_dormant_on(ppp_iface);
-			delegate_ppp_event(PPP_STOP, reason);
+			net_if_dormant_on(link->iface);
+			delegate_ppp_event(link, PPP_STOP, reason);
 			return ret;
 		}
 	}
 
-	modem_ppp_release(&ppp_module);
+	modem_ppp_release(link->module);
+	sm_ppp_hdlc_detach(link->pipe);
 
-	if (!sm_ppp_keep_pipe_attached) {
+	if (!link->keep_pipe_attached) {
 		/* Return the pipe back to AT host */
-		sm_at_host_attach(ppp_pipe);
-		ppp_pipe = NULL;
-		sm_ppp_detach_at_pipe = false;
+		sm_at_host_attach(link->pipe);
+		link->pipe = NULL;
+		link->detach_at_pipe = false;
 	}
 
-	net_if_carrier_off(ppp_iface);
-	net_if_dormant_on(ppp_iface);
+	net_if_carrier_off(link->iface);
+	net_if_dormant_on(link->iface);
 
-	ppp_state = PPP_STATE_STOPPED;
-	send_status_notification();
+	atomic_set(&link->state, PPP_STATE_STOPPED);
+	send_status_notification(link);
 
 	return 0;
 }
 
-static void ppp_cmd_fail_return_to_at_mode(void)
+static void ppp_cmd_fail_return_to_at_mode(struct ppp_link *link)
 {
-	if (!ppp_pipe) {
+	if (!link->pipe) {
 		return;
 	}
-	rsp_send_to(ppp_pipe, NO_CARRIER);
-	cmd_done(ppp_pipe);
-	ppp_pipe = NULL;
+	rsp_send_to(link->pipe, NO_CARRIER);
+	cmd_done(link->pipe);
+	link->pipe = NULL;
 }
 
 static void sm_ppp_activate_pdp_dwork_fn(struct k_work *work)
 {
+	struct ppp_link *link = CONTAINER_OF(k_work_delayable_from_work(work), struct ppp_link,
+					     activate_pdp_dwork);
+
 	if (!sm_util_cereg_is_registered()) {
-		if (sys_timepoint_expired(ppp_pdn_timeout)) {
+		if (sys_timepoint_expired(link->pdn_timeout)) {
 			LOG_ERR("Timeout while waiting for network registration");
-			ppp_cmd_fail_return_to_at_mode();
+			ppp_cmd_fail_return_to_at_mode(link);
 			return;
 		}
-		k_work_reschedule_for_queue(&sm_work_q, &activate_pdp_dwork, K_SECONDS(1));
+		k_work_reschedule_for_queue(&sm_work_q, &link->activate_pdp_dwork, K_SECONDS(1));
 		return;
 	}
 
-	if (!sm_util_is_cid_active(ppp_pdn_cid)) {
-		LOG_DBG("Activating PDP context %u for PPP...", ppp_pdn_cid);
-		int ret = sm_util_at_printf("AT+CGACT=1,%u", ppp_pdn_cid);
+	if (!sm_util_is_cid_active(link->pdn_cid)) {
+		LOG_DBG("Activating PDP context %u for PPP...", link->pdn_cid);
+		int ret = sm_util_at_printf("AT+CGACT=1,%u", link->pdn_cid);
 
 		if (ret) {
-			LOG_ERR("Failed to activate PDP context %u for PPP (%d).", ppp_pdn_cid,
+			LOG_ERR("Failed to activate PDP context %u for PPP (%d).", link->pdn_cid,
 				ret);
-			ppp_cmd_fail_return_to_at_mode();
+			ppp_cmd_fail_return_to_at_mode(link);
 			return;
 		}
 	}
-	LOG_DBG("PDP context %u activated for PPP.", ppp_pdn_cid);
-	rsp_send_to(ppp_pipe, CONNECT);
-	sm_at_host_release(sm_at_host_get_ctx_from(ppp_pipe));
-	modem_ppp_attach(&ppp_module, ppp_pipe);
-	sm_ppp_set_auto_start(true);
-	delegate_ppp_event(PPP_START, PPP_REASON_CMD);
+	LOG_DBG("PDP context %u activated for PPP.", link->pdn_cid);
+	rsp_send_to(link->pipe, CONNECT);
+	sm_at_host_release(sm_at_host_get_ctx_from(link->pipe));
+	modem_ppp_attach(link->module, sm_ppp_hdlc_attach(link->pipe));
+	link->auto_start = true;
+	delegate_ppp_event(link, PPP_START, PPP_REASON_CMD);
 }
 
 /* We need to receive CGEV notifications at all times.
@@ -553,11 +725,6 @@ static void at_notif_on_cgev(const char *notify)
 	uint8_t cid;
 	char cgev_pdn_act[] = "+CGEV: ME PDN ACT";
 
-	if (!sm_ppp_auto_start) {
-		/* Auto-start disabled, ignore all notifications */
-		return;
-	}
-
 	/* +2 for space and a number */
 	if (strlen(cgev_pdn_act) + 2 > strlen(notify)) {
 		/* Ignore notifications that are not long enough to be what we are interested in */
@@ -569,15 +736,26 @@ static void at_notif_on_cgev(const char *notify)
 	 * from where stopping of PPP is triggered.
 	 */
 	str = strstr(notify, cgev_pdn_act);
-	if (str != NULL) {
-		str += strlen(cgev_pdn_act);
-		if (*str == ' ') {
-			str++;
-			cid = (uint8_t)strtoul(str, &endptr, 10);
-			if (endptr != str && cid == ppp_pdn_cid) {
-				LOG_INF("PPP PDN (%d) activated.", ppp_pdn_cid);
-				delegate_ppp_event(PPP_START, PPP_REASON_NETWORK);
-			}
+	if (str == NULL) {
+		return;
+	}
+	str += strlen(cgev_pdn_act);
+	if (*str != ' ') {
+		return;
+	}
+	str++;
+	cid = (uint8_t)strtoul(str, &endptr, 10);
+	if (endptr == str) {
+		return;
+	}
+
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		struct ppp_link *link = &ppp_links[i];
+
+		/* Links with auto-start disabled ignore all notifications. */
+		if (link->auto_start && link->cgev_monitor && cid == link->pdn_cid) {
+			LOG_INF("PPP PDN (%d) activated.", link->pdn_cid);
+			delegate_ppp_event(link, PPP_START, PPP_REASON_NETWORK);
 		}
 	}
 }
@@ -616,29 +794,31 @@ static void ppp_work_fn(void)
 	int err = 0;
 
 	while (k_msgq_get(&ppp_work.queue, &event, K_NO_WAIT) == 0) {
+		struct ppp_link *link = event.link;
 
-		LOG_INF("PPP %s, reason: %d", ppp_action_str(event.action), event.reason);
+		LOG_INF("PPP %zu %s, reason: %d", ppp_link_idx(link), ppp_action_str(event.action),
+			event.reason);
 
 		switch (event.action) {
 		case PPP_START:
-			err = ppp_start();
+			err = ppp_start(link);
 			break;
 		case PPP_RESTART:
-			err = ppp_stop(event.reason);
+			err = ppp_stop(link, event.reason);
 			if (err) {
 				break;
 			}
-			err = ppp_start();
+			err = ppp_start(link);
 			break;
 		case PPP_STOP:
-			err = ppp_stop(event.reason);
+			err = ppp_stop(link, event.reason);
 			break;
 		default:
 			LOG_ERR("Unknown PPP action: %d.", event.action);
 			break;
 		}
 
-		LOG_INF("PPP %s %s.", ppp_action_str(event.action),
+		LOG_INF("PPP %zu %s %s.", ppp_link_idx(link), ppp_action_str(event.action),
 			(err ? "failed" : "succeeded"));
 	}
 }
@@ -646,27 +826,33 @@ static void ppp_work_fn(void)
 static void ppp_net_mgmt_event_handler(uint64_t mgmt_event, struct net_if *iface, void *info,
 				       size_t info_length, void *user_data)
 {
+	struct ppp_link *link = ppp_link_from_iface(iface);
+
+	if (!link) {
+		return;
+	}
+
 	switch (mgmt_event) {
 	case NET_EVENT_PPP_PHASE_RUNNING:
 		LOG_INF("Peer connected.");
-		ppp_peer_connected = true;
-		send_status_notification();
+		link->peer_connected = true;
+		send_status_notification(link);
 		break;
 	case NET_EVENT_PPP_PHASE_DEAD:
 		LOG_DBG("Peer not connected.");
 		/* This event can come without prior NET_EVENT_PPP_PHASE_RUNNING. */
-		if (!ppp_peer_connected) {
+		if (!link->peer_connected) {
 			break;
 		}
-		ppp_peer_connected = false;
+		link->peer_connected = false;
 		/* Also ignore this event when PPP is not running anymore. */
-		if (!ppp_is_running()) {
+		if (!ppp_link_is_running(link)) {
 			break;
 		}
-		send_status_notification();
+		send_status_notification(link);
 
 		LOG_INF("Peer disconnected. %s PPP...", "Stopping");
-		delegate_ppp_event(PPP_STOP, PPP_REASON_PEER_DISCONNECTED);
+		delegate_ppp_event(link, PPP_STOP, PPP_REASON_PEER_DISCONNECTED);
 
 		break;
 	default:
@@ -677,6 +863,45 @@ NET_MGMT_REGISTER_EVENT_HANDLER(sm_ppp_event_handler,
 				NET_EVENT_PPP_PHASE_RUNNING | NET_EVENT_PPP_PHASE_DEAD,
 				ppp_net_mgmt_event_handler, NULL);
 
+static void ppp_link_init(struct ppp_link *link, struct modem_ppp *module)
+{
+	const size_t idx = ppp_link_idx(link);
+	char name[sizeof("ppp_downlink_00")];
+
+	link->module = module;
+	link->iface = modem_ppp_get_iface(module);
+	net_if_flag_set(link->iface, NET_IF_POINTOPOINT);
+
+	for (size_t i = 0; i != ARRAY_SIZE(link->fds); ++i) {
+		link->fds[i] = -1;
+	}
+	k_work_init_delayable(&link->activate_pdp_dwork, sm_ppp_activate_pdp_dwork_fn);
+	k_work_init(&link->flow_on_work, ppp_flow_on_work_fn);
+
+	/* Start the sending threads of the forwarding directions */
+	for (size_t i = 0; i != ARRAY_SIZE(link->fwd); ++i) {
+		struct ppp_fwd *fwd = &link->fwd[i];
+
+		fwd->link = link;
+		fwd->src = ppp_fwd_dirs[i].src;
+		fwd->dst = ppp_fwd_dirs[i].dst;
+		k_mutex_init(&fwd->send_lock);
+		k_mem_slab_init(&fwd->slab, fwd->pkts, sizeof(fwd->pkts[0]),
+				ARRAY_SIZE(fwd->pkts));
+		k_msgq_init(&fwd->queue, (char *)fwd->queue_buf, sizeof(fwd->queue_buf[0]),
+			    ARRAY_SIZE(fwd->queue_buf));
+
+		const size_t stack_idx = idx * ARRAY_SIZE(link->fwd) + i;
+
+		k_thread_create(&fwd->thread, ppp_fwd_thread_stacks[stack_idx],
+				K_THREAD_STACK_SIZEOF(ppp_fwd_thread_stacks[stack_idx]),
+				ppp_fwd_thread, fwd, NULL, NULL,
+				K_LOWEST_APPLICATION_THREAD_PRIO, 0, K_NO_WAIT);
+		snprintf(name, sizeof(name), "%s_%zu", ppp_fwd_dirs[i].name, idx);
+		k_thread_name_set(&fwd->thread, name);
+	}
+}
+
 static int sm_ppp_init(void)
 {
 	/* Initialize event message queue */
@@ -684,13 +909,17 @@ static int sm_ppp_init(void)
 		    sizeof(ppp_work.queue_buf) / sizeof(struct ppp_event));
 
 	/* Create event eventfd for signaling events to the PPP thread */
-	ppp_fds[EVENT_FD_IDX] = eventfd(0, EFD_NONBLOCK);
-	if (ppp_fds[EVENT_FD_IDX] < 0) {
+	ppp_event_fd = eventfd(0, EFD_NONBLOCK);
+	if (ppp_event_fd < 0) {
 		LOG_ERR("Failed to create event eventfd (%d).", errno);
 		sm_init_failed = true;
 		return -errno;
 	}
 
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		ppp_link_init(&ppp_links[i], ppp_modules[i]);
+	}
+
 	/* Start the PPP thread which will handle events and data passing */
 	k_thread_create(&ppp_data_passing_thread_id, ppp_data_passing_thread_stack,
 			K_THREAD_STACK_SIZEOF(ppp_data_passing_thread_stack),
@@ -698,21 +927,72 @@ static int sm_ppp_init(void)
 			K_LOWEST_APPLICATION_THREAD_PRIO, 0, K_NO_WAIT);
 	k_thread_name_set(&ppp_data_passing_thread_id, "ppp_data_passing");
 
-	ppp_iface = modem_ppp_get_iface(&ppp_module);
-
-	net_if_flag_set(ppp_iface, NET_IF_POINTOPOINT);
-
 	LOG_DBG("PPP initialized.");
 	return 0;
 }
 SYS_INIT(sm_ppp_init, APPLICATION, 0);
 
+/* Selects the link for AT#XPPP. Without <dlci>, the default link is used. */
+static int ppp_link_select(unsigned int dlci, struct ppp_link **link_out,
+			   struct modem_pipe **pipe_out)
+{
+	struct modem_pipe *pipe;
+	struct ppp_link *link;
+
+	*pipe_out = NULL;
+	if (dlci == 0) {
+		*link_out = ppp_default_link;
+		return 0;
+	}
+
+	if (!IS_ENABLED(CONFIG_SM_CMUX) || !sm_cmux_is_started()) {
+		LOG_ERR("CMUX is not started.");
+		return -ENOTCONN;
+	}
+	if (dlci > UINT8_MAX) {
+		return -EINVAL;
+	}
+	pipe = sm_cmux_get_dlci(dlci);
+	if (!pipe) {
+		return -EINVAL;
+	}
+
+	link = ppp_link_from_pipe(pipe);
+	if (!link) {
+		/* Only a channel of the AT host, unless it is reserved for the link. */
+		if (!sm_at_host_get_ctx_from(pipe)) {
+			LOG_ERR("CMUX channel %u is not an AT channel.", dlci);
+			return -EINVAL;
+		}
+		/* Leave the default link for the channel reserved by AT#XCMUX, if possible. */
+		for (size_t i = 1; i <= ARRAY_SIZE(ppp_links); ++i) {
+			struct ppp_link *candidate = &ppp_links[i % ARRAY_SIZE(ppp_links)];
+
+			if (!candidate->pipe && ppp_link_is_stopped(candidate)) {
+				link = candidate;
+				break;
+			}
+		}
+		if (!link) {
+			LOG_ERR("No free PPP link.");
+			return -EBUSY;
+		}
+		*pipe_out = pipe;
+	}
+	*link_out = link;
+	return 0;
+}
+
 SM_AT_CMD_CUSTOM(xppp, "AT#XPPP", handle_at_ppp);
 static int handle_at_ppp(enum at_parser_cmd_type cmd_type, struct at_parser *parser,
 			 uint32_t param_count)
 {
 	int ret;
 	unsigned int op;
+	unsigned int cid = 0;
+	unsigned int dlci = 0;
+	struct ppp_link *link;
+	struct modem_pipe *dlci_pipe;
 	enum {
 		OP_STOP,
 		OP_START,
@@ -720,11 +1000,17 @@ static int handle_at_ppp(enum at_parser_cmd_type cmd_type, struct at_parser *par
 	};
 
 	if (cmd_type == AT_PARSER_CMD_TYPE_READ) {
-		rsp_send("\r\n#XPPP: %u,%u,%u\r\n", !sm_ppp_is_stopped(), ppp_peer_connected,
-			 ppp_pdn_cid);
+		for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+			link = &ppp_links[i];
+			if (link != ppp_default_link && ppp_link_is_stopped(link)) {
+				continue;
+			}
+			rsp_send("\r\n#XPPP: %u,%u,%u\r\n", !ppp_link_is_stopped(link),
+				 link->peer_connected, link->pdn_cid);
+		}
 		return 0;
 	}
-	if (cmd_type != AT_PARSER_CMD_TYPE_SET || param_count < 2 || param_count > 3) {
+	if (cmd_type != AT_PARSER_CMD_TYPE_SET || param_count < 2 || param_count > 4) {
 		return -EINVAL;
 	}
 
@@ -735,48 +1021,110 @@ static int handle_at_ppp(enum at_parser_cmd_type cmd_type, struct at_parser *par
 		return -EINVAL;
 	}
 
-	if (op == OP_STOP && param_count != 2) {
-		return -EINVAL;
+	if (op == OP_STOP) {
+		if (param_count > 3) {
+			return -EINVAL;
+		}
+		if (param_count == 3) {
+			/* Stop the link of the PDN. */
+			ret = at_parser_num_get(parser, 2, &cid);
+			if (ret) {
+				return ret;
+			}
+			link = ppp_link_using_cid(cid, NULL);
+			if (!link) {
+				return -EINVAL;
+			}
+			link->urc_pipe = sm_at_host_get_current_pipe();
+			rsp_send_ok();
+			link->auto_start = false;
+			delegate_ppp_event(link, PPP_STOP, PPP_REASON_CMD);
+			return -SILENT_AT_COMMAND_RET;
+		}
+		/* Stop all the links. */
+		rsp_send_ok();
+		for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+			link = &ppp_links[i];
+			link->auto_start = false;
+			if (link != ppp_default_link && ppp_link_is_stopped(link)) {
+				continue;
+			}
+			link->urc_pipe = sm_at_host_get_current_pipe();
+			delegate_ppp_event(link, PPP_STOP, PPP_REASON_CMD);
+		}
+		return -SILENT_AT_COMMAND_RET;
 	}
 
-	ppp_urc_pipe = sm_at_host_get_current_pipe();
-
-	if (op == OP_START) {
-		if (ppp_state != PPP_STATE_STOPPED) {
-			LOG_ERR("PPP already running");
-			return -EALREADY;
+	/* Store PPP PDN if given */
+	at_parser_num_get(parser, 2, &cid);
+	if (param_count == 4) {
+		ret = at_parser_num_get(parser, 3, &dlci);
+		if (ret) {
+			return ret;
 		}
-		ppp_pdn_cid = 0;
-		/* Store PPP PDN if given */
-		at_parser_num_get(parser, 2, &ppp_pdn_cid);
+	}
 
-		if (!ppp_pipe) {
-			struct sm_at_host_ctx *ctx = sm_at_host_get_current();
-			struct modem_pipe *pipe = ctx ? sm_at_host_get_pipe(ctx) : NULL;
+	ret = ppp_link_select(dlci, &link, &dlci_pipe);
+	if (ret) {
+		return ret;
+	}
+	if (!ppp_link_is_stopped(link)) {
+		LOG_ERR("PPP already running");
+		return -EALREADY;
+	}
+	if (ppp_link_using_cid(cid, link)) {
+		LOG_ERR("PDP context %u already used by PPP.", cid);
+		return -EALREADY;
+	}
 
-			if (!ctx || !pipe) {
-				LOG_ERR("No pipe available for PPP.");
-				return -ENODEV;
-			}
-			ppp_pipe = pipe;
-			rsp_send_ok();
-			sm_ppp_detach_at_pipe = true;
-		} else {
-			/* We already have a pipe, this is coming from CMUX module.
-			 * A statically assigned channel from AT#XCMUX command.
-			 */
-			rsp_send_ok();
+	link->urc_pipe = sm_at_host_get_current_pipe();
+	link->pdn_cid = cid;
+
+	if (dlci_pipe) {
+		/* The CMUX channel is taken from the AT host while PPP runs on it. */
+		link->pipe = dlci_pipe;
+		link->keep_pipe_attached = false;
+		rsp_send_ok();
+		link->detach_at_pipe = true;
+	} else if (!link->pipe) {
+		struct sm_at_host_ctx *ctx = sm_at_host_get_current();
+		struct modem_pipe *pipe = ctx ? sm_at_host_get_pipe(ctx) : NULL;
+
+		if (!ctx || !pipe) {
+			LOG_ERR("No pipe available for PPP.");
+			return -ENODEV;
 		}
-		sm_ppp_set_auto_start(true);
-		delegate_ppp_event(PPP_START, PPP_REASON_CMD);
+		link->pipe = pipe;
+		rsp_send_ok();
+		link->detach_at_pipe = true;
 	} else {
+		/* We already have a pipe, this is coming from CMUX module.
+		 * A statically assigned channel from AT#XCMUX command
+		 * or a channel given with <dlci>.
+		 */
 		rsp_send_ok();
-		sm_ppp_set_auto_start(false);
-		delegate_ppp_event(PPP_STOP, PPP_REASON_CMD);
 	}
+	link->auto_start = true;
+	delegate_ppp_event(link, PPP_START, PPP_REASON_CMD);
 	return -SILENT_AT_COMMAND_RET;
 }
 
+/* Takes the pipe from the link, as the pipe is going away. */
+static void ppp_link_detach(struct ppp_link *link)
+{
+	/* The link is stopped later, without the pipe. */
+	if (link->pipe && !ppp_link_is_stopped(link)) {
+		modem_ppp_release(link->module);
+		sm_ppp_hdlc_detach(link->pipe);
+	}
+	link->pipe = NULL;
+	link->keep_pipe_attached = false;
+	link->auto_start = false;
+	if (!ppp_link_is_stopped(link)) {
+		delegate_ppp_event(link, PPP_STOP, PPP_REASON_CMD);
+	}
+}
+
 SM_AT_CMD_CUSTOM(cgdata, "AT+CGDATA", handle_at_cgdata);
 static int handle_at_cgdata(enum at_parser_cmd_type cmd_type, struct at_parser *parser,
 			    uint32_t param_count)
@@ -790,6 +1138,7 @@ static int handle_at_cgdata(enum at_parser_cmd_type cmd_type, struct at_parser *
 	 *   AT+CGDATA=?         - Report supported L2P values
 	 */
 	int ret;
+	struct ppp_link *link = NULL;
 
 	if (cmd_type == AT_PARSER_CMD_TYPE_TEST) {
 		rsp_send("\r\n+CGDATA: (\"PPP\")\r\n");
@@ -821,110 +1170,390 @@ static int handle_at_cgdata(enum at_parser_cmd_type cmd_type, struct at_parser *
 		}
 	}
 
-	if (ppp_state != PPP_STATE_STOPPED) {
+	struct sm_at_host_ctx *ctx = sm_at_host_get_current();
+	struct modem_pipe *pipe = ctx ? sm_at_host_get_pipe(ctx) : NULL;
+
+	if (!ctx || !pipe) {
+		LOG_ERR("No pipe available for PPP.");
+		return -ENODEV;
+	}
+
+	/* Prefer a stopped link without a reserved pipe, then the stopped default link. */
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		if (ppp_link_is_stopped(&ppp_links[i]) && !ppp_links[i].pipe) {
+			link = &ppp_links[i];
+			break;
+		}
+	}
+	if (!link && ppp_link_is_stopped(ppp_default_link)) {
+		link = ppp_default_link;
+	}
+	if (!link) {
 		LOG_ERR("PPP already running");
 		return -EALREADY;
 	}
+	if (ppp_link_using_cid(cid, link)) {
+		LOG_ERR("PDP context %u already used by PPP.", cid);
+		return -EALREADY;
+	}
 
 	if (!sm_util_cfun_is_lte_enabled()) {
 		return -ENOTCONN;
 	}
 
-	if (ppp_pipe) {
-		sm_ppp_detach();
+	if (link->pipe) {
+		ppp_link_detach(link);
 	}
 
-	ppp_urc_pipe = NULL;
-	struct sm_at_host_ctx *ctx = sm_at_host_get_current();
-	struct modem_pipe *pipe = ctx ? sm_at_host_get_pipe(ctx) : NULL;
-
-	if (!ctx || !pipe) {
-		LOG_ERR("No pipe available for PPP.");
-		return -ENODEV;
-	}
-	ppp_pipe = pipe;
-	sm_ppp_keep_pipe_attached = false;
-	ppp_pdn_cid = cid;
+	link->urc_pipe = NULL;
+	link->pipe = pipe;
+	link->keep_pipe_attached = false;
+	link->pdn_cid = cid;
 	/* Do not block the sm_work_q while waiting for PDP context activation */
-	ppp_pdn_timeout = sys_timepoint_calc(PDN_ACTIVATION_TIMEOUT);
-	(void) k_work_reschedule_for_queue(&sm_work_q, &activate_pdp_dwork, K_NO_WAIT);
+	link->pdn_timeout = sys_timepoint_calc(PDN_ACTIVATION_TIMEOUT);
+	(void) k_work_reschedule_for_queue(&sm_work_q, &link->activate_pdp_dwork, K_NO_WAIT);
 	return -AT_COMMAND_CONTINUE_RET;
 }
 
+enum sm_ppp_stat_op {
+	SM_PPP_STAT_RESET,
+	SM_PPP_STAT_LOG,
+};
+
+/* The read response and the log list the latency buckets one by one. */
+BUILD_ASSERT(PPP_LATENCY_BUCKETS == 6);
+
+static void ppp_stats_log(void)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		for (size_t dir = 0; dir != ARRAY_SIZE(ppp_fwd_dirs); ++dir) {
+			const struct ppp_fwd_stats *stats = &ppp_links[i].fwd[dir].stats;
+
+			LOG_INF("PPP %zu %s: %ld packets, %ld bytes, max %ld/%d queued",
+				i, ppp_fwd_dirs[dir].name, atomic_get(&stats->packets),
+				atomic_get(&stats->bytes), atomic_get(&stats->queue_max),
+				CONFIG_SM_PPP_FWD_BUF_COUNT);
+			LOG_INF("PPP %zu %s: dropped %ld non-IP, %ld short, %ld errors, "
+				"%ld link down",
+				i, ppp_fwd_dirs[dir].name, atomic_get(&stats->drop_non_ip),
+				atomic_get(&stats->drop_short), atomic_get(&stats->drop_error),
+				atomic_get(&stats->drop_link_down));
+			LOG_INF("PPP %zu %s: latency <1 ms %ld, <5 ms %ld, <20 ms %ld, "
+				"<100 ms %ld, <500 ms %ld, slower %ld",
+				i, ppp_fwd_dirs[dir].name, atomic_get(&stats->latency[0]),
+				atomic_get(&stats->latency[1]), atomic_get(&stats->latency[2]),
+				atomic_get(&stats->latency[3]), atomic_get(&stats->latency[4]),
+				atomic_get(&stats->latency[5]));
+		}
+	}
+}
+
+static void ppp_stats_reset(void)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		for (size_t dir = 0; dir != ARRAY_SIZE(ppp_fwd_dirs); ++dir) {
+			struct ppp_fwd_stats *stats = &ppp_links[i].fwd[dir].stats;
+
+			atomic_clear(&stats->packets);
+			atomic_clear(&stats->bytes);
+			atomic_clear(&stats->drop_non_ip);
+			atomic_clear(&stats->drop_short);
+			atomic_clear(&stats->drop_error);
+			atomic_clear(&stats->drop_link_down);
+			atomic_clear(&stats->queue_max);
+			for (size_t b = 0; b != ARRAY_SIZE(stats->latency); ++b) {
+				atomic_clear(&stats->latency[b]);
+			}
+		}
+	}
+}
+
+SM_AT_CMD_CUSTOM(xpppstat, "AT#XPPPSTAT", handle_at_xpppstat);
+static int handle_at_xpppstat(enum at_parser_cmd_type cmd_type, struct at_parser *parser,
+			      uint32_t param_count)
+{
+	uint16_t op;
+	int err;
+
+	switch (cmd_type) {
+	case AT_PARSER_CMD_TYPE_SET:
+		if (param_count != 2) {
+			return -EINVAL;
+		}
+		err = at_parser_num_get(parser, 1, &op);
+		if (err) {
+			return err;
+		}
+		if (op == SM_PPP_STAT_RESET) {
+			ppp_stats_reset();
+		} else if (op == SM_PPP_STAT_LOG) {
+			ppp_stats_log();
+		} else {
+			return -EINVAL;
+		}
+		return 0;
+
+	case AT_PARSER_CMD_TYPE_READ:
+		for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+			for (size_t dir = 0; dir != ARRAY_SIZE(ppp_fwd_dirs); ++dir) {
+				const struct ppp_fwd_stats *stats = &ppp_links[i].fwd[dir].stats;
+
+				rsp_send("\r\n#XPPPSTAT: %zu,%zu,%ld,%ld,%ld,%ld,%ld,%ld,%ld,"
+					 "%ld,%ld,%ld,%ld,%ld,%ld\r\n", i, dir,
+					 atomic_get(&stats->packets), atomic_get(&stats->bytes),
+					 atomic_get(&stats->drop_non_ip),
+					 atomic_get(&stats->drop_short),
+					 atomic_get(&stats->drop_error),
+					 atomic_get(&stats->drop_link_down),
+					 atomic_get(&stats->queue_max),
+					 atomic_get(&stats->latency[0]),
+					 atomic_get(&stats->latency[1]),
+					 atomic_get(&stats->latency[2]),
+					 atomic_get(&stats->latency[3]),
+					 atomic_get(&stats->latency[4]),
+					 atomic_get(&stats->latency[5]));
+			}
+		}
+		return 0;
+
+	case AT_PARSER_CMD_TYPE_TEST:
+		rsp_send("\r\n#XPPPSTAT: (%d,%d)\r\n", SM_PPP_STAT_RESET, SM_PPP_STAT_LOG);
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Wake up the data passing thread to poll again. */
+static void ppp_wake_up(void)
+{
+	if (eventfd_write(ppp_event_fd, 1) != 0) {
+		LOG_ERR("Failed to signal PPP event (%d).", errno);
+	}
+}
+
+static void ppp_flow_on_work_fn(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	ppp_wake_up();
+}
+
+/* Returns whether the data passing thread may receive packets for the direction. */
+static bool ppp_fwd_can_receive(struct ppp_fwd *fwd)
+{
+	struct ppp_link *link = fwd->link;
+
+	/* Stop pulling downlink data while the PPP channel is flow controlled. */
+	if (fwd->dst == ZEPHYR_FD_IDX && sm_cmux_is_flow_off(link->pipe)) {
+		sm_cmux_flow_on_notify(link->pipe, &link->flow_on_work);
+		return false;
+	}
+
+	/* Set before checking, so that a buffer freed meanwhile wakes up the thread. */
+	atomic_set(&fwd->starved, true);
+	if (k_mem_slab_num_free_get(&fwd->slab) == 0) {
+		return false;
+	}
+	atomic_set(&fwd->starved, false);
+	return true;
+}
+
+/* Receives all the ready packets of a direction and queues them for sending. */
+static void ppp_fwd_receive(struct ppp_fwd *fwd)
+{
+	struct ppp_pkt *pkt;
+	ssize_t len;
+
+	while (ppp_fwd_can_receive(fwd)) {
+		if (k_mem_slab_alloc(&fwd->slab, (void **)&pkt, K_NO_WAIT)) {
+			break;
+		}
+
+		/* Networks can send packets larger than the MTU, so use the buffer size. */
+		len = zsock_recv(fwd->link->fds[fwd->src], pkt->data, sizeof(pkt->data),
+				 ZSOCK_MSG_DONTWAIT);
+		if (len <= 0) {
+			if (len != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+				LOG_ERR("Failed to receive data from %s socket (%d, %d).",
+					ppp_socket_names[fwd->src], len, -errno);
+			}
+			k_mem_slab_free(&fwd->slab, pkt);
+			break;
+		}
+		pkt->len = len;
+		pkt->recv_cycles = k_cycle_get_32();
+
+		/* The queue has room for all the buffers of the pool. */
+		k_msgq_put(&fwd->queue, &pkt, K_NO_WAIT);
+		sm_util_atomic_max(&fwd->stats.queue_max, k_msgq_num_used_get(&fwd->queue));
+	}
+}
+
+#if defined(CONFIG_SM_PPP_MSS_CLAMP)
+static void ppp_mss_clamp(const struct ppp_link *link, uint8_t *data, size_t len)
+{
+	const uint32_t mtu = net_if_get_mtu(link->iface);
+
+	sm_ppp_mss_clamp(data, len,
+			 link->pdn_ipv4_mtu ? MIN(mtu, link->pdn_ipv4_mtu) : mtu,
+			 link->pdn_ipv6_mtu ? MIN(mtu, link->pdn_ipv6_mtu) : mtu);
+}
+#endif
+
+static void ppp_fwd_stats_latency(struct ppp_fwd *fwd, const struct ppp_pkt *pkt)
+{
+	const uint32_t ms = k_cyc_to_ms_floor32(k_cycle_get_32() - pkt->recv_cycles);
+	size_t i;
+
+	for (i = 0; i != ARRAY_SIZE(ppp_latency_bounds_ms); ++i) {
+		if (ms < ppp_latency_bounds_ms[i]) {
+			break;
+		}
+	}
+	atomic_inc(&fwd->stats.latency[i]);
+}
+
+static void ppp_fwd_send(struct ppp_fwd *fwd, struct ppp_pkt *pkt)
+{
+	struct ppp_link *link = fwd->link;
+	struct sockaddr_ll *dst_addr = NULL;
+	socklen_t addrlen = 0;
+	ssize_t send_ret;
+
+#if defined(CONFIG_SM_PPP_MSS_CLAMP)
+	ppp_mss_clamp(link, pkt->data, pkt->len);
+#endif
+
+	if (fwd->dst == ZEPHYR_FD_IDX) {
+		uint8_t type = pkt->data[0] & 0xf0;
+
+		if (type == 0x60) {
+			link->zephyr_dst_addr.sll_protocol = htons(ETH_P_IPV6);
+		} else if (type == 0x40) {
+			link->zephyr_dst_addr.sll_protocol = htons(ETH_P_IP);
+		} else {
+			/* Not IP traffic, ignore. */
+			atomic_inc(&fwd->stats.drop_non_ip);
+			return;
+		}
+		dst_addr = &link->zephyr_dst_addr;
+		addrlen = sizeof(link->zephyr_dst_addr);
+	}
+
+	send_ret = zsock_sendto(link->fds[fwd->dst], pkt->data, pkt->len, 0,
+				(struct sockaddr *)dst_addr, addrlen);
+	if (send_ret == -1) {
+		atomic_inc(&fwd->stats.drop_error);
+		LOG_ERR("Failed to send %zu bytes to %s socket (%d).",
+			pkt->len, ppp_socket_names[fwd->dst], -errno);
+	} else if ((size_t)send_ret != pkt->len) {
+		atomic_inc(&fwd->stats.drop_short);
+		LOG_ERR("Only sent %zd out of %zu bytes to %s socket.",
+			send_ret, pkt->len, ppp_socket_names[fwd->dst]);
+	} else {
+		atomic_inc(&fwd->stats.packets);
+		atomic_add(&fwd->stats.bytes, send_ret);
+		ppp_fwd_stats_latency(fwd, pkt);
+		LOG_DBG_RATELIMIT_RATE(5000, "Forwarded %zd bytes to %s socket.",
+			send_ret, ppp_socket_names[fwd->dst]);
+	}
+}
+
+/* Sends the queued packets of one direction, so that a blocking send does not
+ * hold back the other direction or the other links.
+ */
+static void ppp_fwd_thread(void *arg1, void *, void *)
+{
+	struct ppp_fwd *fwd = arg1;
+	struct ppp_pkt *pkt;
+
+	while (true) {
+		k_msgq_get(&fwd->queue, &pkt, K_FOREVER);
+
+		/* Packets queued before the link went down are dropped. */
+		k_mutex_lock(&fwd->send_lock, K_FOREVER);
+		if (ppp_link_is_running(fwd->link)) {
+			ppp_fwd_send(fwd, pkt);
+		} else {
+			atomic_inc(&fwd->stats.drop_link_down);
+		}
+		k_mutex_unlock(&fwd->send_lock);
+		k_mem_slab_free(&fwd->slab, pkt);
+
+		if (atomic_cas(&fwd->starved, true, false)) {
+			ppp_wake_up();
+		}
+	}
+}
+
 static void ppp_data_passing_thread(void*, void*, void*)
 {
-	struct zsock_pollfd fds[PPP_FDS_COUNT];
-	size_t mtu = 0;
+	/* The event FD and the data sockets of all the links */
+	struct zsock_pollfd fds[1 + ARRAY_SIZE(ppp_links) * ARRAY_SIZE(ppp_fwd_dirs)];
+	struct ppp_fwd *polled_fwds[ARRAY_SIZE(fds)];
 
 	while (true) {
 		int nfds = 0;
 
 		/* Always poll the event FD for incoming events */
-		fds[nfds].fd = ppp_fds[EVENT_FD_IDX];
+		fds[nfds].fd = ppp_event_fd;
 		fds[nfds].events = ZSOCK_POLLIN;
-		nfds++;
+		polled_fwds[nfds++] = NULL;
 
-		/* When PPP is running, also poll the PPP data sockets */
-		if (ppp_is_running()) {
-			if (mtu == 0) {
-				mtu = net_if_get_mtu(ppp_iface);
-			}
+		/* Also poll the data sockets of the running links
+		 * for the directions that have free buffers.
+		 */
+		for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+			struct ppp_link *link = &ppp_links[i];
 
-			fds[nfds].fd = ppp_fds[ZEPHYR_FD_IDX];
-			fds[nfds].events = ZSOCK_POLLIN;
-			nfds++;
+			if (!ppp_link_is_running(link)) {
+				continue;
+			}
+			for (size_t j = 0; j != ARRAY_SIZE(link->fwd); ++j) {
+				struct ppp_fwd *fwd = &link->fwd[j];
 
-			fds[nfds].fd = ppp_fds[MODEM_FD_IDX];
-			fds[nfds].events = ZSOCK_POLLIN;
-			nfds++;
-		} else {
-			mtu = 0;
+				fds[nfds].fd = link->fds[fwd->src];
+				fds[nfds].events = ppp_fwd_can_receive(fwd) ? ZSOCK_POLLIN : 0;
+				polled_fwds[nfds++] = fwd;
+			}
 		}
 
 		const int poll_ret = zsock_poll(fds, nfds, -1);
 
 		if (poll_ret <= 0) {
 			LOG_ERR("Sockets polling failed (%d, %d).", poll_ret, -errno);
-			if (ppp_is_running()) {
-				ppp_state = PPP_STATE_STARTING;
-				delegate_ppp_event(PPP_RESTART, PPP_REASON_ERROR);
+			for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+				struct ppp_link *link = &ppp_links[i];
+
+				if (ppp_link_is_running(link)) {
+					atomic_set(&link->state, PPP_STATE_STARTING);
+					delegate_ppp_event(link, PPP_RESTART, PPP_REASON_ERROR);
+				}
 			}
 			k_sleep(K_SECONDS(1));
 			continue;
 		}
 
-		for (int i = 0; i < nfds; ++i) {
-			const short revents = fds[i].revents;
-			const int fd = fds[i].fd;
-
-			if (!revents) {
-				continue;
-			}
-
-			/* Check if this is the event FD */
-			if (fd == ppp_fds[EVENT_FD_IDX]) {
-				if (revents & ZSOCK_POLLIN) {
-					eventfd_t value;
-					/* Read the eventfd to clear it */
-					if (eventfd_read(ppp_fds[EVENT_FD_IDX], &value) == 0) {
-						LOG_DBG("Processing PPP events.");
-						/* Process all queued events */
-						ppp_work_fn();
-					} else {
-						LOG_ERR("Failed to read eventfd (%d).", errno);
-					}
-				}
-				continue;
+		if (fds[0].revents & ZSOCK_POLLIN) {
+			eventfd_t value;
+			/* Read the eventfd to clear it */
+			if (eventfd_read(ppp_event_fd, &value) == 0) {
+				LOG_DBG("Processing PPP events.");
+				/* Process all queued events */
+				ppp_work_fn();
+			} else {
+				LOG_ERR("Failed to read eventfd (%d).", errno);
 			}
+		}
 
-			/* Determine the source index for PPP data sockets */
-			size_t src;
+		for (int i = 1; i < nfds; ++i) {
+			struct ppp_fwd *fwd = polled_fwds[i];
+			struct ppp_link *link = fwd->link;
+			const short revents = fds[i].revents;
 
-			if (fd == ppp_fds[ZEPHYR_FD_IDX]) {
-				src = ZEPHYR_FD_IDX;
-			} else if (fd == ppp_fds[MODEM_FD_IDX]) {
-				src = MODEM_FD_IDX;
-			} else {
+			if (!revents || !ppp_link_is_running(link)) {
 				continue;
 			}
 
@@ -932,56 +1561,16 @@ static void ppp_data_passing_thread(void*, void*, void*)
 				/* ZSOCK_POLLERR comes when the connection goes down (AT+CFUN=0). */
 				if (revents ^ ZSOCK_POLLERR) {
 					LOG_WRN("Unexpected event 0x%x on %s socket. Stop.",
-						revents, ppp_socket_names[src]);
+						revents, ppp_socket_names[fwd->src]);
 				} else {
 					LOG_DBG("Connection down. Stop.");
 				}
-				ppp_state = PPP_STATE_STOPPING;
-				delegate_ppp_event(PPP_STOP, PPP_REASON_NETWORK);
-				continue;
-			}
-
-			/* Networks can send packets larger than the MTU, so use the buffer size. */
-			const ssize_t len = zsock_recv(fds[src].fd, ppp_data_buf,
-						       sizeof(ppp_data_buf), ZSOCK_MSG_DONTWAIT);
-
-			if (len <= 0) {
-				if (len != -1 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
-					LOG_ERR("Failed to receive data from %s socket (%d, %d).",
-						ppp_socket_names[src], len, -errno);
-				}
+				atomic_set(&link->state, PPP_STATE_STOPPING);
+				delegate_ppp_event(link, PPP_STOP, PPP_REASON_NETWORK);
 				continue;
 			}
-			ssize_t send_ret;
-			const size_t dst = (src == ZEPHYR_FD_IDX) ? MODEM_FD_IDX : ZEPHYR_FD_IDX;
-			void *dst_addr = (dst == MODEM_FD_IDX) ? NULL : &ppp_zephyr_dst_addr;
-			socklen_t addrlen = (dst == MODEM_FD_IDX) ? 0 : sizeof(ppp_zephyr_dst_addr);
-
-			if (dst == ZEPHYR_FD_IDX) {
-				uint8_t type = ppp_data_buf[0] & 0xf0;
-
-				if (type == 0x60) {
-					ppp_zephyr_dst_addr.sll_protocol = htons(ETH_P_IPV6);
-				} else if (type == 0x40) {
-					ppp_zephyr_dst_addr.sll_protocol = htons(ETH_P_IP);
-				} else {
-					/* Not IP traffic, ignore. */
-					continue;
-				}
-			}
 
-			send_ret =
-				zsock_sendto(fds[dst].fd, ppp_data_buf, len, 0, dst_addr, addrlen);
-			if (send_ret == -1) {
-				LOG_ERR("Failed to send %zd bytes to %s socket (%d).",
-					len, ppp_socket_names[dst], -errno);
-			} else if (send_ret != len) {
-				LOG_ERR("Only sent %zd out of %zd bytes to %s socket.",
-					send_ret, len, ppp_socket_names[dst]);
-			} else {
-				LOG_DBG_RATELIMIT_RATE(5000, "Forwarded %zd bytes to %s socket.",
-					send_ret, ppp_socket_names[dst]);
-			}
+			ppp_fwd_receive(fwd);
 		}
 	}
 }
@@ -991,21 +1580,19 @@ void sm_ppp_attach(struct modem_pipe *pipe)
 	if (pipe) {
 		modem_pipe_release(pipe);
 	}
-	ppp_pipe = pipe;
-	sm_ppp_keep_pipe_attached = true;
+	ppp_default_link->pipe = pipe;
+	ppp_default_link->keep_pipe_attached = true;
 }
 
 void sm_ppp_detach(void)
 {
-	ppp_pipe = NULL;
-	sm_ppp_keep_pipe_attached = false;
-	sm_ppp_auto_start = false;
-	if (!sm_ppp_is_stopped()) {
-		delegate_ppp_event(PPP_STOP, PPP_REASON_CMD);
+	/* All the links are on CMUX channels or on the pipe that is going away. */
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_links); ++i) {
+		ppp_link_detach(&ppp_links[i]);
 	}
 }
 
 void sm_ppp_detach_after_disconnect(void)
 {
-	sm_ppp_keep_pipe_attached = false;
+	ppp_default_link->keep_pipe_attached = false;
 }
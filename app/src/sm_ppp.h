@@ -12,6 +12,7 @@
 /* Whether to forward CGEV notifications to the Serial Modem UART. */
 extern bool sm_fwd_cgev_notifs;
 
+/* The functions below apply to the default PPP link, unless stated otherwise. */
 bool sm_ppp_is_stopped(void);
 bool ppp_is_running(void);
 void sm_ppp_set_auto_start(bool enable);
@@ -19,7 +20,7 @@ void sm_ppp_set_auto_start(bool enable);
 /** Set the permanent modem pipe for PPP communication */
 void sm_ppp_attach(struct modem_pipe *pipe);
 
-/** Detach the modem pipe from PPP communication */
+/** Detach the modem pipes of all the PPP links and stop them */
 void sm_ppp_detach(void);
 
 /** Ask to detach from PIPE after disconnecting PPP */
@@ -0,0 +1,1109 @@
+/*
+ * Copyright (c) 2026 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+#include "sm_ppp_hdlc.h"
+#include "sm_util.h"
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/crc.h>
+#include <string.h>
+
+/* The PPP module frames the packets with the default link options of RFC 1662.
+ * It is given a pipe of its own, through which its frames are framed again on the fly
+ * with the options that the host requested, and that were acknowledged, in LCP.
+ * With CONFIG_SM_PPP_HDLC_VJ, the TCP/IP headers are also compressed (RFC 1144) when the host
+ * requests it in IPCP.
+ */
+LOG_MODULE_REGISTER(sm_ppp_hdlc, CONFIG_SM_LOG_LEVEL);
+
+#define HDLC_FLAG            0x7e
+#define HDLC_ESCAPE          0x7d
+#define HDLC_ESCAPE_XOR      0x20
+#define HDLC_ADDRESS         0xff
+#define HDLC_CONTROL         0x03
+#define HDLC_FCS_INIT        0xffff
+#define HDLC_FCS_GOOD        0xf0b8
+#define HDLC_FCS_LEN         2
+#define HDLC_ACCM_DEFAULT    0xffffffff
+/* Address, control and protocol fields as sent by the PPP module and the host */
+#define HDLC_HDR_LEN         4
+
+/* Longest LCP or IPCP frame that is looked into, without the header */
+#define HDLC_CTRL_MAX        64
+/* Longest IPCP frame from the host that is looked into, every byte escaped */
+#define HDLC_RX_CARRY_MAX    (2 * (HDLC_HDR_LEN + HDLC_CTRL_MAX))
+#define HDLC_TX_BUF_SIZE     512
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+/* Room needed in the transmit buffer before a byte is taken from the PPP module:
+ * a control frame with an inserted option, every byte escaped, and the flags
+ */
+#define HDLC_TX_BURST_MAX    (2 * (HDLC_HDR_LEN + HDLC_CTRL_MAX + VJ_OPT_LEN + HDLC_FCS_LEN) + 2)
+#else
+/* Room needed in the transmit buffer before a byte is taken from the PPP module:
+ * a header and an FCS, every byte escaped, and the flags
+ */
+#define HDLC_TX_BURST_MAX    (2 * (HDLC_HDR_LEN + HDLC_FCS_LEN) + 2)
+#endif
+
+#define PPP_PROTO_IP         0x0021
+#define PPP_PROTO_VJ_COMP    0x002d
+#define PPP_PROTO_VJ_UNCOMP  0x002f
+#define PPP_PROTO_IPCP       0x8021
+#define PPP_PROTO_LCP        0xc021
+
+/* Control protocol (LCP and IPCP) packets */
+#define CP_CONFIGURE_REQ     1
+#define CP_CONFIGURE_ACK     2
+#define CP_CONFIGURE_NAK     3
+#define CP_CONFIGURE_REJ     4
+#define CP_TERMINATE_REQ     5
+#define CP_TERMINATE_ACK     6
+#define CP_HDR_LEN           4
+#define LCP_OPT_ACCM         2
+#define LCP_OPT_PFC          7
+#define LCP_OPT_ACFC         8
+#define IPCP_OPT_COMP        2
+/* IP-Compression-Protocol option for Van Jacobson: protocol, max slot ID and comp slot ID */
+#define VJ_OPT_LEN           6
+
+/* Van Jacobson TCP/IP header compression (RFC 1144) */
+#define VJ_SLOT_COUNT        4
+#define VJ_HDR_MAX           64
+#define VJ_SLOT_NONE         0xff
+#define VJ_NEW_C             0x40
+#define VJ_NEW_I             0x20
+#define VJ_PUSH              0x10
+#define VJ_NEW_S             0x08
+#define VJ_NEW_A             0x04
+#define VJ_NEW_W             0x02
+#define VJ_NEW_U             0x01
+#define VJ_SPECIAL_I         (VJ_NEW_S | VJ_NEW_W | VJ_NEW_U)
+#define VJ_SPECIAL_D         (VJ_NEW_S | VJ_NEW_A | VJ_NEW_W | VJ_NEW_U)
+/* Changes, connection number, TCP checksum and five deltas of up to three bytes */
+#define VJ_COMP_HDR_MAX      (4 + 5 * 3)
+
+#define IP_PROTO_TCP         6
+#define TCP_FIN              0x01
+#define TCP_SYN              0x02
+#define TCP_RST              0x04
+#define TCP_PSH              0x08
+#define TCP_ACK              0x10
+#define TCP_URG              0x20
+
+BUILD_ASSERT(VJ_HDR_MAX <= HDLC_CTRL_MAX);
+BUILD_ASSERT(HDLC_TX_BURST_MAX <= HDLC_TX_BUF_SIZE);
+
+enum hdlc_tx_state {
+	/* Before the first frame */
+	TX_IDLE,
+	/* Address, control and protocol fields */
+	TX_HEADER,
+	/* Frame sent as is */
+	TX_RAW,
+	/* IPCP frame or TCP/IP headers taken before they are sent */
+	TX_COLLECT,
+	/* Rest of the frame, framed again on the fly */
+	TX_STREAM,
+};
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+/* Last TCP/IP headers sent on a connection */
+struct vj_slot {
+	uint8_t hdr[VJ_HDR_MAX];
+	/* 0 while the slot is unused */
+	uint8_t hdr_len;
+	uint32_t used;
+};
+#endif
+
+/* Re-framing state of a PPP link */
+struct ppp_hdlc {
+	/* Pipe of the PPP module */
+	struct modem_pipe pipe;
+	/* Pipe of the link, NULL while not in use */
+	struct modem_pipe *link;
+	struct k_mutex lock;
+	struct k_work flush_work;
+
+	/* Link options for transmission, acknowledged with our LCP Configure-Ack */
+	uint32_t accm;
+	bool acfc;
+	bool pfc;
+
+	/* Frames from the PPP module */
+	struct {
+		enum hdlc_tx_state state;
+		bool escape;
+		uint8_t hdr[HDLC_HDR_LEN];
+		size_t hdr_len;
+		uint16_t protocol;
+		/* ACCM and FCS of the frame being sent */
+		uint32_t accm;
+		uint16_t fcs;
+		/* Bytes taken after the protocol field, with room for an inserted option */
+		uint8_t buf[HDLC_CTRL_MAX + VJ_OPT_LEN];
+		size_t len;
+		/* Look into the LCP frame being sent as is. */
+		bool snoop;
+		/* The last two bytes taken, which are the FCS at the end of the frame */
+		uint8_t hold[HDLC_FCS_LEN];
+		size_t hold_len;
+		/* Framed bytes waiting for transmission */
+		uint8_t out[HDLC_TX_BUF_SIZE];
+		size_t out_len;
+	} tx;
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+	/* Frames from the host */
+	struct {
+		/* In a frame that is passed as is */
+		bool pass;
+		/* Start of a frame that is not yet passed, taken again with the next data */
+		uint8_t carry[HDLC_RX_CARRY_MAX];
+		size_t carry_len;
+		uint8_t frame[HDLC_RX_CARRY_MAX];
+	} rx;
+
+	struct {
+		bool on;
+		uint8_t slot_count;
+		/* The connection number may be left out when it does not change. */
+		bool comp_slot;
+		uint8_t last_slot;
+		uint32_t clock;
+		struct vj_slot slots[VJ_SLOT_COUNT];
+		/* Last IPCP Configure-Request of the host. Its IP-Compression-Protocol option
+		 * is hidden from the PPP module, and put back in the Configure-Ack.
+		 */
+		bool req_valid;
+		bool req_vj;
+		uint8_t req_id;
+		size_t req_off;
+		uint8_t req_opt[VJ_OPT_LEN];
+	} vj;
+#endif
+};
+
+/* One for each PPP link */
+static struct ppp_hdlc ppp_hdlcs[CONFIG_SM_PPP_LINK_COUNT];
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+static void hdlc_vj_reset(struct ppp_hdlc *hdlc)
+{
+	hdlc->vj.on = false;
+	hdlc->vj.req_valid = false;
+}
+#endif
+
+static void hdlc_options_reset(struct ppp_hdlc *hdlc)
+{
+	hdlc->accm = HDLC_ACCM_DEFAULT;
+	hdlc->acfc = false;
+	hdlc->pfc = false;
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+	/* IPCP is negotiated again after LCP. */
+	hdlc_vj_reset(hdlc);
+#endif
+}
+
+/* The options of our Configure-Ack are the ones the host asked us to use when sending. */
+static void hdlc_lcp_snoop(struct ppp_hdlc *hdlc, const uint8_t *lcp, size_t len)
+{
+	uint32_t accm = HDLC_ACCM_DEFAULT;
+	bool acfc = false;
+	bool pfc = false;
+	size_t lcp_len;
+
+	if (len < CP_HDR_LEN) {
+		return;
+	}
+	if (lcp[0] == CP_TERMINATE_REQ || lcp[0] == CP_TERMINATE_ACK) {
+		hdlc_options_reset(hdlc);
+		return;
+	}
+	if (lcp[0] != CP_CONFIGURE_ACK) {
+		return;
+	}
+
+	hdlc_options_reset(hdlc);
+
+	/* A frame too long to be looked into keeps the default options. */
+	lcp_len = sys_get_be16(&lcp[2]);
+	if (lcp_len > len) {
+		return;
+	}
+	for (size_t i = CP_HDR_LEN; i + 2 <= lcp_len; i += lcp[i + 1]) {
+		if (lcp[i + 1] < 2 || i + lcp[i + 1] > lcp_len) {
+			return;
+		}
+		switch (lcp[i]) {
+		case LCP_OPT_ACCM:
+			if (lcp[i + 1] == 6) {
+				accm = sys_get_be32(&lcp[i + 2]);
+			}
+			break;
+		case LCP_OPT_PFC:
+			pfc = true;
+			break;
+		case LCP_OPT_ACFC:
+			acfc = true;
+			break;
+		default:
+			break;
+		}
+	}
+
+	hdlc->accm = accm;
+	hdlc->acfc = acfc;
+	hdlc->pfc = pfc;
+	LOG_INF("PPP transmit options: ACCM 0x%08x, ACFC %d, PFC %d.", accm, acfc, pfc);
+}
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+static void vj_start(struct ppp_hdlc *hdlc)
+{
+	hdlc->vj.on = true;
+	hdlc->vj.slot_count = MIN(VJ_SLOT_COUNT, hdlc->vj.req_opt[4] + 1);
+	hdlc->vj.comp_slot = hdlc->vj.req_opt[5];
+	hdlc->vj.last_slot = VJ_SLOT_NONE;
+	for (size_t i = 0; i != ARRAY_SIZE(hdlc->vj.slots); ++i) {
+		hdlc->vj.slots[i].hdr_len = 0;
+	}
+	LOG_INF("PPP TCP/IP header compression with %u slots.", hdlc->vj.slot_count);
+}
+
+/* Returns the slot of the connection of a TCP/IP packet, or else the first unused slot or
+ * the least recently used one, with *found cleared.
+ */
+static struct vj_slot *vj_slot_get(struct ppp_hdlc *hdlc, const uint8_t *pkt, size_t ihl,
+				   bool *found)
+{
+	struct vj_slot *lru = &hdlc->vj.slots[0];
+
+	for (size_t i = 0; i != hdlc->vj.slot_count; ++i) {
+		struct vj_slot *slot = &hdlc->vj.slots[i];
+		const size_t slot_ihl = (slot->hdr[0] & 0x0f) * 4;
+
+		if (slot->hdr_len && !memcmp(&slot->hdr[12], &pkt[12], 8) &&
+		    !memcmp(&slot->hdr[slot_ihl], &pkt[ihl], 4)) {
+			*found = true;
+			return slot;
+		}
+		if (lru->hdr_len && (!slot->hdr_len || slot->used < lru->used)) {
+			lru = slot;
+		}
+	}
+	*found = false;
+	return lru;
+}
+
+static void vj_encode(uint8_t *buf, size_t *len, uint16_t value, bool zero)
+{
+	if (value >= 256 || (value == 0 && zero)) {
+		buf[(*len)++] = 0;
+		sys_put_be16(value, &buf[*len]);
+		*len += 2;
+	} else {
+		buf[(*len)++] = value;
+	}
+}
+
+/* Compress the TCP/IP headers of an IP packet (RFC 1144). The headers are replaced
+ * with chdr for a compressed packet. Returns the protocol to send the packet with.
+ */
+static uint16_t vj_compress(struct ppp_hdlc *hdlc, uint8_t *pkt, size_t hdr_len,
+			    uint8_t *chdr, size_t *chdr_len)
+{
+	const size_t ihl = (pkt[0] & 0x0f) * 4;
+	const uint8_t *th = &pkt[ihl];
+	uint8_t deltas[5 * 3];
+	size_t deltas_len = 0;
+	uint8_t changes = 0;
+	struct vj_slot *slot;
+	const uint8_t *oip;
+	const uint8_t *oth;
+	uint32_t delta_s;
+	uint32_t delta_a;
+	uint16_t delta;
+	uint8_t slot_id;
+	bool found;
+
+	if ((sys_get_be16(&pkt[6]) & 0x3fff) || sys_get_be16(&pkt[2]) < hdr_len ||
+	    (th[13] & (TCP_SYN | TCP_FIN | TCP_RST | TCP_ACK)) != TCP_ACK) {
+		return PPP_PROTO_IP;
+	}
+
+	slot = vj_slot_get(hdlc, pkt, ihl, &found);
+	slot_id = slot - hdlc->vj.slots;
+	slot->used = ++hdlc->vj.clock;
+	oip = slot->hdr;
+	oth = &oip[ihl];
+
+	/* Everything but the fields that are sent as deltas must be the same. */
+	if (!found || slot->hdr_len != hdr_len || memcmp(&pkt[0], &oip[0], 2) ||
+	    memcmp(&pkt[6], &oip[6], 4) || memcmp(&pkt[20], &oip[20], ihl - 20) ||
+	    th[12] != oth[12] ||
+	    (th[13] & ~(TCP_PSH | TCP_URG)) != (oth[13] & ~(TCP_PSH | TCP_URG)) ||
+	    memcmp(&th[20], &oth[20], hdr_len - ihl - 20)) {
+		goto uncompressed;
+	}
+
+	if (th[13] & TCP_URG) {
+		vj_encode(deltas, &deltas_len, sys_get_be16(&th[18]), true);
+		changes |= VJ_NEW_U;
+	} else if (sys_get_be16(&th[18]) != sys_get_be16(&oth[18])) {
+		goto uncompressed;
+	}
+	delta = sys_get_be16(&th[14]) - sys_get_be16(&oth[14]);
+	if (delta) {
+		vj_encode(deltas, &deltas_len, delta, false);
+		changes |= VJ_NEW_W;
+	}
+	delta_a = sys_get_be32(&th[8]) - sys_get_be32(&oth[8]);
+	if (delta_a) {
+		if (delta_a > 0xffff) {
+			goto uncompressed;
+		}
+		vj_encode(deltas, &deltas_len, delta_a, false);
+		changes |= VJ_NEW_A;
+	}
+	delta_s = sys_get_be32(&th[4]) - sys_get_be32(&oth[4]);
+	if (delta_s) {
+		if (delta_s > 0xffff) {
+			goto uncompressed;
+		}
+		vj_encode(deltas, &deltas_len, delta_s, false);
+		changes |= VJ_NEW_S;
+	}
+
+	switch (changes) {
+	case 0:
+		/* Data following an acknowledgment. Anything else is likely a retransmission. */
+		if (sys_get_be16(&pkt[2]) != sys_get_be16(&oip[2]) &&
+		    sys_get_be16(&oip[2]) == hdr_len) {
+			break;
+		}
+		goto uncompressed;
+	case VJ_SPECIAL_I:
+	case VJ_SPECIAL_D:
+		goto uncompressed;
+	case VJ_NEW_S | VJ_NEW_A:
+		if (delta_s == delta_a && delta_s == sys_get_be16(&oip[2]) - hdr_len) {
+			/* Interactive traffic echoed back */
+			changes = VJ_SPECIAL_I;
+			deltas_len = 0;
+		}
+		break;
+	case VJ_NEW_S:
+		if (delta_s == sys_get_be16(&oip[2]) - hdr_len) {
+			/* Unidirectional data */
+			changes = VJ_SPECIAL_D;
+			deltas_len = 0;
+		}
+		break;
+	default:
+		break;
+	}
+
+	delta = sys_get_be16(&pkt[4]) - sys_get_be16(&oip[4]);
+	if (delta != 1) {
+		vj_encode(deltas, &deltas_len, delta, true);
+		changes |= VJ_NEW_I;
+	}
+	if (th[13] & TCP_PSH) {
+		changes |= VJ_PUSH;
+	}
+	memcpy(slot->hdr, pkt, hdr_len);
+
+	*chdr_len = 0;
+	chdr[(*chdr_len)++] = changes;
+	if (!hdlc->vj.comp_slot || hdlc->vj.last_slot != slot_id) {
+		chdr[0] |= VJ_NEW_C;
+		chdr[(*chdr_len)++] = slot_id;
+		hdlc->vj.last_slot = slot_id;
+	}
+	/* The TCP checksum is sent as is. */
+	chdr[(*chdr_len)++] = th[16];
+	chdr[(*chdr_len)++] = th[17];
+	memcpy(&chdr[*chdr_len], deltas, deltas_len);
+	*chdr_len += deltas_len;
+	return PPP_PROTO_VJ_COMP;
+
+uncompressed:
+	memcpy(slot->hdr, pkt, hdr_len);
+	slot->hdr_len = hdr_len;
+	/* The connection number is sent in the protocol field of the IP header. */
+	pkt[9] = slot_id;
+	hdlc->vj.last_slot = slot_id;
+	return PPP_PROTO_VJ_UNCOMP;
+}
+
+/* Returns the length of the TCP/IP headers of a packet, 0 if more bytes are needed
+ * or -1 if the headers cannot be compressed.
+ */
+static int vj_hdr_len(const uint8_t *pkt, size_t len)
+{
+	size_t ihl;
+	size_t hdr_len;
+
+	if (len < 1) {
+		return 0;
+	}
+	ihl = (pkt[0] & 0x0f) * 4;
+	if ((pkt[0] >> 4) != 4 || ihl < 20) {
+		return -1;
+	}
+	if (len < 10) {
+		return 0;
+	}
+	if (pkt[9] != IP_PROTO_TCP || ihl + 20 > VJ_HDR_MAX) {
+		return -1;
+	}
+	if (len < ihl + 13) {
+		return 0;
+	}
+	hdr_len = ihl + (pkt[ihl + 12] >> 4) * 4;
+	if (hdr_len < ihl + 20 || hdr_len > VJ_HDR_MAX) {
+		return -1;
+	}
+	return (len >= hdr_len) ? hdr_len : 0;
+}
+#endif
+
+/* Puts a byte in the transmit buffer, escaped as needed. */
+static void tx_encode(struct ppp_hdlc *hdlc, uint8_t byte, uint32_t accm)
+{
+	if (byte == HDLC_FLAG || byte == HDLC_ESCAPE || (byte < 0x20 && (accm & BIT(byte)))) {
+		hdlc->tx.out[hdlc->tx.out_len++] = HDLC_ESCAPE;
+		byte ^= HDLC_ESCAPE_XOR;
+	}
+	hdlc->tx.out[hdlc->tx.out_len++] = byte;
+}
+
+/* Puts a byte of the frame being sent, which is covered by its FCS. */
+static void tx_put(struct ppp_hdlc *hdlc, uint8_t byte)
+{
+	hdlc->tx.fcs = crc16_ccitt(hdlc->tx.fcs, &byte, 1);
+	tx_encode(hdlc, byte, hdlc->tx.accm);
+}
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+static void tx_put_buf(struct ppp_hdlc *hdlc, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i != len; ++i) {
+		tx_put(hdlc, buf[i]);
+	}
+}
+#endif
+
+/* Starts a frame with the negotiated options. LCP is always sent with the default options. */
+static void tx_frame_begin(struct ppp_hdlc *hdlc, uint16_t protocol)
+{
+	const bool lcp = (protocol == PPP_PROTO_LCP);
+
+	hdlc->tx.accm = lcp ? HDLC_ACCM_DEFAULT : hdlc->accm;
+	hdlc->tx.fcs = HDLC_FCS_INIT;
+	hdlc->tx.hold_len = 0;
+	hdlc->tx.out[hdlc->tx.out_len++] = HDLC_FLAG;
+	if (lcp || !hdlc->acfc) {
+		tx_put(hdlc, HDLC_ADDRESS);
+		tx_put(hdlc, HDLC_CONTROL);
+	}
+	if (lcp || !hdlc->pfc || protocol > 0xff) {
+		tx_put(hdlc, protocol >> 8);
+	}
+	tx_put(hdlc, protocol);
+}
+
+static void tx_frame_finish(struct ppp_hdlc *hdlc)
+{
+	const uint16_t fcs = hdlc->tx.fcs ^ 0xffff;
+
+	tx_encode(hdlc, fcs & 0xff, hdlc->tx.accm);
+	tx_encode(hdlc, fcs >> 8, hdlc->tx.accm);
+	hdlc->tx.out[hdlc->tx.out_len++] = HDLC_FLAG;
+}
+
+/* Starts a frame sent as is, with its original header and FCS. */
+static void tx_raw_begin(struct ppp_hdlc *hdlc)
+{
+	hdlc->tx.out[hdlc->tx.out_len++] = HDLC_FLAG;
+	for (size_t i = 0; i != hdlc->tx.hdr_len; ++i) {
+		tx_encode(hdlc, hdlc->tx.hdr[i], HDLC_ACCM_DEFAULT);
+	}
+	hdlc->tx.state = TX_RAW;
+}
+
+/* Sends the bytes after the frame being sent, keeping the last two for the FCS. */
+static void tx_stream(struct ppp_hdlc *hdlc, uint8_t byte)
+{
+	if (hdlc->tx.hold_len < sizeof(hdlc->tx.hold)) {
+		hdlc->tx.hold[hdlc->tx.hold_len++] = byte;
+		return;
+	}
+	tx_put(hdlc, hdlc->tx.hold[0]);
+	hdlc->tx.hold[0] = hdlc->tx.hold[1];
+	hdlc->tx.hold[1] = byte;
+}
+
+static void tx_header_done(struct ppp_hdlc *hdlc)
+{
+	const uint8_t *hdr = hdlc->tx.hdr;
+
+	hdlc->tx.protocol = sys_get_be16(&hdr[2]);
+	hdlc->tx.len = 0;
+	hdlc->tx.snoop = false;
+
+	/* The PPP module sends the address, control and protocol fields uncompressed. */
+	if (hdr[0] != HDLC_ADDRESS || hdr[1] != HDLC_CONTROL) {
+		tx_raw_begin(hdlc);
+		return;
+	}
+
+	if (hdlc->tx.protocol == PPP_PROTO_LCP) {
+		tx_raw_begin(hdlc);
+		hdlc->tx.snoop = true;
+		return;
+	}
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+	if (hdlc->tx.protocol == PPP_PROTO_IPCP ||
+	    (hdlc->tx.protocol == PPP_PROTO_IP && hdlc->vj.on)) {
+		hdlc->tx.state = TX_COLLECT;
+		return;
+	}
+#endif
+	tx_frame_begin(hdlc, hdlc->tx.protocol);
+	hdlc->tx.state = TX_STREAM;
+}
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+/* Sends the IP packet being collected once its headers are known. */
+static void tx_ip_collect(struct ppp_hdlc *hdlc)
+{
+	uint8_t chdr[VJ_COMP_HDR_MAX];
+	size_t chdr_len;
+	uint16_t protocol = PPP_PROTO_IP;
+	const int hdr_len = vj_hdr_len(hdlc->tx.buf, hdlc->tx.len);
+
+	if (hdr_len == 0) {
+		return;
+	}
+	if (hdr_len > 0) {
+		protocol = vj_compress(hdlc, hdlc->tx.buf, hdr_len, chdr, &chdr_len);
+	}
+
+	tx_frame_begin(hdlc, protocol);
+	if (protocol == PPP_PROTO_VJ_COMP) {
+		tx_put_buf(hdlc, chdr, chdr_len);
+	} else {
+		for (size_t i = 0; i != hdlc->tx.len; ++i) {
+			tx_stream(hdlc, hdlc->tx.buf[i]);
+		}
+	}
+	hdlc->tx.state = TX_STREAM;
+}
+
+/* Sends an IPCP frame. The option hidden from the PPP module is put back in its
+ * Configure-Ack, which enables the header compression. A Configure-Nak or Configure-Reject
+ * is sent as is, as the PPP module never saw the option.
+ */
+static void tx_ipcp_send(struct ppp_hdlc *hdlc, size_t len)
+{
+	uint8_t *ipcp = hdlc->tx.buf;
+	const size_t off = CP_HDR_LEN + hdlc->vj.req_off;
+
+	if (len >= CP_HDR_LEN && sys_get_be16(&ipcp[2]) == len) {
+		switch (ipcp[0]) {
+		case CP_CONFIGURE_ACK:
+			if (!hdlc->vj.req_valid || ipcp[1] != hdlc->vj.req_id) {
+				break;
+			}
+			hdlc->vj.req_valid = false;
+			hdlc->vj.on = false;
+			if (!hdlc->vj.req_vj || off > len) {
+				break;
+			}
+			memmove(&ipcp[off + VJ_OPT_LEN], &ipcp[off], len - off);
+			memcpy(&ipcp[off], hdlc->vj.req_opt, VJ_OPT_LEN);
+			len += VJ_OPT_LEN;
+			sys_put_be16(len, &ipcp[2]);
+			vj_start(hdlc);
+			break;
+		case CP_CONFIGURE_NAK:
+		case CP_CONFIGURE_REJ:
+			/* The host sends its Configure-Request again, with the option if it still
+			 * wants it. The compression stays off until that one is acknowledged.
+			 */
+			if (hdlc->vj.req_valid && ipcp[1] == hdlc->vj.req_id) {
+				hdlc->vj.req_valid = false;
+				hdlc->vj.on = false;
+			}
+			break;
+		case CP_TERMINATE_REQ:
+		case CP_TERMINATE_ACK:
+			hdlc_vj_reset(hdlc);
+			break;
+		default:
+			break;
+		}
+	}
+
+	tx_frame_begin(hdlc, PPP_PROTO_IPCP);
+	tx_put_buf(hdlc, ipcp, len);
+	tx_frame_finish(hdlc);
+}
+#endif
+
+static void tx_frame_end(struct ppp_hdlc *hdlc)
+{
+	switch (hdlc->tx.state) {
+	case TX_HEADER:
+		if (hdlc->tx.hdr_len) {
+			LOG_WRN("Invalid PPP frame (%zu bytes), dropped.", hdlc->tx.hdr_len);
+		}
+		break;
+	case TX_RAW:
+		hdlc->tx.out[hdlc->tx.out_len++] = HDLC_FLAG;
+		if (hdlc->tx.snoop && hdlc->tx.len >= HDLC_FCS_LEN) {
+			hdlc_lcp_snoop(hdlc, hdlc->tx.buf,
+				       MIN(hdlc->tx.len - HDLC_FCS_LEN, HDLC_CTRL_MAX));
+		}
+		break;
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+	case TX_COLLECT:
+		/* The frame ended before it was sent, its last two bytes are the FCS. */
+		hdlc->tx.len -= MIN(hdlc->tx.len, HDLC_FCS_LEN);
+		if (hdlc->tx.protocol == PPP_PROTO_IPCP) {
+			tx_ipcp_send(hdlc, hdlc->tx.len);
+			break;
+		}
+		tx_frame_begin(hdlc, hdlc->tx.protocol);
+		tx_put_buf(hdlc, hdlc->tx.buf, hdlc->tx.len);
+		tx_frame_finish(hdlc);
+		break;
+#endif
+	case TX_STREAM:
+		/* The held bytes are the FCS of the original frame. */
+		tx_frame_finish(hdlc);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Takes a byte of the frames sent by the PPP module. */
+static void tx_byte(struct ppp_hdlc *hdlc, uint8_t byte)
+{
+	if (byte == HDLC_FLAG) {
+		tx_frame_end(hdlc);
+		hdlc->tx.state = TX_HEADER;
+		hdlc->tx.hdr_len = 0;
+		hdlc->tx.escape = false;
+		return;
+	}
+	if (byte == HDLC_ESCAPE) {
+		hdlc->tx.escape = true;
+		return;
+	}
+	if (hdlc->tx.escape) {
+		byte ^= HDLC_ESCAPE_XOR;
+		hdlc->tx.escape = false;
+	}
+
+	switch (hdlc->tx.state) {
+	case TX_HEADER:
+		hdlc->tx.hdr[hdlc->tx.hdr_len++] = byte;
+		if (hdlc->tx.hdr_len == HDLC_HDR_LEN) {
+			tx_header_done(hdlc);
+		}
+		break;
+	case TX_RAW:
+		tx_encode(hdlc, byte, HDLC_ACCM_DEFAULT);
+		if (hdlc->tx.snoop && hdlc->tx.len < HDLC_CTRL_MAX) {
+			hdlc->tx.buf[hdlc->tx.len] = byte;
+		}
+		hdlc->tx.len++;
+		break;
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+	case TX_COLLECT:
+		if (hdlc->tx.protocol != PPP_PROTO_IPCP) {
+			hdlc->tx.buf[hdlc->tx.len++] = byte;
+			tx_ip_collect(hdlc);
+			break;
+		}
+		if (hdlc->tx.len == HDLC_CTRL_MAX) {
+			/* Too long to be looked into, sent as is. */
+			tx_raw_begin(hdlc);
+			for (size_t i = 0; i != hdlc->tx.len; ++i) {
+				tx_encode(hdlc, hdlc->tx.buf[i], HDLC_ACCM_DEFAULT);
+			}
+			tx_encode(hdlc, byte, HDLC_ACCM_DEFAULT);
+			break;
+		}
+		hdlc->tx.buf[hdlc->tx.len++] = byte;
+		break;
+#endif
+	case TX_STREAM:
+		tx_stream(hdlc, byte);
+		break;
+	default:
+		/* Bytes before the first flag */
+		break;
+	}
+}
+
+/* Sends the framed bytes. Lock hdlc->lock before calling. */
+static int tx_flush(struct ppp_hdlc *hdlc)
+{
+	int ret;
+
+	if (hdlc->tx.out_len == 0) {
+		return 0;
+	}
+	ret = modem_pipe_transmit(hdlc->link, hdlc->tx.out, hdlc->tx.out_len);
+	if (ret <= 0) {
+		return ret;
+	}
+	hdlc->tx.out_len -= ret;
+	memmove(hdlc->tx.out, &hdlc->tx.out[ret], hdlc->tx.out_len);
+	return 0;
+}
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+/* Returns the length of a frame from the host up to its closing flag if it is an IPCP frame
+ * that is in data, 0 if more data is needed to tell, or -1 if the frame is passed as is.
+ */
+static int rx_frame_check(const uint8_t *data, size_t len)
+{
+	uint8_t hdr[HDLC_HDR_LEN];
+	size_t hdr_len = 0;
+	bool escape = false;
+	size_t i;
+
+	for (i = 0; i != len && data[i] != HDLC_FLAG; ++i) {
+		if (hdr_len == HDLC_HDR_LEN) {
+			continue;
+		}
+		if (data[i] == HDLC_ESCAPE) {
+			escape = true;
+			continue;
+		}
+		hdr[hdr_len++] = escape ? data[i] ^ HDLC_ESCAPE_XOR : data[i];
+		escape = false;
+		if (hdr_len == HDLC_HDR_LEN &&
+		    (hdr[0] != HDLC_ADDRESS || hdr[1] != HDLC_CONTROL ||
+		     sys_get_be16(&hdr[2]) != PPP_PROTO_IPCP)) {
+			return -1;
+		}
+	}
+	if (i == len) {
+		return (len < HDLC_RX_CARRY_MAX) ? 0 : -1;
+	}
+	return (hdr_len == HDLC_HDR_LEN && i <= HDLC_RX_CARRY_MAX) ? (int)i : -1;
+}
+
+/* Hides the IP-Compression-Protocol option of an IPCP Configure-Request from the PPP module,
+ * which does not know it. The frame (without flags) is replaced in place.
+ * Returns the length of the frame.
+ */
+static size_t rx_ipcp_filter(struct ppp_hdlc *hdlc, uint8_t *data, size_t len)
+{
+	uint8_t *frame = hdlc->rx.frame;
+	uint8_t *ipcp = &frame[HDLC_HDR_LEN];
+	size_t frame_len = 0;
+	size_t ipcp_len;
+	size_t out_len = 0;
+	bool escape = false;
+	uint16_t fcs;
+
+	for (size_t i = 0; i != len; ++i) {
+		if (data[i] == HDLC_ESCAPE) {
+			escape = true;
+			continue;
+		}
+		frame[frame_len++] = escape ? data[i] ^ HDLC_ESCAPE_XOR : data[i];
+		escape = false;
+	}
+	if (frame_len < HDLC_HDR_LEN + CP_HDR_LEN + HDLC_FCS_LEN ||
+	    crc16_ccitt(HDLC_FCS_INIT, frame, frame_len) != HDLC_FCS_GOOD ||
+	    ipcp[0] != CP_CONFIGURE_REQ) {
+		return len;
+	}
+	ipcp_len = sys_get_be16(&ipcp[2]);
+	if (ipcp_len < CP_HDR_LEN || HDLC_HDR_LEN + ipcp_len + HDLC_FCS_LEN > frame_len) {
+		return len;
+	}
+
+	hdlc->vj.req_valid = true;
+	hdlc->vj.req_vj = false;
+	hdlc->vj.req_id = ipcp[1];
+	for (size_t i = CP_HDR_LEN; i + 2 <= ipcp_len; i += ipcp[i + 1]) {
+		if (ipcp[i + 1] < 2 || i + ipcp[i + 1] > ipcp_len) {
+			break;
+		}
+		if (ipcp[i] == IPCP_OPT_COMP && ipcp[i + 1] == VJ_OPT_LEN &&
+		    sys_get_be16(&ipcp[i + 2]) == PPP_PROTO_VJ_COMP) {
+			hdlc->vj.req_vj = true;
+			hdlc->vj.req_off = i - CP_HDR_LEN;
+			memcpy(hdlc->vj.req_opt, &ipcp[i], VJ_OPT_LEN);
+			memmove(&ipcp[i], &ipcp[i + VJ_OPT_LEN], ipcp_len - i - VJ_OPT_LEN);
+			ipcp_len -= VJ_OPT_LEN;
+			sys_put_be16(ipcp_len, &ipcp[2]);
+			break;
+		}
+	}
+	if (!hdlc->vj.req_vj) {
+		return len;
+	}
+
+	frame_len = HDLC_HDR_LEN + ipcp_len;
+	fcs = crc16_ccitt(HDLC_FCS_INIT, frame, frame_len) ^ 0xffff;
+	sys_put_le16(fcs, &frame[frame_len]);
+	frame_len += HDLC_FCS_LEN;
+
+	/* Six bytes shorter, with at most three more to escape, so it fits in place.
+	 * The PPP module takes control characters unescaped.
+	 */
+	for (size_t i = 0; i != frame_len; ++i) {
+		uint8_t byte = frame[i];
+
+		if (byte == HDLC_FLAG || byte == HDLC_ESCAPE) {
+			data[out_len++] = HDLC_ESCAPE;
+			byte ^= HDLC_ESCAPE_XOR;
+		}
+		data[out_len++] = byte;
+	}
+	return out_len;
+}
+
+/* Passes the frames received from the host, in place. The start of a frame that cannot be
+ * told yet is carried over to the next data. Returns the length of the data to pass.
+ */
+static size_t rx_filter(struct ppp_hdlc *hdlc, uint8_t *data, size_t len)
+{
+	size_t len_out;
+	size_t len_in;
+	size_t out = 0;
+	size_t i = 0;
+	int ret;
+
+	while (i != len) {
+		if (hdlc->rx.pass || data[i] == HDLC_FLAG) {
+			/* The flag ends the frame that is passed. */
+			hdlc->rx.pass = (data[i] != HDLC_FLAG);
+			data[out++] = data[i++];
+			continue;
+		}
+		ret = rx_frame_check(&data[i], len - i);
+		if (ret == 0) {
+			hdlc->rx.carry_len = len - i;
+			memcpy(hdlc->rx.carry, &data[i], hdlc->rx.carry_len);
+			break;
+		}
+		if (ret < 0) {
+			hdlc->rx.pass = true;
+			continue;
+		}
+		len_in = ret;
+		len_out = rx_ipcp_filter(hdlc, &data[i], len_in);
+		memmove(&data[out], &data[i], len_out);
+		out += len_out;
+		i += len_in;
+	}
+	return out;
+}
+
+/* Receives the frames from the host, after the start of a frame carried over from the
+ * previous data. Lock hdlc->lock before calling.
+ */
+static int rx_receive(struct ppp_hdlc *hdlc, uint8_t *buf, size_t size)
+{
+	const size_t carry_len = hdlc->rx.carry_len;
+	int ret;
+
+	if (size <= carry_len) {
+		return -ENOBUFS;
+	}
+	ret = modem_pipe_receive(hdlc->link, &buf[carry_len], size - carry_len);
+	if (ret < 0) {
+		return ret;
+	}
+	memcpy(buf, hdlc->rx.carry, carry_len);
+	hdlc->rx.carry_len = 0;
+	return rx_filter(hdlc, buf, carry_len + ret);
+}
+#endif
+
+static void hdlc_flush_work_fn(struct k_work *work)
+{
+	struct ppp_hdlc *hdlc = CONTAINER_OF(work, struct ppp_hdlc, flush_work);
+	int ret = 0;
+
+	k_mutex_lock(&hdlc->lock, K_FOREVER);
+	if (hdlc->link) {
+		ret = tx_flush(hdlc);
+	}
+	k_mutex_unlock(&hdlc->lock);
+	if (ret < 0) {
+		LOG_WRN("PPP transmit failed (%d).", ret);
+	}
+}
+
+static void hdlc_link_event_handler(struct modem_pipe *link, enum modem_pipe_event event,
+				    void *user_data)
+{
+	struct ppp_hdlc *hdlc = user_data;
+
+	switch (event) {
+	case MODEM_PIPE_EVENT_OPENED:
+		modem_pipe_notify_opened(&hdlc->pipe);
+		break;
+	case MODEM_PIPE_EVENT_CLOSED:
+		modem_pipe_notify_closed(&hdlc->pipe);
+		break;
+	case MODEM_PIPE_EVENT_RECEIVE_READY:
+		modem_pipe_notify_receive_ready(&hdlc->pipe);
+		break;
+	case MODEM_PIPE_EVENT_TRANSMIT_IDLE:
+		k_work_submit_to_queue(&sm_work_q, &hdlc->flush_work);
+		modem_pipe_notify_transmit_idle(&hdlc->pipe);
+		break;
+	default:
+		break;
+	}
+}
+
+static int hdlc_pipe_open(void *data)
+{
+	struct ppp_hdlc *hdlc = data;
+
+	if (!hdlc->link || !sm_pipe_is_open(hdlc->link)) {
+		return -EPERM;
+	}
+	modem_pipe_notify_opened(&hdlc->pipe);
+	return 0;
+}
+
+static int hdlc_pipe_close(void *data)
+{
+	struct ppp_hdlc *hdlc = data;
+
+	modem_pipe_notify_closed(&hdlc->pipe);
+	return 0;
+}
+
+static int hdlc_pipe_transmit(void *data, const uint8_t *buf, size_t size)
+{
+	struct ppp_hdlc *hdlc = data;
+	size_t i = 0;
+	int ret = -EPERM;
+
+	k_mutex_lock(&hdlc->lock, K_FOREVER);
+	if (hdlc->link) {
+		ret = tx_flush(hdlc);
+		for (; ret == 0 && i != size &&
+		       sizeof(hdlc->tx.out) - hdlc->tx.out_len >= HDLC_TX_BURST_MAX; ++i) {
+			tx_byte(hdlc, buf[i]);
+		}
+		if (ret == 0) {
+			ret = tx_flush(hdlc);
+		}
+	}
+	k_mutex_unlock(&hdlc->lock);
+
+	return (ret < 0) ? ret : (int)i;
+}
+
+static int hdlc_pipe_receive(void *data, uint8_t *buf, size_t size)
+{
+	struct ppp_hdlc *hdlc = data;
+	int ret = -EPERM;
+
+	k_mutex_lock(&hdlc->lock, K_FOREVER);
+	if (hdlc->link) {
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+		ret = rx_receive(hdlc, buf, size);
+#else
+		/* The frames from the host keep the default options. */
+		ret = modem_pipe_receive(hdlc->link, buf, size);
+#endif
+	}
+	k_mutex_unlock(&hdlc->lock);
+	return ret;
+}
+
+static const struct modem_pipe_api hdlc_pipe_api = {
+	.open = hdlc_pipe_open,
+	.transmit = hdlc_pipe_transmit,
+	.receive = hdlc_pipe_receive,
+	.close = hdlc_pipe_close,
+};
+
+struct modem_pipe *sm_ppp_hdlc_attach(struct modem_pipe *link)
+{
+	struct ppp_hdlc *hdlc = NULL;
+
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_hdlcs); ++i) {
+		if (ppp_hdlcs[i].link == link) {
+			/* Already attached, the link state is kept. */
+			return &ppp_hdlcs[i].pipe;
+		}
+		if (!hdlc && !ppp_hdlcs[i].link) {
+			hdlc = &ppp_hdlcs[i];
+		}
+	}
+	if (!hdlc) {
+		LOG_ERR("No PPP framing left, using the default options.");
+		return link;
+	}
+
+	k_mutex_lock(&hdlc->lock, K_FOREVER);
+	hdlc_options_reset(hdlc);
+	hdlc->tx.state = TX_IDLE;
+	hdlc->tx.out_len = 0;
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+	hdlc->rx.pass = false;
+	hdlc->rx.carry_len = 0;
+#endif
+	hdlc->link = link;
+	k_mutex_unlock(&hdlc->lock);
+
+	modem_pipe_attach(link, hdlc_link_event_handler, hdlc);
+	if (sm_pipe_is_open(link)) {
+		modem_pipe_notify_opened(&hdlc->pipe);
+	}
+	return &hdlc->pipe;
+}
+
+void sm_ppp_hdlc_detach(struct modem_pipe *link)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_hdlcs); ++i) {
+		struct ppp_hdlc *hdlc = &ppp_hdlcs[i];
+
+		if (!link || hdlc->link != link) {
+			continue;
+		}
+		modem_pipe_release(link);
+		k_mutex_lock(&hdlc->lock, K_FOREVER);
+		hdlc->link = NULL;
+		k_mutex_unlock(&hdlc->lock);
+		k_work_cancel(&hdlc->flush_work);
+		modem_pipe_notify_closed(&hdlc->pipe);
+	}
+}
+
+static int sm_ppp_hdlc_init(void)
+{
+	for (size_t i = 0; i != ARRAY_SIZE(ppp_hdlcs); ++i) {
+		struct ppp_hdlc *hdlc = &ppp_hdlcs[i];
+
+		k_mutex_init(&hdlc->lock);
+		k_work_init(&hdlc->flush_work, hdlc_flush_work_fn);
+		modem_pipe_init(&hdlc->pipe, hdlc, &hdlc_pipe_api);
+	}
+	return 0;
+}
+SYS_INIT(sm_ppp_hdlc_init, APPLICATION, 0);
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2026 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+#ifndef SM_PPP_HDLC_
+#define SM_PPP_HDLC_
+
+#include <zephyr/modem/pipe.h>
+
+#if defined(CONFIG_SM_PPP_HDLC_OPTIONS)
+/**
+ * @brief Get a pipe that re-frames the PPP frames with the negotiated link options.
+ *
+ * The async-control-character map, address-and-control-field compression and
+ * protocol-field compression requested by the host in LCP are applied to the frames
+ * that the PPP module sends on the returned pipe. With CONFIG_SM_PPP_HDLC_VJ, the
+ * TCP/IP headers are also compressed when the host requests it in IPCP.
+ * Attach the PPP module to the returned pipe.
+ *
+ * @param pipe The PPP link pipe.
+ *
+ * @return The pipe for the PPP module, or the link pipe if none is left.
+ */
+struct modem_pipe *sm_ppp_hdlc_attach(struct modem_pipe *pipe);
+
+/**
+ * @brief Stop re-framing the PPP frames and release the link pipe.
+ *
+ * Call after the PPP module has been released.
+ *
+ * @param pipe The PPP link pipe.
+ */
+void sm_ppp_hdlc_detach(struct modem_pipe *pipe);
+#else
+static inline struct modem_pipe *sm_ppp_hdlc_attach(struct modem_pipe *pipe)
+{
+	return pipe;
+}
+
+static inline void sm_ppp_hdlc_detach(struct modem_pipe *pipe)
+{
+}
+#endif
+
+#endif
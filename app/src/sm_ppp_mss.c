@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2026 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+#include "sm_ppp_mss.h"
+#include <zephyr/logging/log.h>
+#include <zephyr/net/net_ip.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+LOG_MODULE_REGISTER(sm_ppp_mss, CONFIG_SM_LOG_LEVEL);
+
+/* Fixed IP and TCP header sizes. The MSS leaves out the IP and TCP options (RFC 6691). */
+#define IPV4_HDR_LEN 20
+#define IPV6_HDR_LEN 40
+#define TCP_HDR_LEN 20
+#define TCP_FLAG_SYN 0x02
+#define TCP_OPT_END 0
+#define TCP_OPT_NOP 1
+#define TCP_OPT_MSS 2
+
+/* Incremental checksum update for a changed 16-bit word (RFC 1624). */
+static uint16_t csum_update16(uint16_t csum, uint16_t old, uint16_t new)
+{
+	uint32_t sum = (uint16_t)~csum + (uint16_t)~old + new;
+
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+void sm_ppp_mss_clamp(uint8_t *data, size_t len, uint32_t ipv4_mtu, uint32_t ipv6_mtu)
+{
+	uint8_t *tcp;
+	size_t tcp_len;
+	size_t ip_hdr_len;
+	size_t base_len;
+	uint32_t mtu;
+
+	if (len >= IPV4_HDR_LEN && (data[0] & 0xf0) == 0x40) {
+		ip_hdr_len = (data[0] & 0x0f) * 4;
+		/* Only TCP in unfragmented or first fragment packets */
+		if (data[9] != IPPROTO_TCP || (sys_get_be16(&data[6]) & 0x1fff) ||
+		    ip_hdr_len < IPV4_HDR_LEN) {
+			return;
+		}
+		base_len = IPV4_HDR_LEN;
+		mtu = ipv4_mtu;
+	} else if (len >= IPV6_HDR_LEN && (data[0] & 0xf0) == 0x60) {
+		/* SYN packets with extension headers are left as is. */
+		if (data[6] != IPPROTO_TCP) {
+			return;
+		}
+		ip_hdr_len = IPV6_HDR_LEN;
+		base_len = IPV6_HDR_LEN;
+		mtu = ipv6_mtu;
+	} else {
+		return;
+	}
+	if (len < ip_hdr_len + TCP_HDR_LEN || mtu <= base_len + TCP_HDR_LEN) {
+		return;
+	}
+
+	tcp = &data[ip_hdr_len];
+	tcp_len = (tcp[12] >> 4) * 4;
+	if (!(tcp[13] & TCP_FLAG_SYN) || tcp_len < TCP_HDR_LEN || ip_hdr_len + tcp_len > len) {
+		return;
+	}
+
+	const uint16_t mss_max = MIN(mtu - base_len - TCP_HDR_LEN, UINT16_MAX);
+
+	for (size_t i = TCP_HDR_LEN; i < tcp_len;) {
+		if (tcp[i] == TCP_OPT_END) {
+			break;
+		} else if (tcp[i] == TCP_OPT_NOP) {
+			i++;
+			continue;
+		} else if (i + 1 >= tcp_len || tcp[i + 1] < 2 || i + tcp[i + 1] > tcp_len) {
+			break;
+		}
+
+		if (tcp[i] == TCP_OPT_MSS && tcp[i + 1] == 4) {
+			const uint16_t mss = sys_get_be16(&tcp[i + 2]);
+			uint16_t csum = sys_get_be16(&tcp[16]);
+
+			if (mss <= mss_max) {
+				return;
+			}
+			/* An option at an odd offset spans two checksum words. */
+			if (i & 1) {
+				csum = csum_update16(csum, BSWAP_16(mss), BSWAP_16(mss_max));
+			} else {
+				csum = csum_update16(csum, mss, mss_max);
+			}
+			sys_put_be16(mss_max, &tcp[i + 2]);
+			sys_put_be16(csum, &tcp[16]);
+			LOG_DBG("Clamped TCP MSS from %u to %u.", mss, mss_max);
+			return;
+		}
+		i += tcp[i + 1];
+	}
+}
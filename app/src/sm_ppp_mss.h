@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2026 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+#ifndef SM_PPP_MSS_
+#define SM_PPP_MSS_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Lower the MSS option of a TCP SYN or SYN-ACK packet to fit an MTU.
+ *
+ * The MSS is limited to the MTU of the packet's IP family minus the fixed IP and TCP
+ * headers (RFC 6691), and the TCP checksum is updated. Other packets are left as is.
+ *
+ * @param data The IPv4 or IPv6 packet.
+ * @param len Length of the packet.
+ * @param ipv4_mtu MTU for IPv4 packets.
+ * @param ipv6_mtu MTU for IPv6 packets.
+ */
+void sm_ppp_mss_clamp(uint8_t *data, size_t len, uint32_t ipv4_mtu, uint32_t ipv6_mtu);
+
+#endif
@@ -7,8 +7,11 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/modem/pipe.h>
+#include <zephyr/sys/byteorder.h>
 #include <modem/nrf_modem_lib_trace.h>
 #include <modem/trace_backend.h>
+#include <string.h>
+#include "sm_trace_backend_cmux.h"
 #include "sm_util.h"
 
 LOG_MODULE_REGISTER(modem_trace_backend, CONFIG_MODEM_TRACE_BACKEND_LOG_LEVEL);
@@ -17,6 +20,212 @@ static K_SEM_DEFINE(tx_idle_sem, 0, 1);
 
 static trace_backend_processed_cb trace_processed_callback;
 static struct modem_pipe *trace_pipe;
+static struct sm_trace_backend_stats stats;
+
+#if defined(CONFIG_SM_MODEM_TRACE_COMPRESS)
+
+/* Frame header: magic "TZ", flags, sequence number, trace length and data length (LE). */
+#define FRAME_MAGIC_0         'T'
+#define FRAME_MAGIC_1         'Z'
+#define FRAME_FLAG_LZ4        BIT(0)
+#define FRAME_HDR_LEN         8
+
+#define BLOCK_SIZE            CONFIG_SM_MODEM_TRACE_COMPRESS_BLOCK_SIZE
+/* Worst case size of an LZ4 block of incompressible data */
+#define LZ4_BOUND(len)        ((len) + (len) / 255 + 16)
+#define LZ4_MIN_MATCH         4
+/* The last match must start at least 12 bytes and the last 5 bytes must be literals. */
+#define LZ4_MF_LIMIT          12
+#define LZ4_LAST_LITERALS     5
+#define LZ4_HASH_LOG          10
+
+static void flush_work_fn(struct k_work *work);
+static K_WORK_DEFINE(flush_work, flush_work_fn);
+static K_MUTEX_DEFINE(frame_mutex);
+
+/* Frame being sent to the trace pipe */
+static struct {
+	uint8_t buf[FRAME_HDR_LEN + LZ4_BOUND(BLOCK_SIZE)];
+	size_t len;
+	size_t sent;
+	/* Trace bytes in the frame */
+	size_t trace_len;
+	uint8_t seq;
+	uint16_t hash[1 << LZ4_HASH_LOG];
+} frame;
+
+static uint32_t lz4_hash(const uint8_t *p)
+{
+	return (sys_get_le32(p) * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static uint8_t *lz4_put_len(uint8_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+/* Writes one sequence. The last sequence of the block has only literals (match_len 0). */
+static uint8_t *lz4_put_seq(uint8_t *op, const uint8_t *lit, size_t lit_len,
+			    size_t offset, size_t match_len)
+{
+	uint8_t *token = op++;
+
+	*token = MIN(lit_len, 15) << 4;
+	if (lit_len >= 15) {
+		op = lz4_put_len(op, lit_len - 15);
+	}
+	memcpy(op, lit, lit_len);
+	op += lit_len;
+	if (match_len == 0) {
+		return op;
+	}
+
+	sys_put_le16(offset, op);
+	op += 2;
+	match_len -= LZ4_MIN_MATCH;
+	*token |= MIN(match_len, 15);
+	if (match_len >= 15) {
+		op = lz4_put_len(op, match_len - 15);
+	}
+	return op;
+}
+
+/* Greedy LZ4 block compression with a single entry hash table.
+ * The search step grows over incompressible data to limit the CPU cost.
+ */
+static size_t lz4_compress(const uint8_t *src, size_t len, uint8_t *dst)
+{
+	uint8_t *op = dst;
+	size_t anchor = 0;
+	size_t pos = 0;
+
+	memset(frame.hash, 0, sizeof(frame.hash));
+
+	while (len > LZ4_MF_LIMIT && pos <= len - LZ4_MF_LIMIT) {
+		const uint32_t h = lz4_hash(&src[pos]);
+		const size_t ref = frame.hash[h];
+		size_t match_len = LZ4_MIN_MATCH;
+
+		frame.hash[h] = pos;
+		if (ref >= pos || memcmp(&src[ref], &src[pos], LZ4_MIN_MATCH) != 0) {
+			pos += 1 + ((pos - anchor) >> 6);
+			continue;
+		}
+		while (pos + match_len < len - LZ4_LAST_LITERALS &&
+		       src[ref + match_len] == src[pos + match_len]) {
+			match_len++;
+		}
+		op = lz4_put_seq(op, &src[anchor], pos - anchor, pos - ref, match_len);
+		pos += match_len;
+		anchor = pos;
+	}
+	op = lz4_put_seq(op, &src[anchor], len - anchor, 0, 0);
+
+	return op - dst;
+}
+
+/* Lock frame_mutex before calling. */
+static void frame_build(const uint8_t *data, size_t len)
+{
+	uint8_t *hdr = frame.buf;
+	uint8_t *payload = &frame.buf[FRAME_HDR_LEN];
+	const uint32_t start = k_cycle_get_32();
+	size_t payload_len = lz4_compress(data, len, payload);
+	uint8_t flags = FRAME_FLAG_LZ4;
+
+	stats.compress_us += k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+	if (payload_len >= len) {
+		/* Send incompressible data as is. */
+		memcpy(payload, data, len);
+		payload_len = len;
+		flags = 0;
+	}
+
+	hdr[0] = FRAME_MAGIC_0;
+	hdr[1] = FRAME_MAGIC_1;
+	hdr[2] = flags;
+	hdr[3] = frame.seq++;
+	sys_put_le16(len, &hdr[4]);
+	sys_put_le16(payload_len, &hdr[6]);
+
+	frame.len = FRAME_HDR_LEN + payload_len;
+	frame.sent = 0;
+	frame.trace_len = len;
+}
+
+/* Lock frame_mutex before calling. Returns 0 when the whole frame has been sent. */
+static int frame_transmit(k_timeout_t timeout)
+{
+	int ret;
+
+	while (frame.sent < frame.len) {
+		if (!trace_pipe) {
+			return -EAGAIN;
+		}
+		ret = modem_pipe_transmit(trace_pipe, &frame.buf[frame.sent],
+					  frame.len - frame.sent);
+		if (ret < 0) {
+			/* The rest of the frame cannot be unpacked, so all its traces are lost. */
+			LOG_WRN("TX error (%d). Dropped %zu bytes.", ret, frame.trace_len);
+			stats.dropped_bytes += frame.trace_len;
+			frame.len = 0;
+			frame.sent = 0;
+			return ret;
+		} else if (ret == 0) {
+			if (k_sem_take(&tx_idle_sem, timeout) != 0) {
+				return -EAGAIN;
+			}
+			continue;
+		}
+		frame.sent += ret;
+		stats.sent_bytes += ret;
+	}
+	return 0;
+}
+
+/* Sends the rest of the frame when no more traces come to push it out. */
+static void flush_work_fn(struct k_work *work)
+{
+	ARG_UNUSED(work);
+
+	/* Do not block sm_work_q, a pending write sends the frame anyway. */
+	if (k_mutex_lock(&frame_mutex, K_NO_WAIT) != 0) {
+		return;
+	}
+	frame_transmit(K_NO_WAIT);
+	k_mutex_unlock(&frame_mutex);
+}
+
+static int compressed_write(const uint8_t *data, size_t len)
+{
+	int ret;
+
+	k_mutex_lock(&frame_mutex, K_FOREVER);
+
+	/* The modem keeps the new traces while the previous frame is sent. */
+	ret = frame_transmit(K_MSEC(100));
+	if (ret == -EAGAIN) {
+		k_mutex_unlock(&frame_mutex);
+		LOG_WRN_RATELIMIT("TX timeout.");
+		return -EAGAIN;
+	}
+
+	len = MIN(len, BLOCK_SIZE);
+	frame_build(data, len);
+	trace_processed_callback(len);
+
+	frame_transmit(K_NO_WAIT);
+	k_mutex_unlock(&frame_mutex);
+
+	return len;
+}
+
+#endif /* CONFIG_SM_MODEM_TRACE_COMPRESS */
 
 static void modem_pipe_event_handler(struct modem_pipe *pipe,
 				     enum modem_pipe_event event, void *user_data)
@@ -25,6 +234,11 @@ static void modem_pipe_event_handler(struct modem_pipe *pipe,
 
 	case MODEM_PIPE_EVENT_TRANSMIT_IDLE:
 		k_sem_give(&tx_idle_sem);
+#if defined(CONFIG_SM_MODEM_TRACE_COMPRESS)
+		if (frame.sent < frame.len) {
+			k_work_submit_to_queue(&sm_work_q, &flush_work);
+		}
+#endif
 		break;
 	case MODEM_PIPE_EVENT_CLOSED:
 		LOG_INF("Trace pipe closed");
@@ -62,6 +276,13 @@ int trace_backend_deinit(void)
 
 void sm_trace_backend_attach(struct modem_pipe *pipe)
 {
+#if defined(CONFIG_SM_MODEM_TRACE_COMPRESS)
+	/* A new channel starts from a frame boundary. */
+	k_mutex_lock(&frame_mutex, K_FOREVER);
+	frame.len = 0;
+	frame.sent = 0;
+	k_mutex_unlock(&frame_mutex);
+#endif
 	modem_pipe_attach(pipe, modem_pipe_event_handler, NULL);
 }
 
@@ -73,16 +294,29 @@ void sm_trace_backend_detach(void)
 	}
 }
 
+void sm_trace_backend_stats_get(struct sm_trace_backend_stats *out)
+{
+	*out = stats;
+}
+
 int trace_backend_write(const void *data, size_t len)
 {
 	int ret = 0;
 
 	if (!trace_pipe || !sm_pipe_is_open(trace_pipe)) {
 		LOG_DBG_RATELIMIT("Pipe closed, dropped %u bytes.", len);
+		stats.dropped_bytes += len;
 		trace_processed_callback(len);
 		return len;
 	}
 
+#if defined(CONFIG_SM_MODEM_TRACE_COMPRESS)
+	ret = compressed_write(data, len);
+	if (ret > 0) {
+		stats.trace_bytes += ret;
+	}
+	return ret;
+#else
 	/* No need to retry here.
 	 * The nrf_modem_lib_trace.c:trace_fragment_write() handles
 	 * retrying if the backend returns -EAGAIN.
@@ -98,14 +332,18 @@ int trace_backend_write(const void *data, size_t len)
 	ret = modem_pipe_transmit(trace_pipe, data, len);
 	if (ret < 0) {
 		LOG_WRN("TX error (%d). Dropped %u bytes.", ret, len);
+		stats.dropped_bytes += len;
 		trace_processed_callback(len);
 		return ret;
 	} else if (ret == 0) {
 		return -EAGAIN;
 	}
+	stats.trace_bytes += ret;
+	stats.sent_bytes += ret;
 	trace_processed_callback(ret);
 
 	return ret;
+#endif
 }
 
 struct nrf_modem_lib_trace_backend trace_backend = {
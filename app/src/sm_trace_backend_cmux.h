@@ -3,7 +3,25 @@
  *
  * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
  */
+#ifndef SM_TRACE_BACKEND_CMUX_
+#define SM_TRACE_BACKEND_CMUX_
+
+#include <stdint.h>
+
+struct modem_pipe;
+
+/** Modem trace counters of the CMUX trace backend */
+struct sm_trace_backend_stats {
+	uint32_t trace_bytes;   /* Trace bytes taken from the modem. */
+	uint32_t sent_bytes;    /* Bytes sent on the trace channel, including the frame headers. */
+	uint32_t dropped_bytes; /* Trace bytes dropped because the channel was closed or failed. */
+	uint32_t compress_us;   /* Time spent compressing. */
+};
 
 void sm_trace_backend_attach(struct modem_pipe *pipe);
 
 void sm_trace_backend_detach(void);
+
+void sm_trace_backend_stats_get(struct sm_trace_backend_stats *stats);
+
+#endif
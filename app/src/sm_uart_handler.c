@@ -9,7 +9,6 @@
 #include <zephyr/drivers/uart.h>
 #include <hal/nrf_uarte.h>
 #include <hal/nrf_gpio.h>
-#include <zephyr/sys/ring_buffer.h>
 #include <zephyr/pm/device.h>
 #include <zephyr/modem/pipe.h>
 #include "sm_uart_handler.h"
@@ -25,6 +24,16 @@ LOG_MODULE_REGISTER(sm_uart_handler, CONFIG_SM_LOG_LEVEL);
 #define UART_RX_TIMEOUT_US		2000
 #define UART_ERROR_DELAY_MS		500
 
+/* Adaptive RX: idle timeout in character times for interactive and bulk traffic */
+#define UART_RX_TIMEOUT_MIN_US		100
+#define UART_RX_TIMEOUT_MAX_US		5000
+#define UART_RX_IDLE_CHARS_INTERACTIVE	8
+#define UART_RX_IDLE_CHARS_BULK		64
+/* Average RX event length, above which the traffic is treated as bulk */
+#define UART_RX_BULK_EVENT_LEN		32
+/* Minimum number of RX buffers in flight when the RX event queue is filling up */
+#define UART_RX_BUF_COUNT_MIN		2
+
 const struct device *const sm_uart_dev = DEVICE_DT_GET(DT_CHOSEN(ncs_sm_uart));
 uint32_t sm_uart_baudrate;
 
@@ -50,13 +59,112 @@ struct rx_event_t {
 };
 K_MSGQ_DEFINE(rx_event_queue, sizeof(struct rx_event_t), UART_RX_EVENT_COUNT, 4);
 
-RING_BUF_DECLARE(tx_buf, CONFIG_SM_UART_TX_BUF_SIZE);
+static struct {
+	/* RX idle timeout used when RX is enabled */
+	uint32_t timeout_us;
+	/* Maximum number of RX buffers in flight */
+	uint32_t buf_limit;
+	/* Average length of RX events, in 1/16 bytes */
+	uint32_t avg_event_len_x16;
+} rx_adapt = {
+	.timeout_us = UART_RX_TIMEOUT_US,
+	.buf_limit = CONFIG_SM_UART_RX_BUF_COUNT,
+};
+
+#if defined(CONFIG_SM_UART_RX_FLOW_CONTROL)
+/* Watermarks for unprocessed RX data, in bytes of the total UART RX buffer space */
+#define UART_RX_CAPACITY	(CONFIG_SM_UART_RX_BUF_COUNT * CONFIG_SM_UART_RX_BUF_SIZE)
+#define UART_RX_HIGH_WATERMARK	(UART_RX_CAPACITY * CONFIG_SM_UART_RX_HIGH_WATERMARK / 100)
+#define UART_RX_LOW_WATERMARK	(UART_RX_CAPACITY * CONFIG_SM_UART_RX_LOW_WATERMARK / 100)
+BUILD_ASSERT(CONFIG_SM_UART_RX_LOW_WATERMARK < CONFIG_SM_UART_RX_HIGH_WATERMARK);
+#endif
+
+#define XON			0x11
+#define XOFF			0x13
+
+/* Backpressure applied to the host */
+enum rx_fc_state {
+	RX_FC_OFF,
+	/* RX buffers are held back, so the UARTE deasserts RTS (HW flow control). */
+	RX_FC_RTS,
+	/* XOFF has been sent (SW flow control). */
+	RX_FC_XOFF,
+	/* CMUX FCoff has been sent. */
+	RX_FC_CMUX,
+};
+
+/* Backpressure that can be applied without HW flow control in the current mode */
+enum rx_fc_method {
+	RX_FC_METHOD_NONE,
+	RX_FC_METHOD_XON_XOFF,
+	RX_FC_METHOD_CMUX,
+};
+
+static struct {
+	/* Received bytes that are not yet processed */
+	atomic_t pending;
+	atomic_t state;
+	/* enum rx_fc_method, updated on mode changes so that the UART callback only reads it */
+	atomic_t method;
+	bool hwfc;
+} rx_fc;
+
+/* UART statistics, updated without locks from the UART callback and the pipe users */
+static struct {
+	atomic_t rx_bytes;
+	atomic_t rx_events;
+	atomic_t rx_slab_max;
+	atomic_t rx_queue_max;
+	/* Received bytes dropped because the RX event queue was full */
+	atomic_t rx_dropped;
+	atomic_t rx_disabled;
+	atomic_t rx_recovered;
+	atomic_t rx_errors;
+	atomic_t rx_overruns;
+	/* RX buffer requests declined because of the adaptive buffer limit */
+	atomic_t rx_buf_declined;
+	/* Times RX was restarted to apply a new timeout */
+	atomic_t rx_restarts;
+	atomic_t rx_pending_max;
+	/* Times the backpressure was asserted */
+	atomic_t fc_asserted;
+	/* Times the high watermark was reached without a way to apply backpressure */
+	atomic_t fc_unprotected;
+	atomic_t tx_bytes;
+	/* Transmits that did not fit in the TX buffers */
+	atomic_t tx_full;
+	/* Time spent waiting for TX buffer space */
+	atomic_t tx_blocked_ms;
+} uart_stats;
+
+/* Ping-pong TX buffers: producers fill one buffer while the other one is on the wire.
+ * When the transfer completes, the filled buffer is started right away from the UART callback.
+ */
+#define UART_TX_BUF_COUNT 2
+static struct {
+	uint8_t buf[UART_TX_BUF_COUNT][CONFIG_SM_UART_TX_BUF_SIZE / UART_TX_BUF_COUNT];
+	size_t len[UART_TX_BUF_COUNT];
+	/* Index of the buffer being filled, the other one is on the wire when TX is busy. */
+	uint8_t fill;
+	/* Bytes reserved in the buffer being filled that are still being copied. The buffer is not
+	 * sent until they are committed, and it stays the one being filled meanwhile.
+	 */
+	size_t copying;
+	/* Flow control character (XON/XOFF) to be sent ahead of the buffered data */
+	uint8_t fc_char;
+	bool fc_pending;
+	/* Copy of fc_char on the wire, fc_busy is set while it is sent instead of a buffer */
+	uint8_t fc_wire;
+	bool fc_busy;
+	struct k_spinlock lock;
+} tx;
 
 enum sm_uart_state {
 	SM_UART_STATE_TX_ENABLED_BIT,
 	SM_UART_STATE_RX_ENABLED_BIT,
 	SM_UART_STATE_RX_RECOVERY_BIT,
-	SM_UART_STATE_RX_RECOVERY_DISABLED_BIT
+	SM_UART_STATE_RX_RECOVERY_DISABLED_BIT,
+	SM_UART_STATE_RX_RESTART_BIT,
 };
 static atomic_t uart_state;
 
@@ -75,6 +183,8 @@ static struct {
 };
 
 K_SEM_DEFINE(tx_done_sem, 0, 1);
+/* Given when a TX buffer is freed. */
+static K_SEM_DEFINE(tx_space_sem, 0, 1);
 
 static inline struct rx_buf_t *block_start_get(uint8_t *buf)
 {
@@ -103,6 +213,7 @@ static struct rx_buf_t *rx_buf_alloc(void)
 	if (err) {
 		return NULL;
 	}
+	sm_util_atomic_max(&uart_stats.rx_slab_max, k_mem_slab_num_used_get(&rx_slab));
 
 	atomic_set(&buf->ref_counter, 1);
 
@@ -125,6 +236,42 @@ static void rx_buf_unref(void *buf)
 	}
 }
 
+/* Derive the RX idle timeout from the baud rate and the observed RX event lengths. */
+static uint32_t rx_timeout_get(void)
+{
+	uint32_t char_time_us;
+	uint32_t idle_chars;
+
+	if (!IS_ENABLED(CONFIG_SM_UART_RX_ADAPTIVE) || sm_uart_baudrate == 0) {
+		return UART_RX_TIMEOUT_US;
+	}
+
+	/* 10 bits per character: start, 8 data and stop bit */
+	char_time_us = DIV_ROUND_UP(10 * USEC_PER_SEC, sm_uart_baudrate);
+	idle_chars = (rx_adapt.avg_event_len_x16 / 16 > UART_RX_BULK_EVENT_LEN)
+			     ? UART_RX_IDLE_CHARS_BULK
+			     : UART_RX_IDLE_CHARS_INTERACTIVE;
+	return CLAMP(char_time_us * idle_chars, UART_RX_TIMEOUT_MIN_US, UART_RX_TIMEOUT_MAX_US);
+}
+
+/* Limit the RX buffers in flight when the RX event queue is filling up, so that RX is paused
+ * and the host throttled by HW flow control before the events cannot be queued anymore.
+ * Without HW flow control, pausing RX would lose data, so all the buffers are always used.
+ */
+static void rx_buf_limit_update(void)
+{
+	if (!IS_ENABLED(CONFIG_SM_UART_RX_ADAPTIVE) || !rx_fc.hwfc) {
+		rx_adapt.buf_limit = CONFIG_SM_UART_RX_BUF_COUNT;
+		return;
+	}
+
+	if (k_msgq_num_used_get(&rx_event_queue) > UART_RX_EVENT_COUNT / 2) {
+		rx_adapt.buf_limit = MAX(UART_RX_BUF_COUNT_MIN, CONFIG_SM_UART_RX_BUF_COUNT / 2);
+	} else {
+		rx_adapt.buf_limit = CONFIG_SM_UART_RX_BUF_COUNT;
+	}
+}
+
 static int rx_enable(void)
 {
 	struct rx_buf_t *buf;
@@ -141,7 +288,8 @@ static int rx_enable(void)
 		return -ENOMEM;
 	}
 
-	ret = uart_rx_enable(sm_uart_dev, buf->buf, sizeof(buf->buf), UART_RX_TIMEOUT_US);
+	rx_adapt.timeout_us = rx_timeout_get();
+	ret = uart_rx_enable(sm_uart_dev, buf->buf, sizeof(buf->buf), rx_adapt.timeout_us);
 	if (ret) {
 		LOG_ERR("UART RX enable failed: %d", ret);
 		rx_buf_unref(buf);
@@ -179,6 +327,7 @@ static int rx_disable(void)
 
 static void rx_recovery(void)
 {
+	bool enabled;
 	int err;
 
 	if (atomic_test_bit(&uart_state, SM_UART_STATE_RX_RECOVERY_DISABLED_BIT)) {
@@ -187,15 +336,137 @@ static void rx_recovery(void)
 
 	atomic_set_bit(&uart_state, SM_UART_STATE_RX_RECOVERY_BIT);
 
+	enabled = atomic_test_bit(&uart_state, SM_UART_STATE_RX_ENABLED_BIT);
 	err = rx_enable();
 	if (err) {
 		/* TODO: Retry with delay? */
 		LOG_ERR("UART RX recovery failed: %d", err);
+	} else if (!enabled) {
+		atomic_inc(&uart_stats.rx_recovered);
 	}
 
 	atomic_clear_bit(&uart_state, SM_UART_STATE_RX_RECOVERY_BIT);
 }
 
+/* Called from the UART callback when an RX event ended before the end of the buffer, which
+ * means that the line has been idle for the RX timeout. The timeout of the ongoing reception
+ * cannot be changed, so RX is restarted with the new timeout while the line is idle.
+ * Only with HW flow control, which holds the host back while RX is off. Without it, bytes
+ * arriving during the restart would be lost, so the new timeout waits for RX to be enabled
+ * again after it was disabled.
+ */
+static void rx_timeout_apply(void)
+{
+	if (!rx_fc.hwfc || rx_timeout_get() == rx_adapt.timeout_us ||
+	    atomic_test_bit(&uart_state, SM_UART_STATE_RX_RECOVERY_DISABLED_BIT) ||
+	    atomic_test_and_set_bit(&uart_state, SM_UART_STATE_RX_RESTART_BIT)) {
+		return;
+	}
+
+	if (uart_rx_disable(sm_uart_dev)) {
+		atomic_clear_bit(&uart_state, SM_UART_STATE_RX_RESTART_BIT);
+	}
+}
+
+#if defined(CONFIG_SM_UART_RX_FLOW_CONTROL)
+static void tx_fc_send(uint8_t c);
+
+void sm_uart_rx_fc_mode_update(void)
+{
+	enum rx_fc_method method = RX_FC_METHOD_NONE;
+
+	if (sm_cmux_is_started()) {
+		method = RX_FC_METHOD_CMUX;
+	} else if (IS_ENABLED(CONFIG_SM_UART_RX_XON_XOFF) && in_at_mode_pipe(&sm_pipe.pipe)) {
+		/* XON/XOFF can only be used when the host sends text, so not in data mode or PPP. */
+		method = RX_FC_METHOD_XON_XOFF;
+	}
+	atomic_set(&rx_fc.method, method);
+}
+
+/* Called from the UART callback when data has been received. */
+static void rx_fc_assert(atomic_val_t pending)
+{
+	if (pending < UART_RX_HIGH_WATERMARK || atomic_get(&rx_fc.state) != RX_FC_OFF) {
+		return;
+	}
+
+	if (rx_fc.hwfc) {
+		atomic_set(&rx_fc.state, RX_FC_RTS);
+	} else if (atomic_get(&rx_fc.method) == RX_FC_METHOD_XON_XOFF) {
+		atomic_set(&rx_fc.state, RX_FC_XOFF);
+		tx_fc_send(XOFF);
+	} else if (atomic_get(&rx_fc.method) == RX_FC_METHOD_CMUX) {
+		atomic_set(&rx_fc.state, RX_FC_CMUX);
+		sm_cmux_fcoff_set(true);
+	} else {
+		atomic_inc(&uart_stats.fc_unprotected);
+		return;
+	}
+	atomic_inc(&uart_stats.fc_asserted);
+	LOG_DBG("RX backpressure on, %ld bytes pending", pending);
+}
+
+/* Called when received data has been processed. */
+static void rx_fc_release(atomic_val_t pending)
+{
+	if (pending > UART_RX_LOW_WATERMARK) {
+		return;
+	}
+
+	if (atomic_cas(&rx_fc.state, RX_FC_XOFF, RX_FC_OFF)) {
+		tx_fc_send(XON);
+	} else if (atomic_cas(&rx_fc.state, RX_FC_CMUX, RX_FC_OFF)) {
+		sm_cmux_fcoff_set(false);
+	} else if (atomic_cas(&rx_fc.state, RX_FC_RTS, RX_FC_OFF)) {
+		/* Give RX buffers to the UARTE again. */
+		rx_recovery();
+	} else {
+		return;
+	}
+	LOG_DBG("RX backpressure off, %ld bytes pending", pending);
+}
+#else
+void sm_uart_rx_fc_mode_update(void)
+{
+}
+
+static void rx_fc_assert(atomic_val_t pending)
+{
+	ARG_UNUSED(pending);
+}
+
+static void rx_fc_release(atomic_val_t pending)
+{
+	ARG_UNUSED(pending);
+}
+#endif /* CONFIG_SM_UART_RX_FLOW_CONTROL */
+
+static void rx_received(size_t len)
+{
+	atomic_val_t pending = atomic_add(&rx_fc.pending, len) + len;
+
+	sm_util_atomic_max(&uart_stats.rx_pending_max, pending);
+	atomic_add(&uart_stats.rx_bytes, len);
+	rx_fc_assert(pending);
+}
+
+static void rx_dropped(size_t len)
+{
+	atomic_sub(&rx_fc.pending, len);
+	atomic_add(&uart_stats.rx_dropped, len);
+}
+
+static void rx_processed(size_t len)
+{
+	rx_fc_release(atomic_sub(&rx_fc.pending, len) - len);
+
+	if (k_msgq_num_used_get(&rx_event_queue) == 0) {
+		/* Try to recover RX, in case it was disabled. */
+		rx_recovery();
+	}
+}
+
 static void tx_enable(void)
 {
 	if (!atomic_test_and_set_bit(&uart_state, SM_UART_STATE_TX_ENABLED_BIT)) {
@@ -226,6 +497,9 @@ static int tx_disable(k_timeout_t timeout)
 	return 0;
 }
 
+/* Start sending the filled TX buffer. tx_done_sem must be taken by the caller.
+ * Returns -EAGAIN if TX is disabled or there is nothing to send yet.
+ */
 static int tx_start(void)
 {
 	uint8_t *buf;
@@ -236,17 +510,81 @@ static int tx_start(void)
 		return -EAGAIN;
 	}
 
-	len = ring_buf_get_claim(&tx_buf, &buf, ring_buf_capacity_get(&tx_buf));
+	K_SPINLOCK(&tx.lock) {
+		if (tx.fc_pending) {
+			tx.fc_wire = tx.fc_char;
+			tx.fc_pending = false;
+			tx.fc_busy = true;
+			buf = &tx.fc_wire;
+			len = 1;
+		} else {
+			buf = tx.buf[tx.fill];
+			/* Whoever commits the last copy starts the buffer. */
+			len = tx.copying ? 0 : tx.len[tx.fill];
+			if (len) {
+				/* The other buffer is empty, as TX is not busy. */
+				tx.fill ^= 1;
+			}
+		}
+	}
+	if (len == 0) {
+		return -EAGAIN;
+	}
+
 	err = uart_tx(sm_uart_dev, buf, len, SYS_FOREVER_US);
 	if (err) {
-		LOG_ERR("UART TX error: %d", err);
-		ring_buf_get_finish(&tx_buf, 0);
+		LOG_ERR("UART TX error: %d, dropped %zu bytes", err, len);
+		K_SPINLOCK(&tx.lock) {
+			if (tx.fc_busy) {
+				tx.fc_busy = false;
+			} else {
+				tx.len[tx.fill ^ 1] = 0;
+			}
+		}
+		k_sem_give(&tx_space_sem);
 		return err;
 	}
 
 	return 0;
 }
 
+/* Give back tx_done_sem after tx_start() did not start anything. Data committed meanwhile could
+ * not take tx_done_sem from its producer, so it is started here.
+ */
+static void tx_release(void)
+{
+	bool ready;
+
+	while (true) {
+		k_sem_give(&tx_done_sem);
+		K_SPINLOCK(&tx.lock) {
+			ready = tx.fc_pending || (tx.copying == 0 && tx.len[tx.fill] != 0);
+		}
+		if (!ready || !atomic_test_bit(&uart_state, SM_UART_STATE_TX_ENABLED_BIT) ||
+		    k_sem_take(&tx_done_sem, K_NO_WAIT) != 0 || tx_start() == 0) {
+			return;
+		}
+	}
+}
+
+#if defined(CONFIG_SM_UART_RX_FLOW_CONTROL)
+/* Send a flow control character ahead of the buffered TX data. If TX is busy, the character is
+ * sent as soon as the ongoing transfer completes. Can be called from the UART callback.
+ */
+static void tx_fc_send(uint8_t c)
+{
+	K_SPINLOCK(&tx.lock) {
+		/* A pending character that has not been sent yet is superseded. */
+		tx.fc_char = c;
+		tx.fc_pending = true;
+	}
+
+	if (k_sem_take(&tx_done_sem, K_NO_WAIT) == 0 && tx_start()) {
+		tx_release();
+	}
+}
+#endif
+
 static inline void uart_callback_notify_pipe_transmit_idle(void)
 {
 	if (atomic_test_bit(&sm_pipe.state, SM_PIPE_STATE_OPEN_BIT)) {
@@ -282,19 +620,23 @@ static void uart_callback(const struct device *dev, struct uart_event *evt, void
 	switch (evt->type) {
 	case UART_TX_DONE:
 	case UART_TX_ABORTED:
-		err = ring_buf_get_finish(&tx_buf, evt->data.tx.len);
-		if (err) {
-			LOG_ERR("UART_TX_%s failure: %d",
-				(evt->type == UART_TX_DONE) ? "DONE" : "ABORTED", err);
+		K_SPINLOCK(&tx.lock) {
+			if (tx.fc_busy) {
+				tx.fc_busy = false;
+			} else {
+				if (evt->data.tx.len < tx.len[tx.fill ^ 1]) {
+					LOG_WRN("UART TX aborted, dropped %zu bytes",
+						tx.len[tx.fill ^ 1] - evt->data.tx.len);
+				}
+				tx.len[tx.fill ^ 1] = 0;
+			}
 		}
-		if (ring_buf_is_empty(&tx_buf) ||
-		    (evt->type == UART_TX_ABORTED &&
-		     !atomic_test_bit(&uart_state, SM_UART_STATE_TX_ENABLED_BIT))) {
-			/* TX buffer is empty or we aborted due to TX being disabled. */
-			k_sem_give(&tx_done_sem);
-		} else {
-			tx_start();
+		atomic_add(&uart_stats.tx_bytes, evt->data.tx.len);
+		if (tx_start()) {
+			/* Nothing to send or TX is disabled. */
+			tx_release();
 		}
+		k_sem_give(&tx_space_sem);
 		uart_callback_notify_pipe_transmit_idle();
 		break;
 	case UART_RX_RDY:
@@ -304,22 +646,41 @@ static void uart_callback(const struct device *dev, struct uart_event *evt, void
 			 */
 			break;
 		}
+		atomic_inc(&uart_stats.rx_events);
+		rx_adapt.avg_event_len_x16 += ((int32_t)(evt->data.rx.len * 16) -
+					       (int32_t)rx_adapt.avg_event_len_x16) / 8;
 		rx_buf_ref(evt->data.rx.buf);
 		rx_event.buf = &evt->data.rx.buf[evt->data.rx.offset];
 		rx_event.len = evt->data.rx.len;
 		err = k_msgq_put(&rx_event_queue, &rx_event, K_NO_WAIT);
 		if (err) {
 			LOG_ERR("RX event queue full, dropped %zu bytes", evt->data.rx.len);
+			atomic_add(&uart_stats.rx_dropped, evt->data.rx.len);
 			rx_buf_unref(evt->data.rx.buf);
 			break;
 		}
+		sm_util_atomic_max(&uart_stats.rx_queue_max, k_msgq_num_used_get(&rx_event_queue));
+		rx_received(evt->data.rx.len);
 		modem_pipe_notify_receive_ready(&sm_pipe.pipe);
+		if (evt->data.rx.offset + evt->data.rx.len < CONFIG_SM_UART_RX_BUF_SIZE) {
+			rx_timeout_apply();
+		}
 		break;
 	case UART_RX_BUF_REQUEST:
 		if (k_msgq_num_free_get(&rx_event_queue) < UART_RX_EVENT_COUNT_FOR_BUF) {
 			LOG_WRN("Disabling UART RX: No event space.");
 			break;
 		}
+		if (atomic_get(&rx_fc.state) == RX_FC_RTS) {
+			LOG_DBG("Disabling UART RX: Backpressure.");
+			break;
+		}
+		rx_buf_limit_update();
+		if (k_mem_slab_num_used_get(&rx_slab) >= rx_adapt.buf_limit) {
+			atomic_inc(&uart_stats.rx_buf_declined);
+			LOG_DBG("Disabling UART RX: Buffer limit %u reached.", rx_adapt.buf_limit);
+			break;
+		}
 		buf = rx_buf_alloc();
 		if (!buf) {
 			LOG_WRN("Disabling UART RX: No free buffers.");
@@ -336,8 +697,21 @@ static void uart_callback(const struct device *dev, struct uart_event *evt, void
 			rx_buf_unref(evt->data.rx_buf.buf);
 		}
 		break;
+	case UART_RX_STOPPED:
+		atomic_inc(&uart_stats.rx_errors);
+		if (evt->data.rx_stop.reason & UART_ERROR_OVERRUN) {
+			atomic_inc(&uart_stats.rx_overruns);
+		}
+		break;
 	case UART_RX_DISABLED:
 		atomic_clear_bit(&uart_state, SM_UART_STATE_RX_ENABLED_BIT);
+		if (atomic_test_and_clear_bit(&uart_state, SM_UART_STATE_RX_RESTART_BIT) &&
+		    rx_enable() == 0 && atomic_test_bit(&uart_state, SM_UART_STATE_RX_ENABLED_BIT)) {
+			/* Restarted with a new RX timeout. */
+			atomic_inc(&uart_stats.rx_restarts);
+			break;
+		}
+		atomic_inc(&uart_stats.rx_disabled);
 		/* Notify pipe that receive may be ready after re-enable */
 		modem_pipe_notify_receive_ready(&sm_pipe.pipe);
 		break;
@@ -380,6 +754,7 @@ static int sm_uart_handler_enable(void)
 	atomic_clear(&uart_state);
 
 	sm_uart_baudrate = cfg.baudrate;
+	rx_fc.hwfc = (cfg.flow_ctrl == UART_CFG_FLOW_CTRL_RTS_CTS);
 	LOG_INF("UART baud: %d d/p/s-bits: %d/%d/%d HWFC: %d",
 		cfg.baudrate, cfg.data_bits, cfg.parity,
 		cfg.stop_bits, cfg.flow_ctrl);
@@ -465,8 +840,9 @@ static int pipe_open(void *data)
 /* Returns the number of bytes written or a negative error code. */
 static int pipe_transmit(void *data, const uint8_t *buf, size_t size)
 {
-	size_t ret;
+	size_t copy_size;
 	size_t sent = 0;
+	int err;
 
 	ARG_UNUSED(data);
 
@@ -479,31 +855,63 @@ static int pipe_transmit(void *data, const uint8_t *buf, size_t size)
 	}
 
 	while (sent < size) {
-		ret = ring_buf_put(&tx_buf, buf + sent, size - sent);
-		if (ret) {
-			sent += ret;
-		} else {
-			/* Buffer full. */
-			break;
+		uint8_t *dst;
+
+		/* Reserve the space under the lock, and copy outside of it. */
+		K_SPINLOCK(&tx.lock) {
+			copy_size = MIN(size - sent, sizeof(tx.buf[0]) - tx.len[tx.fill]);
+			dst = &tx.buf[tx.fill][tx.len[tx.fill]];
+			tx.len[tx.fill] += copy_size;
+			tx.copying += copy_size;
 		}
-	}
+		if (copy_size) {
+			memcpy(dst, buf + sent, copy_size);
+			K_SPINLOCK(&tx.lock) {
+				tx.copying -= copy_size;
+			}
+		}
+		sent += copy_size;
 
-	if (k_sem_take(&tx_done_sem, K_NO_WAIT) == 0) {
-		int err = tx_start();
+		if (k_sem_take(&tx_done_sem, K_NO_WAIT) != 0) {
+			if (copy_size == 0) {
+				/* Both buffers in use. */
+				break;
+			}
+			/* TX is busy, the filled buffer is sent when the transfer completes. */
+			continue;
+		}
 
+		err = tx_start();
 		if (err == -EAGAIN) {
-			k_sem_give(&tx_done_sem);
-			return (int)sent;
+			tx_release();
+			break;
 		} else if (err) {
 			LOG_ERR("TX %s failed (%d).", "start", err);
-			k_sem_give(&tx_done_sem);
+			tx_release();
 			return err;
 		}
 	}
+	if (sent < size) {
+		atomic_inc(&uart_stats.tx_full);
+	}
 
 	return (int)sent;
 }
 
+int sm_uart_pipe_tx_wait(k_timeout_t timeout)
+{
+	int64_t start = k_uptime_get();
+	int err;
+
+	err = k_sem_take(&tx_space_sem, timeout);
+	atomic_add(&uart_stats.tx_blocked_ms, (atomic_val_t)k_uptime_delta(&start));
+
+	return err;
+}
+
+/* Received data claimed with sm_uart_pipe_rx_claim(), buf is NULL when nothing is claimed */
+static struct rx_event_t rx_claimed;
+
 static int pipe_receive(void *data, uint8_t *buf, size_t size)
 {
 	struct rx_event_t rx_event;
@@ -517,6 +925,11 @@ static int pipe_receive(void *data, uint8_t *buf, size_t size)
 		return 0;
 	}
 
+	if (rx_claimed.buf) {
+		/* The rest of the claimed data comes first, it is notified when released. */
+		return 0;
+	}
+
 	while (size > received) {
 		if (k_msgq_get(&rx_event_queue, &rx_event, K_NO_WAIT)) {
 			break;
@@ -534,16 +947,67 @@ static int pipe_receive(void *data, uint8_t *buf, size_t size)
 			err = k_msgq_put_front(&rx_event_queue, &rx_event);
 			if (err) {
 				LOG_ERR("RX event queue full, dropped %zu bytes", rx_event.len);
+				rx_dropped(rx_event.len);
 				rx_buf_unref(rx_event.buf);
 			}
 		}
 	}
-	if (k_msgq_num_used_get(&rx_event_queue) == 0) {
+	rx_processed(received);
+
+	return (int)received;
+}
+
+int sm_uart_pipe_rx_claim(const uint8_t **data, size_t max_len)
+{
+	if (!data || max_len == 0) {
+		return -EINVAL;
+	}
+
+	if (rx_claimed.buf) {
+		return -EBUSY;
+	}
+
+	if (k_msgq_get(&rx_event_queue, &rx_claimed, K_NO_WAIT)) {
+		rx_claimed.buf = NULL;
 		/* Try to recover RX, in case it was disabled. */
 		rx_recovery();
+		return 0;
 	}
 
-	return (int)received;
+	*data = rx_claimed.buf;
+
+	return (int)MIN(rx_claimed.len, max_len);
+}
+
+void sm_uart_pipe_rx_release(size_t len)
+{
+	int err;
+
+	if (!rx_claimed.buf) {
+		return;
+	}
+
+	if (len < rx_claimed.len) {
+		rx_claimed.len -= len;
+		rx_claimed.buf += len;
+		err = k_msgq_put_front(&rx_event_queue, &rx_claimed);
+		if (err) {
+			LOG_ERR("RX event queue full, dropped %zu bytes", rx_claimed.len);
+			rx_dropped(rx_claimed.len);
+			rx_buf_unref(rx_claimed.buf);
+		}
+	} else {
+		len = rx_claimed.len;
+		rx_buf_unref(rx_claimed.buf);
+	}
+	rx_claimed.buf = NULL;
+
+	rx_processed(len);
+
+	if (k_msgq_num_used_get(&rx_event_queue) > 0) {
+		/* The pipe may have been handed over while the data was claimed. */
+		modem_pipe_notify_receive_ready(&sm_pipe.pipe);
+	}
 }
 
 static int pipe_close(void *data)
@@ -651,6 +1115,8 @@ static int handle_at_ipr(enum at_parser_cmd_type cmd_type, struct at_parser *par
 		LOG_ERR("uart_configure: %d", err);
 		return err;
 	}
+	/* The RX idle timeout is derived from the new baud rate when RX is enabled. */
+	sm_uart_baudrate = cfg.baudrate;
 	err = modem_pipe_open(&sm_pipe.pipe, K_SECONDS(1));
 	if (err) {
 		LOG_ERR("modem_pipe_open: %d", err);
@@ -659,3 +1125,120 @@ static int handle_at_ipr(enum at_parser_cmd_type cmd_type, struct at_parser *par
 
 	return -SILENT_AT_COMMAND_RET;
 }
+
+enum sm_uart_stat_op {
+	SM_UART_STAT_RESET,
+	SM_UART_STAT_LOG,
+};
+
+/* The read response has one line for each group, starting with the group. */
+enum sm_uart_stat_group {
+	SM_UART_STAT_GROUP_RX,
+	SM_UART_STAT_GROUP_RX_ADAPT,
+	SM_UART_STAT_GROUP_RX_FC,
+	SM_UART_STAT_GROUP_TX,
+};
+
+static void uart_stats_log(void)
+{
+	atomic_val_t rx_events = atomic_get(&uart_stats.rx_events);
+
+	LOG_INF("UART RX: %ld bytes, %ld events (avg %ld bytes), dropped %ld bytes",
+		atomic_get(&uart_stats.rx_bytes), rx_events,
+		rx_events ? atomic_get(&uart_stats.rx_bytes) / rx_events : 0,
+		atomic_get(&uart_stats.rx_dropped));
+	LOG_INF("UART RX: max %ld/%d buffers, max %ld/%d events",
+		atomic_get(&uart_stats.rx_slab_max), UART_SLAB_BLOCK_COUNT,
+		atomic_get(&uart_stats.rx_queue_max), UART_RX_EVENT_COUNT);
+	LOG_INF("UART RX: disabled %ld, recovered %ld, errors %ld (overruns %ld)",
+		atomic_get(&uart_stats.rx_disabled), atomic_get(&uart_stats.rx_recovered),
+		atomic_get(&uart_stats.rx_errors), atomic_get(&uart_stats.rx_overruns));
+	LOG_INF("UART RX: timeout %u us, limit %u buffers, declined %ld, restarts %ld",
+		rx_adapt.timeout_us, rx_adapt.buf_limit,
+		atomic_get(&uart_stats.rx_buf_declined), atomic_get(&uart_stats.rx_restarts));
+	LOG_INF("UART RX: backpressure %ld, %ld bytes pending (max %ld), asserted %ld, "
+		"unprotected %ld", atomic_get(&rx_fc.state), atomic_get(&rx_fc.pending),
+		atomic_get(&uart_stats.rx_pending_max), atomic_get(&uart_stats.fc_asserted),
+		atomic_get(&uart_stats.fc_unprotected));
+	LOG_INF("UART TX: %ld bytes, buffers full %ld times, blocked %ld ms",
+		atomic_get(&uart_stats.tx_bytes), atomic_get(&uart_stats.tx_full),
+		atomic_get(&uart_stats.tx_blocked_ms));
+}
+
+static void uart_stats_reset(void)
+{
+	atomic_clear(&uart_stats.rx_bytes);
+	atomic_clear(&uart_stats.rx_events);
+	atomic_clear(&uart_stats.rx_slab_max);
+	atomic_clear(&uart_stats.rx_queue_max);
+	atomic_clear(&uart_stats.rx_dropped);
+	atomic_clear(&uart_stats.rx_disabled);
+	atomic_clear(&uart_stats.rx_recovered);
+	atomic_clear(&uart_stats.rx_errors);
+	atomic_clear(&uart_stats.rx_overruns);
+	atomic_clear(&uart_stats.rx_buf_declined);
+	atomic_clear(&uart_stats.rx_restarts);
+	atomic_clear(&uart_stats.rx_pending_max);
+	atomic_clear(&uart_stats.fc_asserted);
+	atomic_clear(&uart_stats.fc_unprotected);
+	atomic_clear(&uart_stats.tx_bytes);
+	atomic_clear(&uart_stats.tx_full);
+	atomic_clear(&uart_stats.tx_blocked_ms);
+}
+
+SM_AT_CMD_CUSTOM(xuartstat, "AT#XUARTSTAT", handle_at_xuartstat);
+static int handle_at_xuartstat(enum at_parser_cmd_type cmd_type, struct at_parser *parser,
+			       uint32_t param_count)
+{
+	atomic_val_t rx_events;
+	uint16_t op;
+	int err;
+
+	switch (cmd_type) {
+	case AT_PARSER_CMD_TYPE_SET:
+		if (param_count != 2) {
+			return -EINVAL;
+		}
+		err = at_parser_num_get(parser, 1, &op);
+		if (err) {
+			return err;
+		}
+		if (op == SM_UART_STAT_RESET) {
+			uart_stats_reset();
+		} else if (op == SM_UART_STAT_LOG) {
+			uart_stats_log();
+		} else {
+			return -EINVAL;
+		}
+		return 0;
+
+	case AT_PARSER_CMD_TYPE_READ:
+		rx_events = atomic_get(&uart_stats.rx_events);
+		rsp_send("\r\n#XUARTSTAT: %d,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\r\n",
+			 SM_UART_STAT_GROUP_RX, atomic_get(&uart_stats.rx_bytes), rx_events,
+			 rx_events ? atomic_get(&uart_stats.rx_bytes) / rx_events : 0,
+			 atomic_get(&uart_stats.rx_slab_max), atomic_get(&uart_stats.rx_queue_max),
+			 atomic_get(&uart_stats.rx_dropped), atomic_get(&uart_stats.rx_disabled),
+			 atomic_get(&uart_stats.rx_recovered), atomic_get(&uart_stats.rx_errors),
+			 atomic_get(&uart_stats.rx_overruns));
+		rsp_send("\r\n#XUARTSTAT: %d,%u,%u,%ld,%ld\r\n", SM_UART_STAT_GROUP_RX_ADAPT,
+			 rx_adapt.timeout_us, rx_adapt.buf_limit,
+			 atomic_get(&uart_stats.rx_buf_declined),
+			 atomic_get(&uart_stats.rx_restarts));
+		rsp_send("\r\n#XUARTSTAT: %d,%ld,%ld,%ld,%ld,%ld\r\n", SM_UART_STAT_GROUP_RX_FC,
+			 atomic_get(&rx_fc.state), atomic_get(&rx_fc.pending),
+			 atomic_get(&uart_stats.rx_pending_max), atomic_get(&uart_stats.fc_asserted),
+			 atomic_get(&uart_stats.fc_unprotected));
+		rsp_send("\r\n#XUARTSTAT: %d,%ld,%ld,%ld\r\n", SM_UART_STAT_GROUP_TX,
+			 atomic_get(&uart_stats.tx_bytes), atomic_get(&uart_stats.tx_full),
+			 atomic_get(&uart_stats.tx_blocked_ms));
+		return 0;
+
+	case AT_PARSER_CMD_TYPE_TEST:
+		rsp_send("\r\n#XUARTSTAT: (%d,%d)\r\n", SM_UART_STAT_RESET, SM_UART_STAT_LOG);
+		return 0;
+
+	default:
+		return -EINVAL;
+	}
+}
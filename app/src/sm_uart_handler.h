@@ -35,6 +35,49 @@ typedef int (*sm_pipe_tx_t)(const uint8_t *data, size_t len, bool urc);
  */
 struct modem_pipe *sm_uart_pipe_get(void);
 
+/**
+ * @brief Claim received data from the UART pipe without copying it.
+ *
+ * The data stays in the UART RX buffer until it is released with sm_uart_pipe_rx_release().
+ * Only one claim can be active at a time. This is an alternative to modem_pipe_receive() for
+ * the user of the UART pipe. modem_pipe_receive() returns no data while a claim is active, and
+ * the pipe is notified as ready to receive when data is left after the release.
+ *
+ * @param[out] data Pointer to the received data.
+ * @param max_len Maximum number of bytes to claim.
+ *
+ * @retval Amount of bytes claimed, 0 if there is no received data, otherwise a negative error
+ *         code.
+ */
+int sm_uart_pipe_rx_claim(const uint8_t **data, size_t max_len);
+
+/**
+ * @brief Release data claimed with sm_uart_pipe_rx_claim().
+ *
+ * @param len Amount of bytes consumed. The rest of the claimed data is returned by the next
+ *            claim.
+ */
+void sm_uart_pipe_rx_release(size_t len);
+
+/**
+ * @brief Update the receive backpressure method after a mode change.
+ *
+ * Call when the AT host mode of the UART pipe, the owner of the UART pipe, or the CMUX state
+ * changes. The UART callback reads the result instead of checking the mode itself.
+ */
+void sm_uart_rx_fc_mode_update(void);
+
+/**
+ * @brief Wait until UART TX buffer space is freed.
+ *
+ * Use when modem_pipe_transmit() on the UART pipe did not accept all the data.
+ *
+ * @param timeout Maximum time to wait.
+ *
+ * @retval 0 if TX buffer space was freed, otherwise a negative error code.
+ */
+int sm_uart_pipe_tx_wait(k_timeout_t timeout);
+
 /** @} */
 
 #endif /* SM_UART_HANDLER_ */
@@ -240,6 +240,24 @@ static inline bool sm_pipe_is_open(struct modem_pipe *pipe)
 	       Z_MODEM_PIPE_EVENT_OPENED_BIT;
 }
 
+/**
+ * @brief Raise an atomic high-water mark
+ *
+ * @param target Atomic variable holding the maximum.
+ * @param value New value, stored if it is larger than the current maximum.
+ */
+static inline void sm_util_atomic_max(atomic_t *target, atomic_val_t value)
+{
+	atomic_val_t old;
+
+	do {
+		old = atomic_get(target);
+		if (value <= old) {
+			return;
+		}
+	} while (!atomic_cas(target, old, value));
+}
+
 /**
  * @brief Get the current functional mode of the modem
  *
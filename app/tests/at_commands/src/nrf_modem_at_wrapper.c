@@ -17,6 +17,8 @@
 #include <nrf_errno.h>
 #include <modem/at_cmd_custom.h>
 
+#include "sm_defines.h"
+
 /* External wrapper functions declared by SM_AT_CMD_CUSTOM macro */
 extern int handle_at_smver_wrapper_xsmver(char *buf, size_t len, char *at_cmd);
 extern int handle_at_sleep_wrapper_xsleep(char *buf, size_t len, char *at_cmd);
@@ -29,6 +31,8 @@ extern int handle_at_clac_wrapper_xclac(char *buf, size_t len, char *at_cmd);
 extern int handle_ate0_wrapper_ate0(char *buf, size_t len, char *at_cmd);
 extern int handle_ate1_wrapper_ate1(char *buf, size_t len, char *at_cmd);
 extern int handle_at_xbootinfo_wrapper_xbootinfo(char *buf, size_t len, char *at_cmd);
+extern int handle_at_urcstat_wrapper_xurcstat(char *buf, size_t len, char *at_cmd);
+extern int handle_at_pipeline_wrapper_xpipeline(char *buf, size_t len, char *at_cmd);
 
 int nrf_modem_at_cmd(void *buf, size_t buf_size, const char *fmt, ...)
 {
@@ -63,6 +67,13 @@ int nrf_modem_at_cmd(void *buf, size_t buf_size, const char *fmt, ...)
 		ret = handle_ate1_wrapper_ate1((char *)buf, buf_size, at_cmd);
 	} else if (strncasecmp(at_cmd, "AT#XBOOTINFO", 12) == 0) {
 		ret = handle_at_xbootinfo_wrapper_xbootinfo((char *)buf, buf_size, at_cmd);
+	} else if (strncasecmp(at_cmd, "AT#XURCSTAT", 11) == 0) {
+		ret = handle_at_urcstat_wrapper_xurcstat((char *)buf, buf_size, at_cmd);
+	} else if (strncasecmp(at_cmd, "AT#XPIPELINE", 12) == 0) {
+		ret = handle_at_pipeline_wrapper_xpipeline((char *)buf, buf_size, at_cmd);
+	} else if (strncasecmp(at_cmd, "AT#XTESTASYNC", 13) == 0) {
+		/* Keeps executing until the test calls sm_at_host_cmd_done() */
+		ret = -AT_COMMAND_CONTINUE_RET;
 	} else {
 		/* Unknown command - return error */
 		ret = -NRF_EINVAL;
@@ -10,10 +10,12 @@
  */
 
 #include <unity.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <zephyr/kernel.h>
 #include <zephyr/sys/reboot.h>
+#include <zephyr/sys/ring_buffer.h>
 #include <dfu/dfu_target.h>
 
 #include "sm_at_host.h"
@@ -33,6 +35,9 @@ extern int _nrf_modem_at_cmd_custom_list_end;
 int _nrf_modem_at_cmd_custom_list_start;
 int _nrf_modem_at_cmd_custom_list_end;
 
+/* UART RX data not yet received by the AT host - provided by uart_stubs.c */
+extern struct ring_buf uart_rx_ring_buf;
+
 /* Response capture - provided by sm_at_host_stubs.c */
 extern void capture_response_data(const uint8_t *data, size_t len);
 extern void clear_captured_response(void);
@@ -351,6 +356,325 @@ void test_xbootinfo_test(void)
 	TEST_ASSERT_TRUE(strstr(response, "OK") != NULL);
 }
 
+/*
+ * Test: Status URCs are coalesced while the AT host is busy
+ * - Tests: A +CEREG URC replaces the latest one in place if the registration status is unchanged
+ */
+void test_urc_coalesce_while_busy(void)
+{
+	struct sm_at_host_ctx *ctx = sm_at_host_get_urc_ctx();
+	const char *response;
+	const char *searching;
+	const char *registered;
+	const char *sendntf;
+
+	TEST_ASSERT_NOT_NULL(ctx);
+
+	sm_at_host_lock(ctx);
+	urc_send("\r\n+CEREG: 2,\"0001\",\"00000001\",7\r\n");
+	urc_send("\r\n+CEREG: 1,\"0001\",\"00000001\",7\r\n");
+	urc_send("\r\n#XSENDNTF: 0,0,10\r\n");
+	urc_send("\r\n+CEREG: 1,\"0001\",\"00000002\",7\r\n");
+	clear_captured_response();
+	sm_at_host_unlock(ctx);
+	k_sleep(K_MSEC(100));
+
+	response = get_captured_response();
+	searching = strstr(response, "+CEREG: 2");
+	registered = strstr(response, "+CEREG: 1");
+	sendntf = strstr(response, "#XSENDNTF: 0,0,10");
+	TEST_ASSERT_NOT_NULL(searching);
+	TEST_ASSERT_NOT_NULL(registered);
+	TEST_ASSERT_NOT_NULL(sendntf);
+	TEST_ASSERT_NULL(strstr(response, "+CEREG: 1,\"0001\",\"00000001\""));
+	TEST_ASSERT_NOT_NULL(strstr(response, "+CEREG: 1,\"0001\",\"00000002\""));
+	TEST_ASSERT_TRUE(searching < registered);
+	TEST_ASSERT_TRUE(registered < sendntf);
+}
+
+/* Read the URC statistics: coalesced, dropped, buffer_max, small_max and large_max */
+static void read_urcstat(unsigned int stats[5])
+{
+	const char *response;
+
+	clear_captured_response();
+	send_at_command("AT#XURCSTAT?\r\n");
+
+	response = strstr(get_captured_response(), "#XURCSTAT: ");
+	TEST_ASSERT_NOT_NULL(response);
+	TEST_ASSERT_EQUAL(5, sscanf(response, "#XURCSTAT: %u,%u,%u,%u,%u", &stats[0], &stats[1],
+				    &stats[2], &stats[3], &stats[4]));
+}
+
+/*
+ * Test: Pipe-specific URC messages run out while the AT host is busy
+ * - Tests: The oldest URC of the lowest priority is dropped to make room for a new URC
+ */
+void test_urc_msg_exhausted_drops_oldest_lowest(void)
+{
+	struct sm_at_host_ctx *ctx = sm_at_host_get_urc_ctx();
+	struct modem_pipe *pipe;
+	const char *response;
+	unsigned int before[5];
+	unsigned int after[5];
+
+	TEST_ASSERT_NOT_NULL(ctx);
+	pipe = sm_at_host_get_pipe(ctx);
+	read_urcstat(before);
+
+	sm_at_host_lock(ctx);
+	/* Fill all 16 small URC messages with normal and low priority URCs. */
+	for (int i = 0; i < 16; i++) {
+		if (i % 2) {
+			urc_send_to(pipe, "\r\n#XAPOLL: %d,1\r\n", i);
+		} else {
+			urc_send_to(pipe, "\r\n#XTESTNTF: %d\r\n", i);
+		}
+	}
+	/* Each of these waits for the host, then drops the oldest low priority URC. */
+	urc_send_to(pipe, "\r\n#XTESTNTF: 16\r\n");
+	urc_send_to(pipe, "\r\n#XSENDNTF: 0,0,10\r\n");
+	clear_captured_response();
+	sm_at_host_unlock(ctx);
+	k_sleep(K_MSEC(100));
+
+	response = get_captured_response();
+	TEST_ASSERT_NULL(strstr(response, "#XAPOLL: 1,1"));
+	TEST_ASSERT_NULL(strstr(response, "#XAPOLL: 3,1"));
+	TEST_ASSERT_NOT_NULL(strstr(response, "#XAPOLL: 5,1"));
+	TEST_ASSERT_NOT_NULL(strstr(response, "#XTESTNTF: 0\r\n"));
+	TEST_ASSERT_NOT_NULL(strstr(response, "#XTESTNTF: 14\r\n"));
+	TEST_ASSERT_NOT_NULL(strstr(response, "#XTESTNTF: 16\r\n"));
+	TEST_ASSERT_NOT_NULL(strstr(response, "#XSENDNTF: 0,0,10"));
+	TEST_ASSERT_TRUE(strstr(response, "#XTESTNTF: 16") < strstr(response, "#XSENDNTF"));
+
+	read_urcstat(after);
+	TEST_ASSERT_EQUAL(before[1] + 2, after[1]);
+	TEST_ASSERT_EQUAL(16, after[3]);
+}
+
+/*
+ * Test: Pipe-specific URC messages run out with only higher priority URCs buffered
+ * - Tests: The new URC is dropped instead of a buffered URC of higher priority
+ */
+void test_urc_msg_exhausted_keeps_higher_priority(void)
+{
+	struct sm_at_host_ctx *ctx = sm_at_host_get_urc_ctx();
+	struct modem_pipe *pipe;
+	const char *response;
+	char urc[32];
+
+	TEST_ASSERT_NOT_NULL(ctx);
+	pipe = sm_at_host_get_pipe(ctx);
+
+	sm_at_host_lock(ctx);
+	for (int i = 0; i < 16; i++) {
+		urc_send_to(pipe, "\r\n#XSENDNTF: %d,0,10\r\n", i);
+	}
+	urc_send_to(pipe, "\r\n#XAPOLL: 0,1\r\n");
+	clear_captured_response();
+	sm_at_host_unlock(ctx);
+	k_sleep(K_MSEC(100));
+
+	response = get_captured_response();
+	TEST_ASSERT_NULL(strstr(response, "#XAPOLL"));
+	for (int i = 0; i < 16; i++) {
+		snprintf(urc, sizeof(urc), "#XSENDNTF: %d,0,10", i);
+		TEST_ASSERT_NOT_NULL(strstr(response, urc));
+	}
+}
+
+/*
+ * Test: A pipe-specific URC larger than the largest URC message
+ * - Tests: The URC is allocated from the heap and sent in full
+ */
+void test_urc_msg_heap_fallback(void)
+{
+	struct sm_at_host_ctx *ctx = sm_at_host_get_urc_ctx();
+	static char payload[300];
+	struct modem_pipe *pipe;
+	const char *response;
+	unsigned int before[5];
+	unsigned int after[5];
+
+	TEST_ASSERT_NOT_NULL(ctx);
+	pipe = sm_at_host_get_pipe(ctx);
+	memset(payload, 'A', sizeof(payload) - 1);
+	read_urcstat(before);
+
+	sm_at_host_lock(ctx);
+	urc_send_to(pipe, "\r\n#XTESTNTF: %s\r\n", payload);
+	clear_captured_response();
+	sm_at_host_unlock(ctx);
+	k_sleep(K_MSEC(100));
+
+	response = strstr(get_captured_response(), "#XTESTNTF: ");
+	TEST_ASSERT_NOT_NULL(response);
+	TEST_ASSERT_EQUAL(0, strncmp(response + strlen("#XTESTNTF: "), payload, strlen(payload)));
+
+	read_urcstat(after);
+	TEST_ASSERT_EQUAL(before[1], after[1]);
+	TEST_ASSERT_EQUAL(before[4], after[4]);
+}
+
+/*
+ * Test: AT#XURCSTAT? - read URC statistics
+ */
+void test_xurcstat_read(void)
+{
+	const char *response;
+
+	clear_captured_response();
+	send_at_command("AT#XURCSTAT?\r\n");
+
+	response = get_captured_response();
+	TEST_ASSERT_TRUE(strstr(response, "#XURCSTAT: ") != NULL);
+	TEST_ASSERT_TRUE(strstr(response, "OK") != NULL);
+}
+
+/*
+ * Test: AT#XPIPELINE - enable pipelining and send commands back-to-back
+ * - Tests: Commands sent in one burst are all executed and responses are in order
+ */
+void test_xpipeline_back_to_back(void)
+{
+	const char *response;
+	const char *first;
+	const char *second;
+
+	send_at_command("AT#XPIPELINE=1\r\n");
+	clear_captured_response();
+	send_at_command("AT#XPIPELINE?\r\n");
+	response = get_captured_response();
+	TEST_ASSERT_NOT_NULL(strstr(response, "#XPIPELINE: 1"));
+
+	clear_captured_response();
+	send_at_command("AT#XDATACTRL=?\r\nAT#XBOOTINFO=?\r\n");
+	k_sleep(K_MSEC(100));
+
+	response = get_captured_response();
+	first = strstr(response, "#XDATACTRL=<time_limit>");
+	second = strstr(response, "#XBOOTINFO: (0,1)");
+	TEST_ASSERT_NOT_NULL(first);
+	TEST_ASSERT_NOT_NULL(second);
+	TEST_ASSERT_TRUE(first < second);
+
+	send_at_command("AT#XPIPELINE=0\r\n");
+}
+
+/*
+ * Test: AT#XPIPELINE - send commands while an asynchronous command is executing
+ * - Tests: Commands are queued until the command is done and then executed in order, and
+ *   reception is held back when the queue cannot take another chunk
+ */
+void test_xpipeline_while_executing(void)
+{
+	struct sm_at_host_ctx *ctx = sm_at_host_get_urc_ctx();
+	static char burst[50 * sizeof("AT#XBOOTINFO=?\r\n")];
+	const char *response;
+	const char *first;
+	const char *second;
+	size_t len = 0;
+	int count = 0;
+
+	TEST_ASSERT_NOT_NULL(ctx);
+	for (int i = 0; i < 50; i++) {
+		len += sprintf(&burst[len], "AT#XBOOTINFO=?\r\n");
+	}
+
+	send_at_command("AT#XPIPELINE=1\r\n");
+	clear_captured_response();
+	send_at_command("AT#XTESTASYNC\r\nAT#XDATACTRL=?\r\n");
+	k_sleep(K_MSEC(100));
+
+	/* The queued command is not executed while the asynchronous one is executing. */
+	TEST_ASSERT_NULL(strstr(get_captured_response(), "#XDATACTRL"));
+
+	/* The first burst is queued, and the second one fills the queue. */
+	uart_stub_rx((const uint8_t *)burst, len);
+	TEST_ASSERT_EQUAL(0, ring_buf_size_get(&uart_rx_ring_buf));
+	uart_stub_rx((const uint8_t *)burst, len);
+	k_sleep(K_MSEC(100));
+	TEST_ASSERT_TRUE(ring_buf_size_get(&uart_rx_ring_buf) > 0);
+	TEST_ASSERT_NULL(strstr(get_captured_response(), "#XBOOTINFO"));
+
+	sm_at_host_cmd_done(ctx);
+	k_sleep(K_MSEC(500));
+
+	TEST_ASSERT_EQUAL(0, ring_buf_size_get(&uart_rx_ring_buf));
+	response = get_captured_response();
+	TEST_ASSERT_NULL(strstr(response, "ERROR"));
+	first = strstr(response, "#XDATACTRL=<time_limit>");
+	second = strstr(response, "#XBOOTINFO: (0,1)");
+	TEST_ASSERT_NOT_NULL(first);
+	TEST_ASSERT_NOT_NULL(second);
+	TEST_ASSERT_TRUE(first < second);
+	for (const char *p = second; p; p = strstr(p + 1, "#XBOOTINFO: (0,1)")) {
+		count++;
+	}
+	TEST_ASSERT_EQUAL(100, count);
+
+	send_at_command("AT#XPIPELINE=0\r\n");
+}
+
+/*
+ * Test: AT#XPIPELINE - echo of a command queued behind an asynchronous command
+ * - Tests: The echo is held back until the command is executed, so it follows the final
+ *   response of the asynchronous command
+ */
+void test_xpipeline_echo_held_back(void)
+{
+	struct sm_at_host_ctx *ctx = sm_at_host_get_urc_ctx();
+	const char *response;
+	const char *ok;
+	const char *echo;
+	const char *rsp;
+
+	TEST_ASSERT_NOT_NULL(ctx);
+	send_at_command("AT#XPIPELINE=1\r\n");
+	send_at_command("ATE1\r\n");
+	clear_captured_response();
+	send_at_command("AT#XTESTASYNC\r\nAT#XDATACTRL=?\r\n");
+	k_sleep(K_MSEC(100));
+
+	/* Only the echo of the executing command has been sent. */
+	response = get_captured_response();
+	TEST_ASSERT_NOT_NULL(strstr(response, "AT#XTESTASYNC"));
+	TEST_ASSERT_NULL(strstr(response, "AT#XDATACTRL"));
+
+	/* Final response of the asynchronous command */
+	rsp_send_ok();
+	sm_at_host_cmd_done(ctx);
+	k_sleep(K_MSEC(100));
+
+	response = get_captured_response();
+	ok = strstr(response, "OK");
+	echo = strstr(response, "AT#XDATACTRL=?");
+	rsp = strstr(response, "#XDATACTRL=<time_limit>");
+	TEST_ASSERT_NOT_NULL(ok);
+	TEST_ASSERT_NOT_NULL(echo);
+	TEST_ASSERT_NOT_NULL(rsp);
+	TEST_ASSERT_TRUE(ok < echo);
+	TEST_ASSERT_TRUE(echo < rsp);
+
+	send_at_command("ATE0\r\n");
+	send_at_command("AT#XPIPELINE=0\r\n");
+}
+
+/*
+ * Test: AT#XPIPELINE - invalid value
+ */
+void test_xpipeline_invalid(void)
+{
+	const char *response;
+
+	clear_captured_response();
+	send_at_command("AT#XPIPELINE=2\r\n");
+
+	response = get_captured_response();
+	TEST_ASSERT_NOT_NULL(strstr(response, "ERROR"));
+}
+
 extern int unity_main(void);
 
 int main(void)
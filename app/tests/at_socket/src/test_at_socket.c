@@ -34,6 +34,25 @@ extern const char *get_captured_response(void);
 extern size_t get_captured_response_len(void);
 extern void clear_captured_response(void);
 
+/* Kernel timer operation counting, see --wrap options in CMakeLists.txt */
+static uint32_t timer_ops;
+
+extern void __real_z_impl_k_timer_start(struct k_timer *timer, k_timeout_t duration,
+					k_timeout_t period);
+extern void __real_z_impl_k_timer_stop(struct k_timer *timer);
+
+void __wrap_z_impl_k_timer_start(struct k_timer *timer, k_timeout_t duration, k_timeout_t period)
+{
+	timer_ops++;
+	__real_z_impl_k_timer_start(timer, duration, period);
+}
+
+void __wrap_z_impl_k_timer_stop(struct k_timer *timer)
+{
+	timer_ops++;
+	__real_z_impl_k_timer_stop(timer);
+}
+
 /* Helper callbacks for mocking zsock_getsockopt with output parameters */
 static int mock_getsockopt_timeval_callback(int socket, int level, int option_name,
 					    void *option_value, net_socklen_t *option_len,
@@ -1314,6 +1333,94 @@ void test_xsend_data_mode_partial_quit_string(void)
 	send_at_command("AT#XCLOSE=1\r\n");
 }
 
+/*
+ * Test: Send data via AT#XSEND in data mode with quit string in the same chunk
+ * - Command: AT#XSEND=<handle>,2,<flags>\r\n followed by data and quit string in one chunk
+ * - Tests: Data before the quit string is sent, including a single '+' inside the data
+ * - Expected: Data mode is exited without waiting for the inactivity timer
+ */
+void test_xsend_data_mode_quit_string_in_chunk(void)
+{
+	const char *response;
+	const char *test_data = "Hello+World+++";
+
+	/* Create socket first */
+	__cmock_zsock_socket_ExpectAndReturn(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+	__cmock_zsock_setsockopt_ExpectAnyArgsAndReturn(0); /* SO_SNDTIMEO */
+	__cmock_zsock_setsockopt_ExpectAnyArgsAndReturn(0); /* SO_POLLCB */
+	send_at_command("AT#XSOCKET=1,1,0\r\n");
+	clear_captured_response();
+
+	/* Enter data mode: socket 1, mode 2 (data), flags 0, no data_len specified */
+	send_at_command("AT#XSEND=1,2,0\r\n");
+
+	response = get_captured_response();
+	TEST_ASSERT_TRUE(strstr(response, "OK") != NULL);
+	clear_captured_response();
+
+	/* Data and quit string arrive in one chunk */
+	__cmock_zsock_setsockopt_ExpectAnyArgsAndReturn(0); /* Clear/set send callback */
+	__cmock_zsock_send_ExpectAndReturn(1, "Hello+World", 11, 0, 11);
+	uart_stub_rx((const uint8_t *)test_data, strlen(test_data));
+
+	response = get_captured_response();
+	TEST_ASSERT_TRUE(strstr(response, "#XDATAMODE: 0") != NULL);
+
+	/* Close socket */
+	__cmock_zsock_close_ExpectAndReturn(1, 0);
+	send_at_command("AT#XCLOSE=1\r\n");
+}
+
+/*
+ * Test: Kernel timer operations for a data mode upload
+ * - Command: AT#XSEND=<handle>,2,<flags>\r\n followed by a 1 KB burst of raw data
+ * - Tests: The inactivity timer is not restarted for every received byte
+ * - Expected: Data is sent once after the inactivity timeout, with a handful of timer operations
+ */
+void test_xsend_data_mode_timer_ops_per_kb(void)
+{
+	const char *response;
+	static uint8_t test_data[1024];
+	uint32_t ops;
+
+	memset(test_data, 'a', sizeof(test_data));
+
+	/* Create socket first */
+	__cmock_zsock_socket_ExpectAndReturn(AF_INET, SOCK_STREAM, IPPROTO_TCP, 1);
+	__cmock_zsock_setsockopt_ExpectAnyArgsAndReturn(0); /* SO_SNDTIMEO */
+	__cmock_zsock_setsockopt_ExpectAnyArgsAndReturn(0); /* SO_POLLCB */
+	send_at_command("AT#XSOCKET=1,1,0\r\n");
+	clear_captured_response();
+
+	/* Enter data mode: socket 1, mode 2 (data), flags 0, no data_len specified */
+	send_at_command("AT#XSEND=1,2,0\r\n");
+
+	response = get_captured_response();
+	TEST_ASSERT_TRUE(strstr(response, "OK") != NULL);
+	clear_captured_response();
+
+	/* The burst is sent when the inactivity timer expires */
+	__cmock_zsock_setsockopt_ExpectAnyArgsAndReturn(0); /* Clear/set send callback */
+	__cmock_zsock_send_ExpectAndReturn(1, test_data, sizeof(test_data), 0, sizeof(test_data));
+	__cmock_zsock_send_IgnoreArg_buf();
+
+	timer_ops = 0;
+	uart_stub_rx(test_data, sizeof(test_data));
+	ops = timer_ops;
+
+	printk("Data mode timer operations per KB: %u\n", ops);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(4, ops);
+
+	/* Exit data mode */
+	send_at_command("+++");
+	response = get_captured_response();
+	TEST_ASSERT_TRUE(strstr(response, "#XDATAMODE: 0") != NULL);
+
+	/* Close socket */
+	__cmock_zsock_close_ExpectAndReturn(1, 0);
+	send_at_command("AT#XCLOSE=1\r\n");
+}
+
 /*
  * Test: Send data via AT#XSENDTO with unformatted string
  * - Command: AT#XSENDTO=<handle>,<mode>,<flags>,"<url>",<port>,"<data>"\r\n
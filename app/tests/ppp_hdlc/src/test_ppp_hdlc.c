@@ -0,0 +1,619 @@
+/*
+ * Copyright (c) 2026 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/**
+ * @file test_ppp_hdlc.c
+ * Unit tests for the PPP re-framing and TCP/IP header compression of sm_ppp_hdlc.c
+ */
+
+#include <zephyr/ztest.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The re-framing functions are static. */
+#include "sm_ppp_hdlc.c"
+
+#if !defined(CONFIG_SM_PPP_HDLC_VJ)
+#define PPP_PROTO_IP   0x0021
+#define PPP_PROTO_IPCP 0x8021
+#endif
+#define CP_TERM_REQ    5
+#define FRAME_MAX      128
+
+static struct ppp_hdlc *const hdlc = &ppp_hdlcs[0];
+
+static uint8_t frame_buf[2 * FRAME_MAX];
+static uint8_t out_buf[FRAME_MAX];
+
+/* Payload with every control character and the flag and escape bytes */
+static uint8_t payload[0x20 + 4];
+
+static void put_escaped(uint8_t *buf, size_t *len, uint8_t byte)
+{
+	if (byte == HDLC_FLAG || byte == HDLC_ESCAPE || byte < 0x20) {
+		buf[(*len)++] = HDLC_ESCAPE;
+		byte ^= HDLC_ESCAPE_XOR;
+	}
+	buf[(*len)++] = byte;
+}
+
+/* Frame a packet with the default options, as the PPP module does. Returns the length. */
+static size_t frame_default(uint16_t protocol, const uint8_t *data, size_t len)
+{
+	uint8_t frame[FRAME_MAX];
+	size_t frame_len = 0;
+	size_t out = 0;
+	uint16_t fcs;
+
+	frame[frame_len++] = HDLC_ADDRESS;
+	frame[frame_len++] = HDLC_CONTROL;
+	sys_put_be16(protocol, &frame[frame_len]);
+	frame_len += 2;
+	memcpy(&frame[frame_len], data, len);
+	frame_len += len;
+	fcs = crc16_ccitt(HDLC_FCS_INIT, frame, frame_len) ^ 0xffff;
+	sys_put_le16(fcs, &frame[frame_len]);
+	frame_len += HDLC_FCS_LEN;
+
+	frame_buf[out++] = HDLC_FLAG;
+	for (size_t i = 0; i != frame_len; ++i) {
+		put_escaped(frame_buf, &out, frame[i]);
+	}
+	frame_buf[out++] = HDLC_FLAG;
+	return out;
+}
+
+/* Pass a framed packet through the re-framer. */
+static void reframe(size_t len)
+{
+	hdlc->tx.out_len = 0;
+	for (size_t i = 0; i != len; ++i) {
+		tx_byte(hdlc, frame_buf[i]);
+	}
+}
+
+/* Take a frame, check that it is escaped as the ACCM asks and that its FCS is good.
+ * Returns the length of the frame in out_buf without the FCS.
+ */
+static size_t unframe_buf(const uint8_t *out, size_t out_len, uint32_t accm)
+{
+	size_t len = 0;
+	bool escape = false;
+
+	zassert_true(out_len >= 2, "%zu bytes sent", out_len);
+	zassert_equal(out[0], HDLC_FLAG);
+	zassert_equal(out[out_len - 1], HDLC_FLAG);
+
+	for (size_t i = 1; i != out_len - 1; ++i) {
+		uint8_t byte = out[i];
+
+		zassert_not_equal(byte, HDLC_FLAG, "Flag in the frame at %zu", i);
+		if (byte == HDLC_ESCAPE) {
+			zassert_false(escape);
+			escape = true;
+			continue;
+		}
+		if (escape) {
+			byte ^= HDLC_ESCAPE_XOR;
+			escape = false;
+			zassert_true(byte == HDLC_FLAG || byte == HDLC_ESCAPE ||
+				     (byte < 0x20 && (accm & BIT(byte))),
+				     "0x%02x escaped with ACCM 0x%08x", byte, accm);
+		} else {
+			zassert_false(byte < 0x20 && (accm & BIT(byte)),
+				      "0x%02x not escaped with ACCM 0x%08x", byte, accm);
+		}
+		zassert_true(len < sizeof(out_buf));
+		out_buf[len++] = byte;
+	}
+	zassert_false(escape);
+	zassert_true(len >= HDLC_FCS_LEN);
+	zassert_equal(crc16_ccitt(HDLC_FCS_INIT, out_buf, len), HDLC_FCS_GOOD, "Bad FCS");
+	return len - HDLC_FCS_LEN;
+}
+
+/* Take the frame sent by the re-framer. */
+static size_t unframe(uint32_t accm)
+{
+	return unframe_buf(hdlc->tx.out, hdlc->tx.out_len, accm);
+}
+
+/* Send an LCP Configure-Ack with the given options and check that it is sent as is. */
+static void lcp_ack(const uint8_t *opts, size_t opts_len)
+{
+	uint8_t lcp[CP_HDR_LEN + 32] = { CP_CONFIGURE_ACK, 1 };
+	size_t len;
+
+	memcpy(&lcp[CP_HDR_LEN], opts, opts_len);
+	sys_put_be16(CP_HDR_LEN + opts_len, &lcp[2]);
+	len = frame_default(PPP_PROTO_LCP, lcp, CP_HDR_LEN + opts_len);
+	reframe(len);
+	zassert_equal(hdlc->tx.out_len, len);
+	zassert_mem_equal(hdlc->tx.out, frame_buf, len);
+}
+
+static void lcp_ack_all(uint32_t accm)
+{
+	uint8_t opts[] = { LCP_OPT_ACCM, 6, 0, 0, 0, 0, LCP_OPT_PFC, 2, LCP_OPT_ACFC, 2 };
+
+	sys_put_be32(accm, &opts[2]);
+	lcp_ack(opts, sizeof(opts));
+	zassert_equal(hdlc->accm, accm);
+	zassert_true(hdlc->acfc);
+	zassert_true(hdlc->pfc);
+}
+
+ZTEST(ppp_hdlc, test_default_options)
+{
+	size_t len = frame_default(PPP_PROTO_IP, payload, sizeof(payload));
+
+	/* Without options, the frames are sent as the PPP module framed them. */
+	reframe(len);
+	zassert_equal(hdlc->tx.out_len, len);
+	zassert_mem_equal(hdlc->tx.out, frame_buf, len);
+}
+
+ZTEST(ppp_hdlc, test_all_options)
+{
+	size_t len;
+
+	lcp_ack_all(0);
+
+	reframe(frame_default(PPP_PROTO_IP, payload, sizeof(payload)));
+	len = unframe(0);
+	/* No address and control fields, one byte protocol */
+	zassert_equal(len, 1 + sizeof(payload));
+	zassert_equal(out_buf[0], PPP_PROTO_IP);
+	zassert_mem_equal(&out_buf[1], payload, sizeof(payload));
+
+	/* A protocol that cannot be compressed keeps both bytes. */
+	reframe(frame_default(PPP_PROTO_IPCP, payload, sizeof(payload)));
+	len = unframe(0);
+	zassert_equal(len, 2 + sizeof(payload));
+	zassert_equal(sys_get_be16(out_buf), PPP_PROTO_IPCP);
+	zassert_mem_equal(&out_buf[2], payload, sizeof(payload));
+}
+
+ZTEST(ppp_hdlc, test_partial_accm)
+{
+	const uint32_t accm = BIT(0x11) | BIT(0x13);
+	const uint8_t opts[] = { LCP_OPT_ACCM, 6, 0x00, 0x0a, 0x00, 0x00 };
+	size_t len;
+
+	lcp_ack(opts, sizeof(opts));
+	zassert_equal(hdlc->accm, accm);
+	zassert_false(hdlc->acfc);
+	zassert_false(hdlc->pfc);
+
+	reframe(frame_default(PPP_PROTO_IP, payload, sizeof(payload)));
+	len = unframe(accm);
+	zassert_equal(len, HDLC_HDR_LEN + sizeof(payload));
+	zassert_equal(out_buf[0], HDLC_ADDRESS);
+	zassert_equal(out_buf[1], HDLC_CONTROL);
+	zassert_equal(sys_get_be16(&out_buf[2]), PPP_PROTO_IP);
+	zassert_mem_equal(&out_buf[HDLC_HDR_LEN], payload, sizeof(payload));
+}
+
+ZTEST(ppp_hdlc, test_lcp_default_options)
+{
+	const uint8_t term[] = { CP_TERM_REQ, 2, 0, CP_HDR_LEN };
+	size_t len;
+
+	lcp_ack_all(0);
+
+	/* LCP is always sent with the default options. */
+	len = frame_default(PPP_PROTO_LCP, term, sizeof(term));
+	reframe(len);
+	zassert_equal(hdlc->tx.out_len, len);
+	zassert_mem_equal(hdlc->tx.out, frame_buf, len);
+
+	/* And a Terminate-Request takes them back. */
+	zassert_equal(hdlc->accm, HDLC_ACCM_DEFAULT);
+	zassert_false(hdlc->acfc);
+	zassert_false(hdlc->pfc);
+}
+
+ZTEST(ppp_hdlc, test_invalid_lcp_options)
+{
+	/* An option running past the end of the packet */
+	const uint8_t opts[] = { LCP_OPT_PFC, 2, LCP_OPT_ACCM, 8, 0, 0 };
+
+	lcp_ack_all(0);
+	lcp_ack(opts, sizeof(opts));
+	zassert_equal(hdlc->accm, HDLC_ACCM_DEFAULT);
+	zassert_false(hdlc->acfc);
+	zassert_false(hdlc->pfc);
+}
+
+ZTEST(ppp_hdlc, test_frames_in_a_row)
+{
+	size_t out_len;
+	size_t len;
+
+	lcp_ack_all(0);
+	len = frame_default(PPP_PROTO_IP, payload, sizeof(payload));
+	reframe(len);
+	out_len = hdlc->tx.out_len;
+
+	/* Frames sharing a flag, as the PPP module sends them, are sent with flags of their own. */
+	memmove(&frame_buf[len - 1], frame_buf, len);
+	reframe(2 * len - 1);
+	zassert_equal(hdlc->tx.out_len, 2 * out_len);
+	zassert_mem_equal(hdlc->tx.out, &hdlc->tx.out[out_len], out_len);
+	hdlc->tx.out_len = out_len;
+	zassert_equal(unframe(0), 1 + sizeof(payload));
+	zassert_mem_equal(&out_buf[1], payload, sizeof(payload));
+}
+
+static void ppp_hdlc_before(void *fixture)
+{
+	ARG_UNUSED(fixture);
+
+	for (size_t i = 0; i != sizeof(payload) - 4; ++i) {
+		payload[i] = i;
+	}
+	payload[0x20] = HDLC_FLAG;
+	payload[0x21] = HDLC_ESCAPE;
+	payload[0x22] = HDLC_ADDRESS;
+	payload[0x23] = 'A';
+
+	hdlc_options_reset(hdlc);
+	hdlc->tx.state = TX_IDLE;
+	hdlc->tx.out_len = 0;
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+	hdlc->rx.pass = false;
+	hdlc->rx.carry_len = 0;
+#endif
+}
+
+ZTEST_SUITE(ppp_hdlc, NULL, NULL, ppp_hdlc_before, NULL, NULL);
+
+#if defined(CONFIG_SM_PPP_HDLC_VJ)
+#define CP_CONFIGURE_REQ_LEN (CP_HDR_LEN + 2 * VJ_OPT_LEN)
+#define IPCP_OPT_ADDR        3
+#define TCP_HDR_LEN          40
+#define TCP_CHECKSUM         0xabcd
+
+static const uint8_t ipcp_addr_opt[] = { IPCP_OPT_ADDR, 6, 10, 0, 0, 1 };
+/* 16 slots, connection number may be left out */
+static const uint8_t ipcp_vj_opt[] = { IPCP_OPT_COMP, VJ_OPT_LEN, 0x00, 0x2d, 15, 1 };
+
+static uint8_t pkt[FRAME_MAX];
+static uint8_t chdr[VJ_COMP_HDR_MAX];
+static size_t chdr_len;
+
+/* Pass an IPCP Configure-Request of the host through the receive filter, and check that
+ * the PPP module gets it without the IP-Compression-Protocol option.
+ */
+static void ipcp_request(uint8_t id, bool vj)
+{
+	uint8_t ipcp[CP_CONFIGURE_REQ_LEN] = { CP_CONFIGURE_REQ, id };
+	size_t ipcp_len = CP_HDR_LEN;
+	size_t len;
+	size_t out;
+
+	memcpy(&ipcp[ipcp_len], ipcp_addr_opt, sizeof(ipcp_addr_opt));
+	ipcp_len += sizeof(ipcp_addr_opt);
+	if (vj) {
+		memcpy(&ipcp[ipcp_len], ipcp_vj_opt, sizeof(ipcp_vj_opt));
+		ipcp_len += sizeof(ipcp_vj_opt);
+	}
+	sys_put_be16(ipcp_len, &ipcp[2]);
+	len = frame_default(PPP_PROTO_IPCP, ipcp, ipcp_len);
+	memcpy(pkt, frame_buf, len);
+
+	out = rx_filter(hdlc, frame_buf, len);
+	zassert_equal(hdlc->rx.carry_len, 0);
+	if (!vj) {
+		zassert_equal(out, len);
+		zassert_mem_equal(frame_buf, pkt, len);
+		return;
+	}
+	/* The control characters are no longer escaped. */
+	zassert_equal(unframe_buf(frame_buf, out, 0), HDLC_HDR_LEN + CP_HDR_LEN + 6);
+	zassert_equal(sys_get_be16(&out_buf[2]), PPP_PROTO_IPCP);
+	zassert_equal(out_buf[HDLC_HDR_LEN], CP_CONFIGURE_REQ);
+	zassert_equal(out_buf[HDLC_HDR_LEN + 1], id);
+	zassert_equal(sys_get_be16(&out_buf[HDLC_HDR_LEN + 2]), CP_HDR_LEN + 6);
+	zassert_mem_equal(&out_buf[HDLC_HDR_LEN + CP_HDR_LEN], ipcp_addr_opt, 6);
+}
+
+/* Send an IPCP packet with the address option from the PPP module. Returns the length of
+ * the IPCP packet sent to the host, which is in out_buf after the header.
+ */
+static size_t ipcp_send(uint8_t code, uint8_t id)
+{
+	uint8_t ipcp[CP_HDR_LEN + sizeof(ipcp_addr_opt)] = { code, id };
+	size_t len;
+
+	memcpy(&ipcp[CP_HDR_LEN], ipcp_addr_opt, sizeof(ipcp_addr_opt));
+	sys_put_be16(sizeof(ipcp), &ipcp[2]);
+	reframe(frame_default(PPP_PROTO_IPCP, ipcp, sizeof(ipcp)));
+	len = unframe(HDLC_ACCM_DEFAULT);
+	zassert_true(len >= HDLC_HDR_LEN + CP_HDR_LEN);
+	zassert_equal(sys_get_be16(&out_buf[2]), PPP_PROTO_IPCP);
+	zassert_equal(out_buf[HDLC_HDR_LEN], code);
+	zassert_equal(out_buf[HDLC_HDR_LEN + 1], id);
+	zassert_equal(sys_get_be16(&out_buf[HDLC_HDR_LEN + 2]), len - HDLC_HDR_LEN);
+	zassert_mem_equal(&out_buf[HDLC_HDR_LEN + CP_HDR_LEN], ipcp_addr_opt, 6);
+	return len - HDLC_HDR_LEN;
+}
+
+static void vj_negotiate(void)
+{
+	ipcp_request(1, true);
+	zassert_equal(ipcp_send(CP_CONFIGURE_ACK, 1), CP_HDR_LEN + 12);
+	zassert_mem_equal(&out_buf[HDLC_HDR_LEN + CP_HDR_LEN + 6], ipcp_vj_opt, VJ_OPT_LEN);
+	zassert_true(hdlc->vj.on);
+	zassert_equal(hdlc->vj.slot_count, VJ_SLOT_COUNT);
+	zassert_true(hdlc->vj.comp_slot);
+}
+
+/* Build the TCP/IP headers of a packet, followed by its data. */
+static void tcp_pkt(uint16_t port, uint16_t id, uint32_t seq, uint32_t ack, size_t data_len,
+		    uint8_t flags)
+{
+	uint8_t *th = &pkt[20];
+
+	memset(pkt, 0, sizeof(pkt));
+	pkt[0] = 0x45;
+	sys_put_be16(TCP_HDR_LEN + data_len, &pkt[2]);
+	sys_put_be16(id, &pkt[4]);
+	pkt[8] = 64;
+	pkt[9] = IP_PROTO_TCP;
+	sys_put_be32(0x0a000001, &pkt[12]);
+	sys_put_be32(0x0a000002, &pkt[16]);
+	sys_put_be16(port, &th[0]);
+	sys_put_be16(80, &th[2]);
+	sys_put_be32(seq, &th[4]);
+	sys_put_be32(ack, &th[8]);
+	th[12] = 5 << 4;
+	th[13] = flags;
+	sys_put_be16(1000, &th[14]);
+	sys_put_be16(TCP_CHECKSUM, &th[16]);
+	memset(&pkt[TCP_HDR_LEN], 'D', MIN(data_len, sizeof(pkt) - TCP_HDR_LEN));
+}
+
+static uint16_t compress(void)
+{
+	return vj_compress(hdlc, pkt, TCP_HDR_LEN, chdr, &chdr_len);
+}
+
+static void check_chdr(const uint8_t *expected, size_t len)
+{
+	zassert_equal(chdr_len, len, "%zu bytes of compressed header", chdr_len);
+	zassert_mem_equal(chdr, expected, len);
+}
+
+ZTEST(ppp_hdlc_vj, test_ipcp_ack)
+{
+	vj_negotiate();
+
+	/* A Terminate-Request turns the compression off. */
+	zassert_equal(ipcp_send(CP_TERMINATE_REQ, 2), CP_HDR_LEN + 6);
+	zassert_false(hdlc->vj.on);
+}
+
+ZTEST(ppp_hdlc_vj, test_ipcp_nak)
+{
+	ipcp_request(1, true);
+
+	/* The Configure-Nak is sent as is, and the request is forgotten. */
+	zassert_equal(ipcp_send(CP_CONFIGURE_NAK, 1), CP_HDR_LEN + 6);
+	zassert_false(hdlc->vj.on);
+	zassert_false(hdlc->vj.req_valid);
+	zassert_equal(ipcp_send(CP_CONFIGURE_ACK, 1), CP_HDR_LEN + 6);
+	zassert_false(hdlc->vj.on);
+
+	/* The next request is acknowledged with the option. */
+	ipcp_request(2, true);
+	zassert_equal(ipcp_send(CP_CONFIGURE_ACK, 2), CP_HDR_LEN + 12);
+	zassert_true(hdlc->vj.on);
+}
+
+ZTEST(ppp_hdlc_vj, test_ipcp_reject)
+{
+	vj_negotiate();
+
+	/* A new request turns the compression off until it is acknowledged. */
+	ipcp_request(2, true);
+	zassert_equal(ipcp_send(CP_CONFIGURE_REJ, 2), CP_HDR_LEN + 6);
+	zassert_false(hdlc->vj.on);
+
+	/* A Configure-Nak that is not for the last request is left alone. */
+	ipcp_request(3, false);
+	zassert_equal(ipcp_send(CP_CONFIGURE_NAK, 2), CP_HDR_LEN + 6);
+	zassert_true(hdlc->vj.req_valid);
+
+	/* The host no longer asks for the compression. */
+	zassert_equal(ipcp_send(CP_CONFIGURE_ACK, 3), CP_HDR_LEN + 6);
+	zassert_false(hdlc->vj.on);
+}
+
+ZTEST(ppp_hdlc_vj, test_ipcp_request_split)
+{
+	uint8_t ipcp[CP_CONFIGURE_REQ_LEN] = { CP_CONFIGURE_REQ, 1, 0, CP_CONFIGURE_REQ_LEN };
+	size_t half;
+	size_t len;
+	size_t out;
+
+	memcpy(&ipcp[CP_HDR_LEN], ipcp_addr_opt, sizeof(ipcp_addr_opt));
+	memcpy(&ipcp[CP_HDR_LEN + 6], ipcp_vj_opt, sizeof(ipcp_vj_opt));
+	len = frame_default(PPP_PROTO_IPCP, ipcp, sizeof(ipcp));
+	half = len / 2;
+
+	/* Only the opening flag is passed, the start of the frame is carried over. */
+	zassert_equal(rx_filter(hdlc, frame_buf, half), 1);
+	zassert_equal(hdlc->rx.carry_len, half - 1);
+	zassert_mem_equal(hdlc->rx.carry, &frame_buf[1], half - 1);
+
+	/* It is taken again in front of the rest, as rx_receive() does. */
+	hdlc->rx.carry_len = 0;
+	out = rx_filter(hdlc, &frame_buf[1], len - 1);
+	zassert_equal(unframe_buf(frame_buf, 1 + out, 0), HDLC_HDR_LEN + CP_HDR_LEN + 6);
+	zassert_true(hdlc->vj.req_vj);
+}
+
+ZTEST(ppp_hdlc_vj, test_vj_special_d)
+{
+	const uint8_t expected[] = { VJ_SPECIAL_D, 0xab, 0xcd };
+
+	vj_negotiate();
+	tcp_pkt(1000, 1, 100, 500, 100, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+	zassert_equal(pkt[9], 0);
+
+	/* Unidirectional data: the sequence number moves by the length of the last data. */
+	tcp_pkt(1000, 2, 200, 500, 100, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_COMP);
+	check_chdr(expected, sizeof(expected));
+}
+
+ZTEST(ppp_hdlc_vj, test_vj_special_i)
+{
+	const uint8_t expected[] = { VJ_SPECIAL_I | VJ_PUSH, 0xab, 0xcd };
+
+	vj_negotiate();
+	tcp_pkt(1000, 1, 100, 500, 10, TCP_ACK | TCP_PSH);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+
+	/* Interactive traffic: both numbers move by the length of the last data. */
+	tcp_pkt(1000, 2, 110, 510, 10, TCP_ACK | TCP_PSH);
+	zassert_equal(compress(), PPP_PROTO_VJ_COMP);
+	check_chdr(expected, sizeof(expected));
+}
+
+ZTEST(ppp_hdlc_vj, test_vj_new_i)
+{
+	const uint8_t expected_ack[] = { VJ_NEW_A | VJ_NEW_I, 0xab, 0xcd, 100, 3 };
+	const uint8_t expected_seq[] = { VJ_NEW_S, 0xab, 0xcd, 0, 0x01, 0x2c };
+	const uint8_t expected_same_id[] = { VJ_NEW_A | VJ_NEW_I, 0xab, 0xcd, 1, 0, 0, 0 };
+
+	vj_negotiate();
+	tcp_pkt(1000, 1, 100, 500, 0, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+
+	/* The IP ID is sent when it does not move by one. */
+	tcp_pkt(1000, 4, 100, 600, 0, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_COMP);
+	check_chdr(expected_ack, sizeof(expected_ack));
+
+	/* Deltas of 256 or more take three bytes. */
+	tcp_pkt(1000, 5, 400, 600, 0, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_COMP);
+	check_chdr(expected_seq, sizeof(expected_seq));
+
+	/* And so does an ID delta of zero. */
+	tcp_pkt(1000, 5, 400, 601, 0, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_COMP);
+	check_chdr(expected_same_id, sizeof(expected_same_id));
+}
+
+ZTEST(ppp_hdlc_vj, test_vj_uncompressed)
+{
+	vj_negotiate();
+
+	/* Packets that are never compressed */
+	tcp_pkt(1000, 1, 100, 500, 0, TCP_SYN | TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_IP);
+	zassert_equal(pkt[9], IP_PROTO_TCP);
+	tcp_pkt(1000, 1, 100, 500, 0, TCP_ACK);
+	sys_put_be16(0x2000, &pkt[6]);
+	zassert_equal(compress(), PPP_PROTO_IP);
+
+	tcp_pkt(1000, 1, 100, 500, 10, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+
+	/* A retransmission */
+	tcp_pkt(1000, 2, 100, 500, 10, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+
+	/* A field that is not sent as a delta changes. */
+	tcp_pkt(1000, 3, 110, 500, 10, TCP_ACK);
+	pkt[8] = 63;
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+
+	/* A sequence number jump too large for a delta */
+	tcp_pkt(1000, 4, 0x20000, 500, 10, TCP_ACK);
+	pkt[8] = 63;
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+
+	/* Changes that would be taken for SPECIAL_D */
+	tcp_pkt(1000, 5, 0x20010, 501, 10, TCP_ACK | TCP_URG);
+	pkt[8] = 63;
+	sys_put_be16(2000, &pkt[34]);
+	sys_put_be16(1, &pkt[38]);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+	zassert_equal(pkt[9], 0);
+}
+
+ZTEST(ppp_hdlc_vj, test_vj_slot_reuse)
+{
+	uint8_t expected[] = { VJ_NEW_C | VJ_SPECIAL_D, 0, 0xab, 0xcd };
+
+	vj_negotiate();
+
+	/* Four connections take the four slots. */
+	for (uint16_t i = 0; i != VJ_SLOT_COUNT; ++i) {
+		tcp_pkt(1000 + i, 1, 100, 500, 10, TCP_ACK);
+		zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+		zassert_equal(pkt[9], i);
+	}
+	/* All but the first one are used again, with their connection number. */
+	for (uint16_t i = 1; i != VJ_SLOT_COUNT; ++i) {
+		tcp_pkt(1000 + i, 2, 110, 500, 10, TCP_ACK);
+		zassert_equal(compress(), PPP_PROTO_VJ_COMP);
+		expected[1] = i;
+		check_chdr(expected, sizeof(expected));
+	}
+
+	/* A new connection takes the least recently used slot... */
+	tcp_pkt(2000, 1, 100, 500, 10, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+	zassert_equal(pkt[9], 0);
+
+	/* ...and the connection that was in it has to start again. */
+	tcp_pkt(1000, 2, 110, 500, 10, TCP_ACK);
+	zassert_equal(compress(), PPP_PROTO_VJ_UNCOMP);
+	zassert_equal(pkt[9], 1);
+}
+
+ZTEST(ppp_hdlc_vj, test_vj_frames)
+{
+	const size_t data_len = 16;
+	size_t len;
+
+	vj_negotiate();
+
+	/* The first packet of a connection is sent with its connection number. */
+	tcp_pkt(1000, 1, 100, 500, data_len, TCP_ACK);
+	reframe(frame_default(PPP_PROTO_IP, pkt, TCP_HDR_LEN + data_len));
+	len = unframe(HDLC_ACCM_DEFAULT);
+	zassert_equal(len, HDLC_HDR_LEN + TCP_HDR_LEN + data_len);
+	zassert_equal(sys_get_be16(&out_buf[2]), PPP_PROTO_VJ_UNCOMP);
+	pkt[9] = 0;
+	zassert_mem_equal(&out_buf[HDLC_HDR_LEN], pkt, TCP_HDR_LEN + data_len);
+
+	/* The next ones with compressed headers */
+	tcp_pkt(1000, 2, 100 + data_len, 500, data_len, TCP_ACK);
+	reframe(frame_default(PPP_PROTO_IP, pkt, TCP_HDR_LEN + data_len));
+	len = unframe(HDLC_ACCM_DEFAULT);
+	zassert_equal(len, HDLC_HDR_LEN + 3 + data_len);
+	zassert_equal(sys_get_be16(&out_buf[2]), PPP_PROTO_VJ_COMP);
+	zassert_equal(out_buf[HDLC_HDR_LEN], VJ_SPECIAL_D);
+	zassert_equal(sys_get_be16(&out_buf[HDLC_HDR_LEN + 1]), TCP_CHECKSUM);
+	zassert_mem_equal(&out_buf[HDLC_HDR_LEN + 3], &pkt[TCP_HDR_LEN], data_len);
+
+	/* Other IP packets are sent as is. */
+	pkt[9] = 17;
+	reframe(frame_default(PPP_PROTO_IP, pkt, TCP_HDR_LEN + data_len));
+	len = unframe(HDLC_ACCM_DEFAULT);
+	zassert_equal(sys_get_be16(&out_buf[2]), PPP_PROTO_IP);
+	zassert_mem_equal(&out_buf[HDLC_HDR_LEN], pkt, TCP_HDR_LEN + data_len);
+}
+
+ZTEST_SUITE(ppp_hdlc_vj, NULL, NULL, ppp_hdlc_before, NULL, NULL);
+#endif
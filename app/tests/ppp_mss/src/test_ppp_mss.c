@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2026 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/**
+ * @file test_ppp_mss.c
+ * Unit tests for the TCP MSS clamping of sm_ppp_mss.c
+ */
+
+#include <zephyr/ztest.h>
+#include <zephyr/sys/byteorder.h>
+#include <stdint.h>
+#include <string.h>
+#include "sm_ppp_mss.h"
+
+#define IPV4_MTU     1280
+#define IPV6_MTU     1400
+#define TCP_SYN      0x02
+#define TCP_ACK      0x10
+#define TCP_OPT_NOP  1
+#define TCP_OPT_MSS  2
+#define PROTO_TCP    6
+#define MSS          1460
+
+static uint8_t pkt[128];
+static size_t pkt_len;
+static size_t ip_hdr_len;
+
+static uint32_t csum_add(uint32_t sum, const uint8_t *data, size_t len)
+{
+	for (size_t i = 0; i < len; i += 2) {
+		sum += (data[i] << 8) | ((i + 1 < len) ? data[i + 1] : 0);
+	}
+	return sum;
+}
+
+/* Returns the TCP checksum of the packet, 0 when the checksum field is right. */
+static uint16_t tcp_csum(void)
+{
+	const size_t tcp_len = pkt_len - ip_hdr_len;
+	uint32_t sum = PROTO_TCP + tcp_len;
+
+	if ((pkt[0] >> 4) == 4) {
+		sum = csum_add(sum, &pkt[12], 8);
+	} else {
+		sum = csum_add(sum, &pkt[8], 32);
+	}
+	sum = csum_add(sum, &pkt[ip_hdr_len], tcp_len);
+	while (sum >> 16) {
+		sum = (sum & 0xffff) + (sum >> 16);
+	}
+	return ~sum;
+}
+
+/* Build a TCP packet with an MSS option after nop_count NOP options. */
+static void tcp_pkt(int ip_version, size_t ip_opt_len, uint8_t flags, size_t nop_count)
+{
+	uint8_t *tcp;
+	size_t tcp_len = 20 + ROUND_UP(nop_count + 4, 4);
+
+	memset(pkt, 0, sizeof(pkt));
+	if (ip_version == 4) {
+		ip_hdr_len = 20 + ip_opt_len;
+		pkt[0] = 0x40 | (ip_hdr_len / 4);
+		pkt[9] = PROTO_TCP;
+		sys_put_be32(0x0a000001, &pkt[12]);
+		sys_put_be32(0xc0a80102, &pkt[16]);
+		/* IP options, such as a router alert */
+		memset(&pkt[20], TCP_OPT_NOP, ip_opt_len);
+	} else {
+		ip_hdr_len = 40;
+		pkt[0] = 0x60;
+		pkt[6] = PROTO_TCP;
+		for (size_t i = 8; i != 40; ++i) {
+			pkt[i] = i * 7;
+		}
+	}
+	pkt_len = ip_hdr_len + tcp_len;
+
+	tcp = &pkt[ip_hdr_len];
+	sys_put_be16(49152, &tcp[0]);
+	sys_put_be16(443, &tcp[2]);
+	sys_put_be32(0x12345678, &tcp[4]);
+	tcp[12] = (tcp_len / 4) << 4;
+	tcp[13] = flags;
+	sys_put_be16(65535, &tcp[14]);
+	memset(&tcp[20], TCP_OPT_NOP, tcp_len - 20);
+	tcp[20 + nop_count] = TCP_OPT_MSS;
+	tcp[20 + nop_count + 1] = 4;
+	sys_put_be16(MSS, &tcp[20 + nop_count + 2]);
+
+	sys_put_be16(tcp_csum(), &tcp[16]);
+	zassert_equal(tcp_csum(), 0);
+}
+
+static uint16_t mss_get(size_t nop_count)
+{
+	return sys_get_be16(&pkt[ip_hdr_len + 20 + nop_count + 2]);
+}
+
+static void clamp(void)
+{
+	sm_ppp_mss_clamp(pkt, pkt_len, IPV4_MTU, IPV6_MTU);
+}
+
+ZTEST(ppp_mss, test_ipv4_syn)
+{
+	tcp_pkt(4, 0, TCP_SYN, 0);
+	clamp();
+	zassert_equal(mss_get(0), IPV4_MTU - 40);
+	zassert_equal(tcp_csum(), 0);
+
+	/* A SYN-ACK as well */
+	tcp_pkt(4, 0, TCP_SYN | TCP_ACK, 0);
+	clamp();
+	zassert_equal(mss_get(0), IPV4_MTU - 40);
+	zassert_equal(tcp_csum(), 0);
+}
+
+ZTEST(ppp_mss, test_odd_offset)
+{
+	/* The option spans two checksum words. */
+	for (size_t nop_count = 1; nop_count != 4; ++nop_count) {
+		tcp_pkt(4, 0, TCP_SYN, nop_count);
+		clamp();
+		zassert_equal(mss_get(nop_count), IPV4_MTU - 40, "%zu NOPs", nop_count);
+		zassert_equal(tcp_csum(), 0, "%zu NOPs", nop_count);
+	}
+}
+
+ZTEST(ppp_mss, test_ipv4_options)
+{
+	/* The MSS leaves out the IP options. */
+	tcp_pkt(4, 4, TCP_SYN, 0);
+	clamp();
+	zassert_equal(mss_get(0), IPV4_MTU - 40);
+	zassert_equal(tcp_csum(), 0);
+}
+
+ZTEST(ppp_mss, test_ipv6_syn)
+{
+	tcp_pkt(6, 0, TCP_SYN, 1);
+	clamp();
+	zassert_equal(mss_get(1), IPV6_MTU - 60);
+	zassert_equal(tcp_csum(), 0);
+
+	/* Extension headers before TCP */
+	tcp_pkt(6, 0, TCP_SYN, 0);
+	pkt[6] = 0;
+	clamp();
+	zassert_equal(mss_get(0), MSS);
+}
+
+ZTEST(ppp_mss, test_not_clamped)
+{
+	/* Not a SYN */
+	tcp_pkt(4, 0, TCP_ACK, 0);
+	clamp();
+	zassert_equal(mss_get(0), MSS);
+	zassert_equal(tcp_csum(), 0);
+
+	/* Already small enough */
+	tcp_pkt(4, 0, TCP_SYN, 0);
+	sm_ppp_mss_clamp(pkt, pkt_len, MSS + 40, IPV6_MTU);
+	zassert_equal(mss_get(0), MSS);
+	zassert_equal(tcp_csum(), 0);
+
+	/* Options cut short */
+	tcp_pkt(4, 0, TCP_SYN, 0);
+	sm_ppp_mss_clamp(pkt, pkt_len - 2, IPV4_MTU, IPV6_MTU);
+	zassert_equal(mss_get(0), MSS);
+
+	/* Not TCP */
+	tcp_pkt(4, 0, TCP_SYN, 0);
+	pkt[9] = 17;
+	clamp();
+	zassert_equal(mss_get(0), MSS);
+}
+
+ZTEST(ppp_mss, test_fragments)
+{
+	/* The first fragment carries the TCP header. */
+	tcp_pkt(4, 0, TCP_SYN, 0);
+	sys_put_be16(0x2000, &pkt[6]);
+	clamp();
+	zassert_equal(mss_get(0), IPV4_MTU - 40);
+	zassert_equal(tcp_csum(), 0);
+
+	/* The other ones do not. */
+	tcp_pkt(4, 0, TCP_SYN, 0);
+	sys_put_be16(0x2001, &pkt[6]);
+	clamp();
+	zassert_equal(mss_get(0), MSS);
+}
+
+ZTEST_SUITE(ppp_mss, NULL, NULL, NULL, NULL, NULL);
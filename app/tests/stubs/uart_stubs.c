@@ -62,6 +62,25 @@ static int pipe_receive(void *data, uint8_t *buf, size_t size)
 	return ring_buf_get(&uart_rx_ring_buf, buf, size);
 }
 
+int sm_uart_pipe_rx_claim(const uint8_t **data, size_t max_len)
+{
+	return ring_buf_get_claim(&uart_rx_ring_buf, (uint8_t **)data, max_len);
+}
+
+void sm_uart_pipe_rx_release(size_t len)
+{
+	ring_buf_get_finish(&uart_rx_ring_buf, len);
+}
+
+int sm_uart_pipe_tx_wait(k_timeout_t timeout)
+{
+	return 0;
+}
+
+void sm_uart_rx_fc_mode_update(void)
+{
+}
+
 static int pipe_close(void *data)
 {
 	struct modem_pipe *pipe = (struct modem_pipe *)data;
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2026 Nordic Semiconductor ASA
+ *
+ * SPDX-License-Identifier: LicenseRef-Nordic-5-Clause
+ */
+
+/**
+ * @file test_trace_compress.c
+ * Unit tests for the LZ4 compression of sm_trace_backend_cmux.c
+ */
+
+#include <zephyr/ztest.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The compression functions are static. */
+#include "sm_trace_backend_cmux.c"
+
+static uint8_t src_buf[BLOCK_SIZE];
+static uint8_t lz4_buf[LZ4_BOUND(BLOCK_SIZE)];
+static uint8_t out_buf[BLOCK_SIZE];
+
+/* Decompress an LZ4 block and check that the end of block rules are followed.
+ * Returns the decompressed length, or -1 if the block is invalid.
+ */
+static int lz4_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size)
+{
+	size_t last_match_start = 0;
+	size_t last_match_end = 0;
+	size_t ip = 0;
+	size_t op = 0;
+
+	while (ip < len) {
+		const uint8_t token = src[ip++];
+		size_t lit_len = token >> 4;
+		size_t match_len = token & 0x0F;
+		size_t offset;
+		uint8_t byte;
+
+		if (lit_len == 15) {
+			do {
+				if (ip >= len) {
+					return -1;
+				}
+				byte = src[ip++];
+				lit_len += byte;
+			} while (byte == 255);
+		}
+		if (lit_len > len - ip || lit_len > size - op) {
+			return -1;
+		}
+		memcpy(&dst[op], &src[ip], lit_len);
+		ip += lit_len;
+		op += lit_len;
+		if (ip == len) {
+			break;
+		}
+
+		if (len - ip < 2) {
+			return -1;
+		}
+		offset = sys_get_le16(&src[ip]);
+		ip += 2;
+		if (offset == 0 || offset > op) {
+			return -1;
+		}
+		if (match_len == 15) {
+			do {
+				if (ip >= len) {
+					return -1;
+				}
+				byte = src[ip++];
+				match_len += byte;
+			} while (byte == 255);
+		}
+		match_len += LZ4_MIN_MATCH;
+		if (match_len > size - op) {
+			return -1;
+		}
+		last_match_start = op;
+		/* Byte by byte, as the match may overlap the output. */
+		for (size_t i = 0; i != match_len; ++i, ++op) {
+			dst[op] = dst[op - offset];
+		}
+		last_match_end = op;
+	}
+
+	if (last_match_end && (last_match_start + LZ4_MF_LIMIT > op ||
+			       last_match_end + LZ4_LAST_LITERALS > op)) {
+		return -1;
+	}
+	return op;
+}
+
+static void fill_random(uint8_t *buf, size_t len)
+{
+	uint32_t x = 0x12345678;
+
+	for (size_t i = 0; i != len; ++i) {
+		/* xorshift32 */
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x;
+	}
+}
+
+static void fill_text(uint8_t *buf, size_t len)
+{
+	static const char text[] = "%CESQ: 54,2,23,3 +CEREG: 1,\"4A2C\",\"0143C507\",7 ";
+
+	for (size_t i = 0; i != len; ++i) {
+		buf[i] = text[i % (sizeof(text) - 1)];
+	}
+}
+
+/* Compress src_buf and check that it decompresses back. Returns the compressed length. */
+static size_t round_trip(size_t len)
+{
+	const size_t lz4_len = lz4_compress(src_buf, len, lz4_buf);
+	int ret;
+
+	zassert_true(lz4_len <= LZ4_BOUND(len), "%zu bytes compressed to %zu", len, lz4_len);
+
+	memset(out_buf, 0xAA, sizeof(out_buf));
+	ret = lz4_decompress(lz4_buf, lz4_len, out_buf, sizeof(out_buf));
+	zassert_equal(ret, (int)len, "%zu bytes decompressed to %d", len, ret);
+	zassert_mem_equal(out_buf, src_buf, len, "%zu bytes differ", len);
+
+	return lz4_len;
+}
+
+ZTEST(trace_compress, test_empty_block)
+{
+	zassert_equal(round_trip(0), 1);
+	zassert_equal(lz4_buf[0], 0);
+}
+
+ZTEST(trace_compress, test_short_blocks)
+{
+	/* Blocks too short for a match are only literals. */
+	memset(src_buf, 'A', sizeof(src_buf));
+	for (size_t len = 1; len <= LZ4_MF_LIMIT; ++len) {
+		zassert_equal(round_trip(len), len + 1);
+	}
+	for (size_t len = LZ4_MF_LIMIT + 1; len <= 2 * LZ4_MF_LIMIT; ++len) {
+		round_trip(len);
+	}
+}
+
+ZTEST(trace_compress, test_block_size_edges)
+{
+	const size_t lens[] = { BLOCK_SIZE - 1, BLOCK_SIZE };
+
+	for (size_t i = 0; i != ARRAY_SIZE(lens); ++i) {
+		fill_text(src_buf, lens[i]);
+		zassert_true(round_trip(lens[i]) < lens[i] / 4);
+
+		/* A match that runs to the end of the block, with 255 length extensions */
+		memset(src_buf, 0, lens[i]);
+		zassert_true(round_trip(lens[i]) < 16);
+	}
+}
+
+ZTEST(trace_compress, test_incompressible_block)
+{
+	fill_random(src_buf, BLOCK_SIZE);
+	zassert_true(round_trip(BLOCK_SIZE) > BLOCK_SIZE);
+
+	/* Literals after a match in the middle of the block */
+	memset(&src_buf[BLOCK_SIZE / 2], 0, 64);
+	round_trip(BLOCK_SIZE);
+}
+
+ZTEST(trace_compress, test_frame_build)
+{
+	const uint8_t *hdr = frame.buf;
+	const uint8_t seq = frame.seq;
+
+	/* Incompressible data is sent as is. */
+	fill_random(src_buf, BLOCK_SIZE);
+	frame_build(src_buf, BLOCK_SIZE);
+	zassert_equal(hdr[0], FRAME_MAGIC_0);
+	zassert_equal(hdr[1], FRAME_MAGIC_1);
+	zassert_equal(hdr[2], 0);
+	zassert_equal(hdr[3], seq);
+	zassert_equal(sys_get_le16(&hdr[4]), BLOCK_SIZE);
+	zassert_equal(sys_get_le16(&hdr[6]), BLOCK_SIZE);
+	zassert_mem_equal(&frame.buf[FRAME_HDR_LEN], src_buf, BLOCK_SIZE);
+	zassert_equal(frame.len, FRAME_HDR_LEN + BLOCK_SIZE);
+	zassert_equal(frame.trace_len, BLOCK_SIZE);
+
+	fill_text(src_buf, BLOCK_SIZE);
+	frame_build(src_buf, BLOCK_SIZE);
+	zassert_equal(hdr[2], FRAME_FLAG_LZ4);
+	zassert_equal(hdr[3], (uint8_t)(seq + 1));
+	zassert_equal(sys_get_le16(&hdr[4]), BLOCK_SIZE);
+	zassert_equal(lz4_decompress(&frame.buf[FRAME_HDR_LEN], sys_get_le16(&hdr[6]),
+				     out_buf, sizeof(out_buf)), BLOCK_SIZE);
+	zassert_mem_equal(out_buf, src_buf, BLOCK_SIZE);
+	zassert_equal(frame.trace_len, BLOCK_SIZE);
+}
+
+ZTEST_SUITE(trace_compress, NULL, NULL, NULL, NULL, NULL);